@@ -99,6 +99,7 @@ LOCAL_SRC_FILES := \
   drm/drmconnector.cpp \
   drm/drmcrtc.cpp \
   drm/drmdevice.cpp \
+  drm/drmblobcache.cpp \
   drm/drmencoder.cpp \
   drm/drmeventlistener.cpp \
   drm/drmmode.cpp \
@@ -112,13 +113,19 @@ LOCAL_SRC_FILES := \
   rockchip/compositor/drmdisplaycomposition.cpp \
   rockchip/compositor/drmdisplaycompositor.cpp \
   rockchip/utils/drmdebug.cpp \
+  rockchip/utils/drmtelemetry.cpp \
+  rockchip/utils/drmeventlog.cpp \
+  rockchip/utils/drmsettings.cpp \
   rockchip/common/drmfence.cpp \
   rockchip/common/drmlayer.cpp \
   rockchip/common/drmtype.cpp \
   rockchip/common/drmgralloc.cpp \
   rockchip/common/drmbaseparameter.cpp \
+  rockchip/common/drmdmchint.cpp \
   rockchip/platform/common/platformdrmgeneric.cpp \
   rockchip/platform/common/platform.cpp \
+  rockchip/platform/common/drmbandwidth.cpp \
+  rockchip/platform/common/drmplanebalancer.cpp \
   rockchip/platform/rk3399/drmvop3399.cpp \
   rockchip/platform/rk356x/drmvop356x.cpp \
   rockchip/platform/rk3588/drmvop3588.cpp \
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-drm-blob-cache"
+
+#include "drmblobcache.h"
+#include "drmdevice.h"
+#include "rockchip/utils/drmdebug.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <log/log.h>
+
+namespace android {
+
+static uint64_t BlobHash(const void *data, size_t length){
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = 14695981039346656037ULL;
+  for(size_t i = 0; i < length; i++){
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  hash ^= length;
+  hash *= 1099511628211ULL;
+  return hash;
+}
+
+DrmBlobCache::DrmBlobCache(DrmDevice *drm) : drm_(drm) {
+  iIdleSize_ = hwc_get_int_property("vendor.hwc.blob_cache_size", BLOB_CACHE_SIZE_DEFAULT);
+}
+
+DrmBlobCache::~DrmBlobCache() {
+  Clear();
+}
+
+int DrmBlobCache::Acquire(const void *data, size_t length, uint32_t *blob_id){
+  if(data == NULL || length == 0 || blob_id == NULL)
+    return -EINVAL;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint64_t hash = BlobHash(data, length);
+  auto range = mapHash_.equal_range(hash);
+  for(auto it = range.first; it != range.second; ++it){
+    BlobEntry &entry = mapBlob_[it->second];
+    if(entry.vData_.size() != length || memcmp(entry.vData_.data(), data, length))
+      continue;
+    if(entry.iRefCnt_++ == 0)
+      listIdle_.erase(entry.itIdle_);
+    iHitCnt_++;
+    *blob_id = entry.uBlobId_;
+    HWC2_ALOGD_IF_VERBOSE("hit blob_id=%" PRIu32 " ref=%d", entry.uBlobId_, entry.iRefCnt_);
+    return 0;
+  }
+
+  uint32_t id = 0;
+  int ret = drm_->CreatePropertyBlob(const_cast<void *>(data), length, &id);
+  if(ret){
+    HWC2_ALOGE("CreatePropertyBlob fail, length=%zu ret=%d", length, ret);
+    return ret;
+  }
+  iMissCnt_++;
+
+  BlobEntry &entry = mapBlob_[id];
+  entry.uBlobId_ = id;
+  entry.uHash_ = hash;
+  entry.iRefCnt_ = 1;
+  entry.vData_.assign(static_cast<const uint8_t *>(data),
+                      static_cast<const uint8_t *>(data) + length);
+  mapHash_.emplace(hash, id);
+  *blob_id = id;
+  HWC2_ALOGD_IF_VERBOSE("create blob_id=%" PRIu32 " length=%zu", id, length);
+  return 0;
+}
+
+int DrmBlobCache::Release(uint32_t blob_id){
+  if(!blob_id)
+    return 0;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto it = mapBlob_.find(blob_id);
+  if(it == mapBlob_.end()){
+    // 非缓存创建的 blob, 直接销毁
+    return drm_->DestroyPropertyBlob(blob_id);
+  }
+
+  BlobEntry &entry = it->second;
+  if(entry.iRefCnt_ <= 0){
+    HWC2_ALOGE("blob_id=%" PRIu32 " released too many times.", blob_id);
+    return -EINVAL;
+  }
+  if(--entry.iRefCnt_ == 0){
+    listIdle_.push_front(blob_id);
+    entry.itIdle_ = listIdle_.begin();
+    EvictIdle();
+  }
+  return 0;
+}
+
+void DrmBlobCache::EvictIdle(){
+  while(listIdle_.size() > iIdleSize_){
+    uint32_t blob_id = listIdle_.back();
+    listIdle_.pop_back();
+
+    auto it = mapBlob_.find(blob_id);
+    if(it != mapBlob_.end()){
+      auto range = mapHash_.equal_range(it->second.uHash_);
+      for(auto hash_it = range.first; hash_it != range.second; ++hash_it){
+        if(hash_it->second == blob_id){
+          mapHash_.erase(hash_it);
+          break;
+        }
+      }
+      mapBlob_.erase(it);
+    }
+    drm_->DestroyPropertyBlob(blob_id);
+    iEvictCnt_++;
+  }
+}
+
+void DrmBlobCache::Clear(){
+  std::lock_guard<std::mutex> lock(mtx_);
+  for(auto &blob : mapBlob_)
+    drm_->DestroyPropertyBlob(blob.first);
+  mapBlob_.clear();
+  mapHash_.clear();
+  listIdle_.clear();
+}
+
+void DrmBlobCache::Dump(String8 &output){
+  std::lock_guard<std::mutex> lock(mtx_);
+  output.appendFormat("BlobCache: blobs=%zu idle=%zu/%zu hit=%" PRIu64 " miss=%" PRIu64 " evict=%" PRIu64 "\n",
+                      mapBlob_.size(), listIdle_.size(), iIdleSize_,
+                      iHitCnt_, iMissCnt_, iEvictCnt_);
+  for(auto &blob : mapBlob_){
+    output.appendFormat("  blob_id=%" PRIu32 " ref=%d size=%zu hash=0x%" PRIx64 "\n",
+                        blob.first, blob.second.iRefCnt_,
+                        blob.second.vData_.size(), blob.second.uHash_);
+  }
+}
+
+}  // namespace android
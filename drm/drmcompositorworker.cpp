@@ -21,6 +21,7 @@
 #include "utils/worker.h"
 
 #include <stdlib.h>
+#include <time.h>
 
 #include <log/log.h>
 #include <hardware/hardware.h>
@@ -41,7 +42,8 @@ int DrmCompositorWorker::Init() {
 
 void DrmCompositorWorker::Routine() {
   int ret;
-  if (!compositor_->HaveQueuedComposites()) {
+  if (!compositor_->HaveQueuedComposites() &&
+      !compositor_->HaveCursorUpdate()) {
     Lock();
     int wait_ret = WaitForSignalOrExitLocked(kWaitTimeOut_);
     Unlock();
@@ -52,9 +54,15 @@ void DrmCompositorWorker::Routine() {
       case -EINTR:
         return;
       //close pre-comp for static screen.
-      case -ETIMEDOUT:
+      case -ETIMEDOUT: {
         kWaitTimeOut_ = kWaitTimeOut_ * 2 > 500000000LL? 500000000LL : kWaitTimeOut_ * 2;
+        // Static scene, try to flatten it by writeback.
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        compositor_->Vsync(compositor_->display(),
+                           ts.tv_sec * 1000000000LL + ts.tv_nsec);
         return;
+      }
       default:
         ALOGE("Failed to wait for signal, %d", wait_ret);
         return;
@@ -62,6 +70,16 @@ void DrmCompositorWorker::Routine() {
   }
   kWaitTimeOut_ = 2000000LL;
 
+  // 只有光标位置更新时, 不走完整的合成流程
+  if (!compositor_->HaveQueuedComposites()) {
+    if (compositor_->HaveCursorUpdate()) {
+      ret = compositor_->CommitCursor();
+      if (ret)
+        ALOGE("Failed to commit cursor! %d", ret);
+    }
+    return;
+  }
+
   ret = compositor_->Composite();
   if (ret)
     ALOGE("Failed to composite! %d", ret);
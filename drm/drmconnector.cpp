@@ -185,9 +185,14 @@ int DrmConnector::Init() {
     std::tie(ret,unique_id_) = connector_id_property_.value();
   }
 
-  drm_->GetHdrPanelMetadata(this,&hdr_metadata_);
-  bSupportSt2084_ = drm_->is_hdr_panel_support_st2084(this);
-  bSupportHLG_    = drm_->is_hdr_panel_support_HLG(this);
+  // 已断开时没有有效 EDID, 推迟到热插拔 UpdateModes 时再解析
+  if(state_ != DRM_MODE_DISCONNECTED){
+    drm_->GetHdrPanelMetadata(this,&hdr_metadata_);
+    bSupportSt2084_ = drm_->is_hdr_panel_support_st2084(this);
+    bSupportHLG_    = drm_->is_hdr_panel_support_HLG(this);
+  }else{
+    memset(&hdr_metadata_, 0, sizeof(hdr_metadata_));
+  }
   drmHdr_.clear();
   if(bSupportSt2084_){
       drmHdr_.push_back(DrmHdr(DRM_HWC_HDR10,
@@ -992,12 +997,6 @@ int DrmConnector::switch_hdmi_hdr_mode(drmModeAtomicReqPtr pset,
       return -1;
   }
 
-  // 释放上一次的 Blob
-  if (blob_id_){
-      drm_->DestroyPropertyBlob(blob_id_);
-      blob_id_ = 0;
-  }
-
   struct hdr_output_metadata hdr_metadata;
   memset(&hdr_metadata, 0, sizeof(struct hdr_output_metadata));
 
@@ -1024,10 +1023,26 @@ int DrmConnector::switch_hdmi_hdr_mode(drmModeAtomicReqPtr pset,
   bool hdr_state_update = false;
   if(hdr_metadata_property().id()){
       HWC2_ALOGD_IF_DEBUG("hdr_metadata eotf=0x%x", hdmi_metadata_type.eotf);
-      drm_->CreatePropertyBlob(&hdr_metadata, sizeof(struct hdr_output_metadata), &blob_id_);
-      ret = drmModeAtomicAddProperty(pset, id(), hdr_metadata_property().id(), blob_id_);
-      if (ret < 0) {
-        HWC2_ALOGE("Failed to add prop[%d] to [%d]", hdr_metadata_property().id(), id());
+      uint32_t blob_id = 0;
+      ret = drm_->AcquirePropertyBlob(&hdr_metadata, sizeof(struct hdr_output_metadata), &blob_id);
+      if(ret){
+        // blob_id 为 0 时提交会清除 HDR metadata
+        HWC2_ALOGE("conn-id=%d Failed to create hdr metadata blob ret=%d", id(), ret);
+        return ret;
+      }
+      // metadata 未变化时 blob_id 相同, 属性无需重复提交
+      if(blob_id != blob_id_){
+        ret = drmModeAtomicAddProperty(pset, id(), hdr_metadata_property().id(), blob_id);
+        if (ret < 0) {
+          HWC2_ALOGE("Failed to add prop[%d] to [%d]", hdr_metadata_property().id(), id());
+          drm_->ReleasePropertyBlob(blob_id);
+          return ret;
+        }
+        // 提交成功后才替换 blob_id_, 见 complete_hdmi_hdr_mode
+        drm_->ReleasePropertyBlob(pending_blob_id_);
+        pending_blob_id_ = blob_id;
+      }else{
+        drm_->ReleasePropertyBlob(blob_id);
       }
   }
 
@@ -1053,6 +1068,21 @@ int DrmConnector::switch_hdmi_hdr_mode(drmModeAtomicReqPtr pset,
 
 }
 
+void DrmConnector::complete_hdmi_hdr_mode(int commit_ret){
+  std::unique_lock<std::recursive_mutex> lock(mRecursiveMutex);
+  if(!pending_blob_id_)
+    return;
+
+  if(commit_ret == 0){
+    // 释放上一次的 Blob
+    drm_->ReleasePropertyBlob(blob_id_);
+    blob_id_ = pending_blob_id_;
+  }else{
+    drm_->ReleasePropertyBlob(pending_blob_id_);
+  }
+  pending_blob_id_ = 0;
+}
+
 const DrmProperty &DrmConnector::brightness_id_property() const {
   return brightness_id_property_;
 }
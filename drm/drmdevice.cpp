@@ -33,6 +33,10 @@
 #include <xf86drmMode.h>
 #include <drm_fourcc.h>
 #include <cinttypes>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
 
 #include <cutils/properties.h>
 #include <log/log.h>
@@ -45,7 +49,90 @@
 
 namespace android {
 
-DrmDevice::DrmDevice() : event_listener_(this) {
+// 初始化期间预取单个对象的全部属性:
+//   GetProperty 每按名字查找一次都要 GETPROPERTIES + 逐个 GETPROPERTY,
+//   对象 Init 需要查找几十个属性, 预取后只读取一次.
+//   thread_local, 供线程池中并行初始化不同对象使用.
+class DrmObjectPropertyCache {
+ public:
+  DrmObjectPropertyCache(int fd, uint32_t obj_id, uint32_t obj_type)
+      : obj_id_(obj_id), obj_type_(obj_type), prev_(current_) {
+    props_ = drmModeObjectGetProperties(fd, obj_id, obj_type);
+    if (props_) {
+      for (uint32_t i = 0; i < props_->count_props; i++)
+        prop_ptrs_.push_back(drmModeGetProperty(fd, props_->props[i]));
+    }
+    current_ = this;
+  }
+  ~DrmObjectPropertyCache() {
+    current_ = prev_;
+    for (drmModePropertyPtr p : prop_ptrs_)
+      drmModeFreeProperty(p);
+    if (props_)
+      drmModeFreeObjectProperties(props_);
+  }
+
+  static DrmObjectPropertyCache *Get(uint32_t obj_id, uint32_t obj_type) {
+    if (current_ && current_->props_ &&
+        current_->obj_id_ == obj_id && current_->obj_type_ == obj_type)
+      return current_;
+    return NULL;
+  }
+
+  int Find(const char *prop_name, DrmProperty *property) const {
+    for (size_t i = 0; i < prop_ptrs_.size(); i++) {
+      drmModePropertyPtr p = prop_ptrs_[i];
+      if (p && !strcmp(p->name, prop_name)) {
+        property->Init(p, props_->prop_values[i]);
+        return 0;
+      }
+    }
+    return -ENOENT;
+  }
+
+ private:
+  uint32_t obj_id_;
+  uint32_t obj_type_;
+  drmModeObjectPropertiesPtr props_;
+  std::vector<drmModePropertyPtr> prop_ptrs_;
+  DrmObjectPropertyCache *prev_;
+  static thread_local DrmObjectPropertyCache *current_;
+};
+
+thread_local DrmObjectPropertyCache *DrmObjectPropertyCache::current_ = NULL;
+
+// 在线程池中执行 func(0) ~ func(count - 1), 遇到错误后不再领取新任务, 返回首个错误
+static int ParallelForEach(size_t count, const std::function<int(size_t)> &func) {
+  size_t thread_cnt = std::max(hwc_get_int_property("vendor.hwc.init_threads",
+                                                    INIT_THREADS_DEFAULT), 1);
+  thread_cnt = std::min(thread_cnt, static_cast<size_t>(
+                        std::max(std::thread::hardware_concurrency(), 1u)));
+  thread_cnt = std::min(thread_cnt, count);
+
+  std::atomic<size_t> next(0);
+  std::atomic<int> first_err(0);
+  auto worker = [&]() {
+    size_t index;
+    while (!first_err.load() && (index = next.fetch_add(1)) < count) {
+      int ret = func(index);
+      if (ret) {
+        int expect = 0;
+        first_err.compare_exchange_strong(expect, ret);
+      }
+    }
+  };
+
+  // 当前线程也参与执行
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_cnt; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &t : threads)
+    t.join();
+  return first_err.load();
+}
+
+DrmDevice::DrmDevice() : event_listener_(this), blob_cache_(this) {
 }
 
 DrmDevice::~DrmDevice() {
@@ -451,16 +538,22 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
 
     std::unique_ptr<DrmCrtc> crtc(new DrmCrtc(this, c, i));
     drmModeFreeCrtc(c);
-
-    ret = crtc->Init();
-    if (ret) {
-      ALOGE("Failed to initialize crtc %d", res->crtcs[i]);
-      break;
-    }
-    soc_id_ = crtc->get_soc_id();
     crtcs_.emplace_back(std::move(crtc));
   }
 
+  // 各 crtc 属性读取互不依赖, 并行完成
+  if (!ret) {
+    ret = ParallelForEach(crtcs_.size(), [this](size_t i) {
+      DrmObjectPropertyCache cache(fd(), crtcs_[i]->id(), DRM_MODE_OBJECT_CRTC);
+      int ret = crtcs_[i]->Init();
+      if (ret)
+        ALOGE("Failed to initialize crtc %d", crtcs_[i]->id());
+      return ret;
+    });
+  }
+  for (auto &crtc : crtcs_)
+    soc_id_ = crtc->get_soc_id();
+
   std::vector<int> possible_clones;
   for (int i = 0; !ret && i < res->count_encoders; ++i) {
     drmModeEncoderPtr e = drmModeGetEncoder(fd(), res->encoders[i]);
@@ -494,6 +587,7 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
         encoders_[i]->AddPossibleClone(encoders_[j].get());
   }
 
+  std::vector<std::unique_ptr<DrmConnector>> new_connectors;
   for (int i = 0; !ret && i < res->count_connectors; ++i) {
     drmModeConnectorPtr c = drmModeGetConnector(fd(), res->connectors[i]);
     if (!c) {
@@ -517,14 +611,26 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
         new DrmConnector(this, c, current_encoder, possible_encoders));
 
     drmModeFreeConnector(c);
+    new_connectors.emplace_back(std::move(conn));
+  }
 
-    ret = conn->Init();
-    if (ret) {
-      ALOGE("Init connector %d failed", res->connectors[i]);
-      break;
-    }
-    conn->UpdateModes();
+  if (!ret) {
+    ret = ParallelForEach(new_connectors.size(), [&new_connectors, this](size_t i) {
+      DrmConnector *conn = new_connectors[i].get();
+      DrmObjectPropertyCache cache(fd(), conn->id(), DRM_MODE_OBJECT_CONNECTOR);
+      int ret = conn->Init();
+      if (ret) {
+        ALOGE("Init connector %d failed", conn->id());
+        return ret;
+      }
+      // 已断开的 connector 推迟到热插拔时再探测 mode
+      if (conn->state() != DRM_MODE_DISCONNECTED)
+        conn->UpdateModes();
+      return 0;
+    });
+  }
 
+  for (auto &conn : new_connectors) {
     if (conn->writeback()){
       writeback_connectors_.emplace_back(std::move(conn));
     }else
@@ -667,6 +773,8 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
     return std::make_tuple(-ENOENT, 0);
   }
 
+  std::vector<drmModePlanePtr> new_plane_ptrs;
+  std::vector<std::unique_ptr<DrmPlane>> new_planes;
   for (uint32_t i = 0; i < plane_res->count_planes; ++i) {
     drmModePlanePtr p = drmModeGetPlane(fd(), plane_res->planes[i]);
     if (!p) {
@@ -674,15 +782,26 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
       ret = -ENODEV;
       break;
     }
+    new_plane_ptrs.push_back(p);
+    new_planes.emplace_back(new DrmPlane(this, p, soc_id_));
+  }
 
-    std::unique_ptr<DrmPlane> plane(new DrmPlane(this, p, soc_id_));
+  // plane 数量最多, 属性读取放到线程池中并行完成
+  if (!ret) {
+    ret = ParallelForEach(new_planes.size(), [&new_planes, this](size_t i) {
+      DrmObjectPropertyCache cache(fd(), new_planes[i]->id(), DRM_MODE_OBJECT_PLANE);
+      int ret = new_planes[i]->Init();
+      if (ret)
+        ALOGE("Init plane %d failed", new_planes[i]->id());
+      return ret;
+    });
+  }
 
-    ret = plane->Init();
-    if (ret) {
-      ALOGE("Init plane %d failed", plane_res->planes[i]);
-      drmModeFreePlane(p);
-      break;
-    }
+  // 分组依赖 plane 顺序, 串行完成
+  size_t plane_cnt = ret ? 0 : new_planes.size();
+  for (size_t i = 0; i < plane_cnt; ++i) {
+    drmModePlanePtr p = new_plane_ptrs[i];
+    std::unique_ptr<DrmPlane> plane(std::move(new_planes[i]));
     uint64_t share_id,zpos,crtc_id;
     std::tie(ret, share_id) = plane->share_id_property().value();
     std::tie(ret, zpos) = plane->zpos_property().value();
@@ -715,11 +834,11 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
     }
     sort_planes_.emplace_back(plane.get());
 
-    drmModeFreePlane(p);
-
     planes_.emplace_back(std::move(plane));
 
   }
+  for (drmModePlanePtr p : new_plane_ptrs)
+    drmModeFreePlane(p);
 
   std::sort(sort_planes_.begin(),sort_planes_.end(),PlaneSortByZpos);
 
@@ -972,12 +1091,25 @@ int DrmDevice::DestroyPropertyBlob(uint32_t blob_id) {
   return 0;
 }
 
+int DrmDevice::AcquirePropertyBlob(const void *data, size_t length,
+                                   uint32_t *blob_id) {
+  return blob_cache_.Acquire(data, length, blob_id);
+}
+
+int DrmDevice::ReleasePropertyBlob(uint32_t blob_id) {
+  return blob_cache_.Release(blob_id);
+}
+
 DrmEventListener *DrmDevice::event_listener() {
   return &event_listener_;
 }
 
 int DrmDevice::GetProperty(uint32_t obj_id, uint32_t obj_type,
                            const char *prop_name, DrmProperty *property) {
+  DrmObjectPropertyCache *cache = DrmObjectPropertyCache::Get(obj_id, obj_type);
+  if (cache)
+    return cache->Find(prop_name, property);
+
   drmModeObjectPropertiesPtr props;
 
   props = drmModeObjectGetProperties(fd(), obj_id, obj_type);
@@ -1107,20 +1239,27 @@ int DrmDevice::UpdateDisplayGamma(int display_id){
       gamma_lut[i].green = info->gamma_lut_data.lgreen[i];
       gamma_lut[i].blue = info->gamma_lut_data.lblue[i];
     }
-    ret = drmModeCreatePropertyBlob(fd_.get(), gamma_lut, sizeof(gamma_lut), &blob_id);
+    ret = AcquirePropertyBlob(gamma_lut, sizeof(gamma_lut), &blob_id);
     if(ret){
       ALOGE("%s,line=%d %s crtc-id=%d CreatePropertyBlob  fail.",__FUNCTION__,__LINE__,connector_type_str(conn->type()),crtc->id());
 
       return ret;
     }
-    ret = drmModeObjectSetProperty(fd_.get(), crtc->id(), DRM_MODE_OBJECT_CRTC, crtc->gamma_lut_property().id(), blob_id);
-    if(ret){
-      ALOGE("%s,line=%d %s crtc-id=%d gamma fail.",__FUNCTION__,__LINE__,connector_type_str(conn->type()),crtc->id());
-
-      return ret;
+    // 内容未变化时 blob_id 相同, 无需重新设置
+    DrmCrtcPendingState &pending = mapPendingCrtcState_[crtc->id()];
+    pending.uCrtcId_ = crtc->id();
+    uint32_t last_blob_id = pending.bGamma_ ? pending.uGammaBlob_ : mapGammaBlob_[crtc->id()];
+    if(last_blob_id == blob_id){
+      ReleasePropertyBlob(blob_id);
+      return 0;
     }
-    ALOGD_IF(LogLevel(DBG_VERBOSE),"%s,line=%d, display=%d crtc-id=%d set Gamma success!",__FUNCTION__,__LINE__,
-                                    crtc->id(),display_id);
+    // 在下一帧的原子提交中生效
+    if(pending.bGamma_)
+      ReleasePropertyBlob(pending.uGammaBlob_);
+    pending.bGamma_ = true;
+    pending.uGammaBlob_ = blob_id;
+    ALOGD_IF(LogLevel(DBG_VERBOSE),"%s,line=%d, display=%d crtc-id=%d queue Gamma blob=%d",__FUNCTION__,__LINE__,
+                                    display_id,crtc->id(),blob_id);
   }
 
   return ret;
@@ -1155,20 +1294,27 @@ int DrmDevice::UpdateDisplay3DLut(int display_id){
       cubit_lut[i].green = info->cubic_lut_data.lgreen[i];
       cubit_lut[i].blue = info->cubic_lut_data.lblue[i];
     }
-    ret = drmModeCreatePropertyBlob(fd_.get(), cubit_lut, sizeof(cubit_lut), &blob_id);
+    ret = AcquirePropertyBlob(cubit_lut, sizeof(cubit_lut), &blob_id);
     if(ret){
       ALOGE("%s,line=%d %s crtc-id=%d CreatePropertyBlob  fail.",__FUNCTION__,__LINE__,connector_type_str(conn->type()),crtc->id());
 
       return ret;
     }
-    ret = drmModeObjectSetProperty(fd_.get(), crtc->id(), DRM_MODE_OBJECT_CRTC, crtc->cubic_lut_property().id(), blob_id);
-    if(ret){
-      ALOGE("%s,line=%d %s crtc-id=%d 3D Lut fail.",__FUNCTION__,__LINE__,connector_type_str(conn->type()),crtc->id());
-
-      return ret;
+    // 内容未变化时 blob_id 相同, 无需重新设置
+    DrmCrtcPendingState &pending = mapPendingCrtcState_[crtc->id()];
+    pending.uCrtcId_ = crtc->id();
+    uint32_t last_blob_id = pending.bCubicLut_ ? pending.uCubicLutBlob_ : mapCubicLutBlob_[crtc->id()];
+    if(last_blob_id == blob_id){
+      ReleasePropertyBlob(blob_id);
+      return 0;
     }
-    ALOGD_IF(LogLevel(DBG_VERBOSE),"%s,line=%d, display=%d crtc-id=%d set 3DLut success!",__FUNCTION__,__LINE__,
-                                    crtc->id(),display_id);
+    // 在下一帧的原子提交中生效
+    if(pending.bCubicLut_)
+      ReleasePropertyBlob(pending.uCubicLutBlob_);
+    pending.bCubicLut_ = true;
+    pending.uCubicLutBlob_ = blob_id;
+    ALOGD_IF(LogLevel(DBG_VERBOSE),"%s,line=%d, display=%d crtc-id=%d queue 3DLut blob=%d",__FUNCTION__,__LINE__,
+                                    display_id,crtc->id(),blob_id);
   }
 
   return ret;
@@ -1241,7 +1387,7 @@ int DrmDevice::UpdateDisplayMode(int display_id){
   conn->current_mode().ToDrmModeModeInfo(&drm_mode);
   ALOGD_IF(LogLevel(DBG_VERBOSE),"%s,line=%d, current_mode id=%d , w=%d,h=%d",__FUNCTION__,__LINE__,
             conn->current_mode().id(),conn->current_mode().h_display(),conn->current_mode().v_display());
-  ret = CreatePropertyBlob(&drm_mode, sizeof(drm_mode), &blob_id[0]);
+  ret = AcquirePropertyBlob(&drm_mode, sizeof(drm_mode), &blob_id[0]);
 
   DrmCrtc *crtc = conn->encoder()->crtc();
 
@@ -1256,12 +1402,13 @@ int DrmDevice::UpdateDisplayMode(int display_id){
   if (ret < 0) {
     ALOGE("%s:line=%d Failed to commit pset ret=%d\n", __FUNCTION__, __LINE__, ret);
     drmModeAtomicFree(pset);
+    ReleasePropertyBlob(blob_id[0]);
 
     return ret;
   }
 
   if (blob_id[0])
-    DestroyPropertyBlob(blob_id[0]);
+    ReleasePropertyBlob(blob_id[0]);
 
   conn->set_active_mode(conn->current_mode());
 
@@ -1285,42 +1432,107 @@ int DrmDevice::UpdateVrrRefreshRate(int display_id, int refresh_rate){
 
   DrmCrtc *crtc = conn->encoder()->crtc();
   if(crtc != NULL && crtc->variable_refresh_rate().id() > 0){
-
-    drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
-    if (!pset) {
-      HWC2_ALOGE("%s:line=%d Failed to allocate property set",__FUNCTION__, __LINE__);
-      return -ENOMEM;
-    }
-
     uint64_t min_refresh_rate = 0;
     uint64_t max_refresh_rate = 0;
     std::tie(ret, min_refresh_rate) = crtc->min_refresh_rate().value();
     std::tie(ret, max_refresh_rate) = crtc->max_refresh_rate().value();
     if(refresh_rate < min_refresh_rate) refresh_rate = min_refresh_rate;
     if(refresh_rate > max_refresh_rate) refresh_rate = max_refresh_rate;
-    ret = drmModeAtomicAddProperty(pset, crtc->id(),
-                                  crtc->variable_refresh_rate().id(), refresh_rate) < 0;
-    if (ret) {
-      ALOGE("Failed to add variable_refresh_rate property %d to crtc %d",
-            crtc->variable_refresh_rate().id(), crtc->id());
-      drmModeAtomicFree(pset);
-      return -EINVAL;
-    }
-    // AtomicCommit
-    uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
-    ret = drmModeAtomicCommit(fd_.get(), pset, flags, this);
-    if (ret < 0) {
-      ALOGE("%s:line=%d Failed to commit pset ret=%d\n", __FUNCTION__, __LINE__, ret);
-      drmModeAtomicFree(pset);
-      return ret;
-    }
-    drmModeAtomicFree(pset);
-    HWC2_ALOGI("display-id=%d Update Refresh Rate = %d success!.", display_id, refresh_rate);
+    // 在下一帧的原子提交中生效, 避免与 compositor 的提交竞争
+    DrmCrtcPendingState &pending = mapPendingCrtcState_[crtc->id()];
+    pending.uCrtcId_ = crtc->id();
+    pending.bVrr_ = true;
+    pending.uRefreshRate_ = refresh_rate;
+    HWC2_ALOGI("display-id=%d queue Refresh Rate = %d.", display_id, refresh_rate);
   }
 
   return 0;
 }
 
+int DrmDevice::CollectPendingCrtcState(DrmCrtc *crtc, drmModeAtomicReqPtr pset,
+                                       DrmCrtcPendingState *state){
+  std::unique_lock<std::recursive_mutex> lock(mRecursiveMutex);
+  auto it = mapPendingCrtcState_.find(crtc->id());
+  if(it == mapPendingCrtcState_.end())
+    return 0;
+  *state = it->second;
+  mapPendingCrtcState_.erase(it);
+
+  int ret = 0;
+  if(state->bVrr_)
+    DRM_ATOMIC_ADD_PROP(crtc->id(), crtc->variable_refresh_rate().id(), state->uRefreshRate_);
+  if(state->bGamma_)
+    DRM_ATOMIC_ADD_PROP(crtc->id(), crtc->gamma_lut_property().id(), state->uGammaBlob_);
+  if(state->bCubicLut_)
+    DRM_ATOMIC_ADD_PROP(crtc->id(), crtc->cubic_lut_property().id(), state->uCubicLutBlob_);
+  HWC2_ALOGD_IF_DEBUG("crtc-id=%d vrr=%d(%" PRIu64 ") gamma=%d(%d) cubic_lut=%d(%d)",
+                      crtc->id(), state->bVrr_, state->uRefreshRate_,
+                      state->bGamma_, state->uGammaBlob_,
+                      state->bCubicLut_, state->uCubicLutBlob_);
+  return ret < 0 ? ret : 0;
+}
+
+bool DrmDevice::HasPendingCrtcState(DrmCrtc *crtc){
+  std::unique_lock<std::recursive_mutex> lock(mRecursiveMutex);
+  auto it = mapPendingCrtcState_.find(crtc->id());
+  return it != mapPendingCrtcState_.end() &&
+         (it->second.bVrr_ || it->second.bGamma_ || it->second.bCubicLut_);
+}
+
+void DrmDevice::CompletePendingCrtcState(DrmCrtcPendingState &state, int commit_ret){
+  if(!state.uCrtcId_)
+    return;
+
+  std::unique_lock<std::recursive_mutex> lock(mRecursiveMutex);
+  if(commit_ret == 0){
+    if(state.bGamma_){
+      ReleasePropertyBlob(mapGammaBlob_[state.uCrtcId_]);
+      mapGammaBlob_[state.uCrtcId_] = state.uGammaBlob_;
+    }
+    if(state.bCubicLut_){
+      ReleasePropertyBlob(mapCubicLutBlob_[state.uCrtcId_]);
+      mapCubicLutBlob_[state.uCrtcId_] = state.uCubicLutBlob_;
+    }
+    if(state.bVrr_)
+      HWC2_ALOGI("crtc-id=%d Update Refresh Rate = %" PRIu64 " success!.",
+                 state.uCrtcId_, state.uRefreshRate_);
+  }else if(commit_ret != -EBUSY && commit_ret != -EINTR && commit_ret != -EAGAIN){
+    // 属性本身可能被内核拒绝 (如 LUT 大小不匹配), 重试只会让后续每帧都失败, 直接丢弃
+    HWC2_ALOGE("crtc-id=%d commit fail ret=%d, drop vrr=%d(%" PRIu64 ") gamma=%d cubic_lut=%d.",
+               state.uCrtcId_, commit_ret, state.bVrr_, state.uRefreshRate_,
+               state.bGamma_, state.bCubicLut_);
+    if(state.bGamma_)
+      ReleasePropertyBlob(state.uGammaBlob_);
+    if(state.bCubicLut_)
+      ReleasePropertyBlob(state.uCubicLutBlob_);
+  }else{
+    // 暂时性失败, 放回队列下一帧重试; 期间已有更新的值则丢弃旧值
+    DrmCrtcPendingState &pending = mapPendingCrtcState_[state.uCrtcId_];
+    pending.uCrtcId_ = state.uCrtcId_;
+    if(state.bVrr_ && !pending.bVrr_){
+      pending.bVrr_ = true;
+      pending.uRefreshRate_ = state.uRefreshRate_;
+    }
+    if(state.bGamma_){
+      if(!pending.bGamma_){
+        pending.bGamma_ = true;
+        pending.uGammaBlob_ = state.uGammaBlob_;
+      }else{
+        ReleasePropertyBlob(state.uGammaBlob_);
+      }
+    }
+    if(state.bCubicLut_){
+      if(!pending.bCubicLut_){
+        pending.bCubicLut_ = true;
+        pending.uCubicLutBlob_ = state.uCubicLutBlob_;
+      }else{
+        ReleasePropertyBlob(state.uCubicLutBlob_);
+      }
+    }
+  }
+  state = DrmCrtcPendingState();
+}
+
 // 检查 Connector 状态
 int DrmDevice::CheckConnectorState(int display_id, DrmConnector *conn){
   if (!conn) {
@@ -1572,7 +1784,7 @@ int DrmDevice::BindConnectorAndCrtc(int display_id, DrmConnector* conn, DrmCrtc*
               conn->current_mode().h_display(),
               conn->current_mode().v_display(),
               conn->current_mode().v_refresh());
-  CreatePropertyBlob(&drm_mode, sizeof(drm_mode), &blob_id[0]);
+  AcquirePropertyBlob(&drm_mode, sizeof(drm_mode), &blob_id[0]);
 
   // Enable DrmConnector DPMS on.
   // The note is due to HJC's suggestion that the DRM driver
@@ -1591,6 +1803,7 @@ int DrmDevice::BindConnectorAndCrtc(int display_id, DrmConnector* conn, DrmCrtc*
   if (ret < 0) {
     ALOGE("%s:line=%d Failed to commit pset ret=%d\n", __FUNCTION__, __LINE__, ret);
     drmModeAtomicFree(pset);
+    ReleasePropertyBlob(blob_id[0]);
 
     return ret;
   }
@@ -1598,7 +1811,7 @@ int DrmDevice::BindConnectorAndCrtc(int display_id, DrmConnector* conn, DrmCrtc*
   HWC2_ALOGI("display-id=%d Bind Connector-id=%d Crtc-id=%d success!.",
               display_id, conn->id(), crtc->id());
 
-  DestroyPropertyBlob(blob_id[0]);
+  ReleasePropertyBlob(blob_id[0]);
 
   conn->set_active_mode(conn->current_mode());
 
@@ -125,11 +125,14 @@ void DrmEventListener::UEventHandler() {
 
 void DrmEventListener::Routine() {
   int ret;
+  // select() overwrites the set, keep fds_ intact for the next round.
+  fd_set fds;
   do {
-    ret = select(max_fd_ + 1, &fds_, NULL, NULL, NULL);
+    fds = fds_;
+    ret = select(max_fd_ + 1, &fds, NULL, NULL, NULL);
   } while (ret == -1 && errno == EINTR);
 
-  if (FD_ISSET(drm_->fd(), &fds_)) {
+  if (FD_ISSET(drm_->fd(), &fds)) {
     drmEventContext event_context =
         {.version = 2,
          .vblank_handler = NULL,
@@ -137,7 +140,7 @@ void DrmEventListener::Routine() {
     drmHandleEvent(drm_->fd(), &event_context);
   }
 
-  if (FD_ISSET(uevent_fd_.get(), &fds_))
+  if (FD_ISSET(uevent_fd_.get(), &fds))
     UEventHandler();
 }
 }  // namespace android
@@ -39,6 +39,37 @@ struct plane_rotation_type_name plane_rotation_type_names[] = {
   { DRM_PLANE_ROTATION_Unknown, "unknown" },
 };
 
+#ifndef DRM_FORMAT_NV15
+#define DRM_FORMAT_NV15 fourcc_code('N', 'V', '1', '5')
+#endif
+#ifndef DRM_FORMAT_NV20
+#define DRM_FORMAT_NV20 fourcc_code('N', 'V', '2', '0')
+#endif
+#ifndef DRM_FORMAT_NV30
+#define DRM_FORMAT_NV30 fourcc_code('N', 'V', '3', '0')
+#endif
+
+// 能力位图使用的格式表，下标即格式位，最多 64 项
+static const uint32_t plane_caps_formats[] = {
+  DRM_FORMAT_ARGB8888, DRM_FORMAT_XRGB8888, DRM_FORMAT_ABGR8888, DRM_FORMAT_XBGR8888,
+  DRM_FORMAT_RGBA8888, DRM_FORMAT_RGBX8888, DRM_FORMAT_BGRA8888, DRM_FORMAT_BGRX8888,
+  DRM_FORMAT_RGB888,   DRM_FORMAT_BGR888,   DRM_FORMAT_RGB565,   DRM_FORMAT_BGR565,
+  DRM_FORMAT_ARGB2101010, DRM_FORMAT_ABGR2101010, DRM_FORMAT_XRGB2101010, DRM_FORMAT_XBGR2101010,
+  DRM_FORMAT_NV12, DRM_FORMAT_NV21, DRM_FORMAT_NV16, DRM_FORMAT_NV61,
+  DRM_FORMAT_NV24, DRM_FORMAT_NV42, DRM_FORMAT_NV15, DRM_FORMAT_NV20,
+  DRM_FORMAT_NV30, DRM_FORMAT_YUV420_8BIT, DRM_FORMAT_YUV420_10BIT, DRM_FORMAT_YUYV,
+  DRM_FORMAT_YVYU, DRM_FORMAT_UYVY, DRM_FORMAT_VYUY, DRM_FORMAT_YUV420,
+  DRM_FORMAT_YVU420,
+};
+
+uint64_t DrmPlaneFormatBit(uint32_t fourcc){
+  for(int i = 0; i < ARRAY_SIZE(plane_caps_formats); i++){
+    if(plane_caps_formats[i] == fourcc)
+      return 1ULL << i;
+  }
+  return 0;
+}
+
 DrmPlane::DrmPlane(DrmDevice *drm, drmModePlanePtr p,int soc_id)
     : drm_(drm), id_(p->plane_id),
       possible_crtc_mask_(p->possible_crtcs),
@@ -288,6 +319,8 @@ int DrmPlane::Init() {
     return ret;
   }
 
+  UpdateCaps();
+
 
   return 0;
 }
@@ -593,9 +626,64 @@ int DrmPlane::get_output_h_max(){
     return output_h_max_;
 }
 
+void DrmPlane::UpdateCaps(){
+  caps_.format_mask = 0;
+  caps_.afbc_format_mask = 0;
+  for(int i = 0; i < ARRAY_SIZE(plane_caps_formats); i++){
+    if(is_support_format_slow(plane_caps_formats[i], false))
+      caps_.format_mask |= 1ULL << i;
+    if(is_support_format_slow(plane_caps_formats[i], true))
+      caps_.afbc_format_mask |= 1ULL << i;
+  }
+
+  // 缩放区间，不支持缩放的 Plane 区间收敛为 [1.0, 1.0]
+  caps_.scale_min_inclusive = true;
+  bool scale_range = get_scale();
+  if(isRK3588(soc_id_)){
+    scale_range = (win_type_ & (PLANE_RK3588_ALL_CLUSTER_MASK | PLANE_RK3588_ALL_ESMART_MASK)) > 0;
+    // RK3588 Esmart 不支持最小缩放倍数，见 is_support_scale
+    if((win_type_ & PLANE_RK3588_ALL_CLUSTER_MASK) == 0 &&
+       (win_type_ & PLANE_RK3588_ALL_ESMART_MASK) > 0)
+      caps_.scale_min_inclusive = false;
+  }
+  caps_.scale_min = scale_range ? scale_min_ : 1.0;
+  caps_.scale_max = scale_range ? scale_max_ : 1.0;
+
+  caps_.features = 0;
+  // 8K 模式下 get_scale() 的 Plane 仍可缩放，这里取并集
+  if(get_scale() || caps_.scale_min < 1.0 || caps_.scale_max > 1.0)
+    caps_.features |= DRM_PLANE_CAP_SCALE;
+  if(alpha_property_.id())
+    caps_.features |= DRM_PLANE_CAP_ALPHA;
+  if(b_hdr2sdr_)
+    caps_.features |= DRM_PLANE_CAP_HDR;
+  if(b_yuv_)
+    caps_.features |= DRM_PLANE_CAP_YUV;
+  if(get_afbc())
+    caps_.features |= DRM_PLANE_CAP_AFBC;
+
+  caps_.transform_mask = rotate_ | DRM_PLANE_ROTATION_0;
+
+  caps_.input_w_max  = input_w_max_;
+  caps_.input_h_max  = input_h_max_;
+  caps_.output_w_max = output_w_max_;
+  caps_.output_h_max = output_h_max_;
+
+  HWC2_ALOGD_IF_DEBUG("%s format=0x%" PRIx64 " afbc_format=0x%" PRIx64 " features=0x%x transform=0x%x "
+                      "scale=%s%f,%f] input=%dx%d output=%dx%d",
+                      name_, caps_.format_mask, caps_.afbc_format_mask, caps_.features,
+                      caps_.transform_mask, caps_.scale_min_inclusive ? "[" : "(",
+                      caps_.scale_min, caps_.scale_max, caps_.input_w_max, caps_.input_h_max,
+                      caps_.output_w_max, caps_.output_h_max);
+}
+
 void DrmPlane::set_yuv(bool b_yuv)
 {
     b_yuv_ = b_yuv;
+    if(b_yuv_)
+      caps_.features |= DRM_PLANE_CAP_YUV;
+    else
+      caps_.features &= ~DRM_PLANE_CAP_YUV;
 }
 
 bool DrmPlane::is_use(){
@@ -616,34 +704,30 @@ void DrmPlane::set_reserved(bool bReserved) {
 }
 
 bool DrmPlane::is_support_scale(float scale_rate){
-  if(isRK3588(soc_id_)){
-    if((win_type_ & PLANE_RK3588_ALL_CLUSTER_MASK) > 0)
-      return (scale_rate >= scale_min_) && (scale_rate <= scale_max_);
-    // RK3588 Esmart scale down 1080x1920 => 135x240 颜色出现错误，故认为缩小倍数8倍为不支持
-    else if((win_type_ & PLANE_RK3588_ALL_ESMART_MASK) > 0)
-      return (scale_rate > scale_min_) && (scale_rate <= scale_max_);
-    else
-      return scale_rate == 1.0;
-  }else{
-    if(get_scale()){
-      return (scale_rate >= scale_min_) && (scale_rate <= scale_max_);
-    }else{
-      return scale_rate == 1.0;
-    }
-  }
+  // 区间在 UpdateCaps() 中按平台预先计算
+  if(caps_.scale_min_inclusive ? scale_rate < caps_.scale_min : scale_rate <= caps_.scale_min)
+    return false;
+  return scale_rate <= caps_.scale_max;
 }
 
 bool DrmPlane::is_support_input(int input_w, int input_h){
   // RK platform VOP can't display src/dst w/h < 4 layer.
-  return (input_w <= input_w_max_ && input_w >= 4) && (input_h <= input_h_max_ && input_h >= 4);
+  return (input_w <= caps_.input_w_max && input_w >= 4) && (input_h <= caps_.input_h_max && input_h >= 4);
 }
 
 bool DrmPlane::is_support_output(int output_w, int output_h){
   // RK platform VOP can't display src/dst w/h < 4 layer.
-  return (output_w <= output_w_max_ && output_w >= 4) && (output_h <= output_h_max_ && output_h >= 4);
+  return (output_w <= caps_.output_w_max && output_w >= 4) && (output_h <= caps_.output_h_max && output_h >= 4);
 }
 
 bool DrmPlane::is_support_format(uint32_t format, bool afbcd){
+  uint64_t format_bit = DrmPlaneFormatBit(format);
+  if(format_bit)
+    return (get_format_mask(afbcd) & format_bit) > 0;
+  return is_support_format_slow(format, afbcd);
+}
+
+bool DrmPlane::is_support_format_slow(uint32_t format, bool afbcd){
   if(isRK3588(soc_id_)){
     if((win_type_ & PLANE_RK3588_ALL_CLUSTER_MASK) > 0){
       if(afbcd){
@@ -155,6 +155,9 @@ int ResourceManager::InitProperty() {
   property_get("vendor.hwc.enable_dynamic_display_mode", property_value, "0");
   mDynamicDisplayMode_ = atoi(property_value) > 0;
 
+  property_get("vendor.hwc.solid_color", property_value, "1");
+  mSolidColorMode_ = atoi(property_value) > 0;
+
   return 0;
 }
 
@@ -399,6 +402,72 @@ std::shared_ptr<DrmBuffer> ResourceManager::GetResetWBBuffer(){
   }
   return mResetBackBuffer_;
 }
+std::shared_ptr<DrmBuffer> ResourceManager::GetSolidColorBuffer(hwc_color_t color, int width, int height){
+  std::lock_guard<std::mutex> lock(mtx_);
+  // alpha 由 plane alpha 实现，buffer 只区分 RGB
+  uint64_t key = ((uint64_t)color.r << 48) | ((uint64_t)color.g << 40) |
+                 ((uint64_t)color.b << 32) | ((uint64_t)(width & 0xffff) << 16) |
+                 (uint64_t)(height & 0xffff);
+  auto mapBuffer = mapSolidColorBuffer_.find(key);
+  if(mapBuffer != mapSolidColorBuffer_.end())
+    return mapBuffer->second;
+
+  if(mapSolidColorBuffer_.size() >= SOLID_COLOR_BUFFER_MAX){
+    // 只淘汰没有被图层引用的 buffer, 正在显示的 buffer 不能释放
+    auto unused = mapSolidColorBuffer_.begin();
+    for(; unused != mapSolidColorBuffer_.end(); unused++){
+      if(unused->second.use_count() == 1)
+        break;
+    }
+    if(unused == mapSolidColorBuffer_.end()){
+      HWC2_ALOGD_IF_DEBUG("SolidColorBuffer cache is full, size=%zu", mapSolidColorBuffer_.size());
+      return NULL;
+    }
+    mapSolidColorBuffer_.erase(unused);
+  }
+
+  std::shared_ptr<DrmBuffer> buffer = std::make_shared<DrmBuffer>(width,
+                                                                  height,
+                                                                  HAL_PIXEL_FORMAT_RGBA_8888,
+                                                                  0,
+                                                                  "SolidColorBuffer");
+  if(buffer->Init()){
+    HWC2_ALOGE("DrmBuffer Init fail, w=%d h=%d format=%d name=%s",
+                width, height, HAL_PIXEL_FORMAT_RGBA_8888, "SolidColorBuffer");
+    return NULL;
+  }
+
+  rga_buffer_t dst;
+  im_rect dst_rect;
+  memset(&dst, 0x0, sizeof(dst));
+
+  dst.fd      = buffer->GetFd();
+  dst.width   = buffer->GetWidth();
+  dst.height  = buffer->GetHeight();
+  dst.wstride = buffer->GetStride();
+  dst.hstride = buffer->GetHeightStride();
+  dst.format  = buffer->GetFormat();
+
+  dst_rect.x = 0;
+  dst_rect.y = 0;
+  dst_rect.width  = dst.width;
+  dst_rect.height = dst.height;
+
+  // RGBA8888 内存字节序为 R,G,B,A
+  uint32_t fill_color = color.r | (color.g << 8) | (color.b << 16) | (0xffu << 24);
+  IM_STATUS im_state = imfill(dst, dst_rect, fill_color);
+  if(im_state != IM_STATUS_SUCCESS){
+    HWC2_ALOGE("call im2d fill color [%d,%d,%d] fail, %s",
+               color.r, color.g, color.b, imStrError(im_state));
+    return NULL;
+  }
+
+  mapSolidColorBuffer_.emplace(key, buffer);
+  HWC2_ALOGD_IF_DEBUG("SolidColorBuffer [%d,%d,%d] w=%d h=%d size=%zu",
+                      color.r, color.g, color.b, width, height, mapSolidColorBuffer_.size());
+  return buffer;
+}
+
 std::shared_ptr<DrmBuffer> ResourceManager::GetNextWBBuffer(){
   std::lock_guard<std::mutex> lock(mtx_);
   return mNextWriteBackBuffer_;
@@ -23,12 +23,19 @@
 #include "platform.h"
 #include "vsyncworker.h"
 #include "rockchip/utils/drmdebug.h"
+#include "rockchip/utils/drmsettings.h"
+#include "rockchip/utils/drmtelemetry.h"
+#include "rockchip/utils/drmtrace.h"
 #include "rockchip/drmgralloc.h"
+#include "rockchip/drmdmchint.h"
+#include "rockchip/platform/drmbandwidth.h"
+#include "rockchip/platform/drmplanebalancer.h"
 #include <im2d.hpp>
 #include <drm_fourcc.h>
 #include <rga.h>
 
 #include <inttypes.h>
+#include <algorithm>
 #include <string>
 
 #include <cutils/properties.h>
@@ -98,7 +105,8 @@ DrmHwcTwo::DrmHwcTwo()
 }
 
 HWC2::Error DrmHwcTwo::CreateDisplay(hwc2_display_t displ,
-                                     HWC2::DisplayType type) {
+                                     HWC2::DisplayType type,
+                                     bool init) {
   HWC2_ALOGD_IF_VERBOSE("display-id=%" PRIu64 " type=%s" , displ,
                         (type == HWC2::DisplayType::Physical ? "Physical" : "Virtual"));
 
@@ -112,10 +120,42 @@ HWC2::Error DrmHwcTwo::CreateDisplay(hwc2_display_t displ,
                     std::forward_as_tuple(resource_manager_, drm, importer,
                                           displ, type));
 
-  displays_.at(displ).Init();
+  if(init)
+    displays_.at(displ).Init();
   return HWC2::Error::None;
 }
 
+void DrmHwcTwo::InitSecondaryDisplays(std::vector<hwc2_display_t> displays) {
+  for(auto displ : displays){
+    HWC2::Error ret = displays_.at(displ).Init();
+    HWC2_ALOGD_IF_DEBUG("display-id=%" PRIu64 " async init ret=%d", displ, ret);
+  }
+
+  bool report = false;
+  {
+    std::lock_guard<std::mutex> lock(mtxDisplayInit_);
+    bDisplayInitDone_ = true;
+    cvDisplayInit_.notify_all();
+    report = callbacks_.count(HWC2::Callback::Hotplug) > 0;
+  }
+  HWC2_ALOGI("secondary displays init done, count=%zu", displays.size());
+
+  // 回调 SurfaceFlinger 时不能持锁, 否则与 SF 注册回调互相等待
+  // SurfaceFlinger 已注册 Hotplug 回调, 补报副屏
+  if(report){
+    auto &drmDevices = resource_manager_->GetDrmDevices();
+    for (auto &device : drmDevices)
+      HandleInitialHotplugState(device.get());
+  }
+  for (auto handler : vHotplugHandler_)
+    handler->ReplayDeferredEvent();
+}
+
+void DrmHwcTwo::WaitDisplayInit() {
+  std::unique_lock<std::mutex> lock(mtxDisplayInit_);
+  cvDisplayInit_.wait(lock, [this]{ return bDisplayInitDone_.load(); });
+}
+
 HWC2::Error DrmHwcTwo::Init() {
   HWC2_ALOGD_IF_VERBOSE();
   int rv = resource_manager_->Init(this);
@@ -124,19 +164,49 @@ HWC2::Error DrmHwcTwo::Init() {
     return HWC2::Error::NoResources;
   }
 
+  std::vector<std::string> connector_names;
+  for (auto &drm : resource_manager_->GetDrmDevices()) {
+    for (auto &conn : drm->connectors()) {
+      if (conn->unique_name()[0] != '\0')
+        connector_names.push_back(conn->unique_name());
+    }
+  }
+  DrmSettings::getInstance()->Init(connector_names);
+
+  // 主屏先完成初始化, 副屏交给后台线程, 缩短开机首帧时间
+  bool async_init = hwc_get_bool_property("vendor.hwc.async_display_init",
+                                          ASYNC_DISPLAY_INIT_DEFAULT);
+  std::vector<hwc2_display_t> async_displays;
   HWC2::Error ret = HWC2::Error::None;
   for (auto &map_display : resource_manager_->getDisplays()) {
-    ret = CreateDisplay(map_display.second, HWC2::DisplayType::Physical);
+    bool async = async_init && map_display.second != HWC_DISPLAY_PRIMARY;
+    ret = CreateDisplay(map_display.second, HWC2::DisplayType::Physical, !async);
     if (ret != HWC2::Error::None) {
       ALOGE("Failed to create display %d with error %d", map_display.second, ret);
       return ret;
     }
+    if(async){
+      // PlaneGroup 归属在主屏 Validate 中读取, 分配不能放到后台线程;
+      // 绑定失败 (如未连接) 时直接同步初始化, 后台线程不会再调用 BindDpyRes
+      if(displays_.at(map_display.second).InitDpyRes() == HWC2::Error::None)
+        async_displays.push_back(map_display.second);
+      else
+        displays_.at(map_display.second).Init();
+    }
   }
 
+  if(!async_displays.empty())
+    bDisplayInitDone_ = false;
+
   auto &drmDevices = resource_manager_->GetDrmDevices();
   for (auto &device : drmDevices) {
-    device->RegisterHotplugHandler(new DrmHotplugHandler(this, device.get()));
+    DrmHotplugHandler *handler = new DrmHotplugHandler(this, device.get());
+    vHotplugHandler_.push_back(handler);
+    device->RegisterHotplugHandler(handler);
   }
+
+  if(!async_displays.empty())
+    std::thread(&DrmHwcTwo::InitSecondaryDisplays, this, async_displays).detach();
   return ret;
 }
 
@@ -154,6 +224,7 @@ HWC2::Error DrmHwcTwo::CreateVirtualDisplay(uint32_t width, uint32_t height,
                                             int32_t *format,
                                             hwc2_display_t *display) {
   HWC2_ALOGD_IF_VERBOSE("w=%u,h=%u,f=%d",width,height,*format);
+  WaitDisplayInit();
   HWC2::Error ret = HWC2::Error::None;
   int physical_display_num = resource_manager_->getDisplayCount();
   int virtual_display_id = physical_display_num + mVirtualDisplayCount_;
@@ -188,6 +259,7 @@ HWC2::Error DrmHwcTwo::CreateVirtualDisplay(uint32_t width, uint32_t height,
 HWC2::Error DrmHwcTwo::DestroyVirtualDisplay(hwc2_display_t display) {
 
   HWC2_ALOGD_IF_VERBOSE();
+  WaitDisplayInit();
   auto virtual_display = displays_.find(display);
   if(virtual_display != displays_.end()){
 	  displays_.erase(virtual_display);
@@ -208,6 +280,7 @@ void DrmHwcTwo::Dump(uint32_t *size, char *buffer) {
       *size = static_cast<uint32_t>(copiedBytes);
       return;
   }
+  WaitDisplayInit();
   String8 output;
 
   char acVersion[50] = {0};
@@ -219,6 +292,17 @@ void DrmHwcTwo::Dump(uint32_t *size, char *buffer) {
     if((map_disp.second.DumpDisplayInfo(output)) < 0)
       continue;
   }
+  output.append("\n");
+  DrmBandwidth::getInstance()->Dump(output);
+  DrmDmcHint::getInstance()->Dump(output);
+  DrmPlaneBalancer::getInstance()->Dump(output);
+  DrmSettings::getInstance()->Dump(output);
+  for(auto &drm : resource_manager_->GetDrmDevices())
+    drm->blob_cache()->Dump(output);
+  output.append("\n");
+  DrmTelemetry::getInstance()->Dump(output);
+  output.append("\n");
+  DrmEventLog::Dump(output);
   mDumpString = output.string();
   *size = static_cast<uint32_t>(mDumpString.size());
   return;
@@ -251,6 +335,8 @@ HWC2::Error DrmHwcTwo::RegisterCallback(int32_t descriptor,
       return HWC2::Error::BadParameter;
   }
 
+  std::unique_lock<std::mutex> lock(mtxDisplayInit_);
+
   if (!function) {
     callbacks_.erase(callback);
     switch (callback) {
@@ -273,6 +359,9 @@ HWC2::Error DrmHwcTwo::RegisterCallback(int32_t descriptor,
   }
 
   callbacks_.emplace(callback, HwcCallback(data, function));
+  // 持锁只决定由谁上报副屏, 回调 SurfaceFlinger 前释放
+  bool report_secondary = bDisplayInitDone_;
+  lock.unlock();
 
   switch (callback) {
     case HWC2::Callback::Hotplug: {
@@ -281,6 +370,9 @@ HWC2::Error DrmHwcTwo::RegisterCallback(int32_t descriptor,
               static_cast<int32_t>(HWC2::Connection::Connected));
       // 主屏已经像SurfaceFlinger注册
       mHasRegisterDisplay_.insert(HWC_DISPLAY_PRIMARY);
+      // 副屏仍在后台初始化时, 由 InitSecondaryDisplays 完成后上报
+      if(!report_secondary)
+        break;
       auto &drmDevices = resource_manager_->GetDrmDevices();
       for (auto &device : drmDevices)
         HandleInitialHotplugState(device.get());
@@ -328,6 +420,9 @@ int DrmHwcTwo::HwcDisplay::ClearDisplay() {
      connector_->hwc_state() != HwcConnnectorStete::RELEASE_CRTC){
     compositor_->ClearDisplay();
   }
+  if(crtc_ != NULL)
+    DrmBandwidth::getInstance()->ClearPlan(crtc_);
+  DrmDmcHint::getInstance()->RemoveDisplay(handle_);
   HWC2_ALOGD_IF_VERBOSE("display-id=%" PRIu64,handle_);
   return 0;
 }
@@ -366,12 +461,9 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init() {
     return HWC2::Error::NoResources;
   }
 
-  UpdateDisplayMode();
-  ret = drm_->BindDpyRes(handle_);
-  if (ret) {
-    HWC2_ALOGE("Failed to BindDpyRes for display=%d %d\n", display, ret);
-    return HWC2::Error::NoResources;
-  }
+  HWC2::Error error = InitDpyRes();
+  if(error != HWC2::Error::None)
+    return error;
 
   ret = drm_->UpdateDisplayGamma(handle_);
   if (ret) {
@@ -430,7 +522,7 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init() {
   // Standard Switch Resolution Mode
   ctx_.bStandardSwitchResolution = hwc_get_bool_property("vendor.hwc.enable_display_configs","false");
 
-  HWC2::Error error = ChosePreferredConfig();
+  error = ChosePreferredConfig();
   if(error != HWC2::Error::None){
     ALOGE("Failed to chose prefererd config for display %d (%d)", display, error);
     return error;
@@ -442,6 +534,30 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init() {
 }
 
 
+HWC2::Error DrmHwcTwo::HwcDisplay::InitDpyRes() {
+  if(dpy_res_bound_)
+    return HWC2::Error::None;
+
+  int display = static_cast<int>(handle_);
+  connector_ = drm_->GetConnectorForDisplay(display);
+  if (!connector_) {
+    ALOGE("Failed to get connector for display %d", display);
+    return HWC2::Error::BadDisplay;
+  }
+
+  if(connector_->state() != DRM_MODE_CONNECTED)
+    return HWC2::Error::NoResources;
+
+  UpdateDisplayMode();
+  int ret = drm_->BindDpyRes(handle_);
+  if (ret) {
+    HWC2_ALOGE("Failed to BindDpyRes for display=%d %d\n", display, ret);
+    return HWC2::Error::NoResources;
+  }
+  dpy_res_bound_ = true;
+  return HWC2::Error::None;
+}
+
 HWC2::Error DrmHwcTwo::HwcDisplay::InitVirtual() {
 
   HWC2_ALOGD_IF_VERBOSE("display-id=%" PRIu64 " type=%s",handle_,
@@ -1164,6 +1280,12 @@ HWC2::Error DrmHwcTwo::HwcDisplay::GetReleaseFences(uint32_t *num_elements,
     }
 
     layers[num_layers - 1] = l.first;
+    if(UseKernelOutFence()){
+      // crtc out fence 本身就是上一帧 buffer 的释放时刻.
+      const sp<ReleaseFence> rf = l.second.back_release_fence();
+      fences[num_layers - 1] = rf->isValid() ? dup(rf->getFd()) : -1;
+      continue;
+    }
     fences[num_layers - 1] = l.second.release_fence()->isValid() ? dup(l.second.release_fence()->getFd()) : -1;
     if(LogLevel(DBG_DEBUG))
       HWC2_ALOGD_IF_DEBUG("Check Layer %" PRIu64 " Release(%d) %s Info: size=%d act=%d signal=%d err=%d",
@@ -1270,6 +1392,14 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidatePlanes() {
   std::vector<PlaneGroup *> plane_groups;
   DrmDevice *drm = crtc_->getDrmDevice();
   plane_groups.clear();
+  // 按各 display 负载跨 CRTC 调配 PlaneGroup
+  int donor = DrmPlaneBalancer::getInstance()->Rebalance(drm, crtc_);
+  // 供出方可能是静态画面, 主动刷新使其提交 disable
+  if(donor >= 0 && g_ctx != NULL){
+    auto donor_display = g_ctx->displays_.find(donor);
+    if(donor_display != g_ctx->displays_.end())
+      donor_display->second.InvalidateControl(60, 1);
+  }
   std::vector<PlaneGroup *> all_plane_groups = drm->GetPlaneGroups();
   for(auto &plane_group : all_plane_groups){
     if(plane_group->acquire(1 << crtc_->pipe(), handle_)){
@@ -1287,6 +1417,22 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidatePlanes() {
     return HWC2::Error::BadConfig;
   }
 
+  // 该分配方案曾被内核 TEST_ONLY 拒绝, 直接回退 GLES 合成.
+  if(compositor_->PlanTestEnable()){
+    iPlanSignature_ = GetPlanSignature();
+    if(compositor_->LookupPlan(iPlanSignature_) == -EINVAL){
+      HWC2_ALOGD_IF_DEBUG("plan=0x%" PRIx64 " rejected by kernel, try GLES policy.", iPlanSignature_);
+      std::tie(ret,
+               composition_planes_) = planner_->TryHwcPolicy(layers, plane_groups, crtc_, true);
+      if (ret){
+        ALOGE("Second, GLES policy fail ret=%d", ret);
+        return HWC2::Error::BadConfig;
+      }
+      iPlanSignature_ = GetPlanSignature();
+    }
+  }
+  DrmTelemetry::getInstance()->Mark(handle_, frame_no_, kTmPlanEnd);
+
   for (auto &drm_hwc_layer : drm_hwc_layers_) {
     if(drm_hwc_layer.bFbTarget_){
       if(drm_hwc_layer.bAfbcd_)
@@ -1295,9 +1441,19 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidatePlanes() {
         client_layer_.DisableAfbc();
       continue;
     }
-    if(drm_hwc_layer.bMatch_){
+    if(drm_hwc_layer.bRgaCompose_){
       auto map_hwc2layer = layers_.find(drm_hwc_layer.uId_);
       map_hwc2layer->second.set_validated_type(HWC2::Composition::Device);
+      ALOGD_IF(LogLevel(DBG_INFO),"[%.4" PRIu32 "]=Device-RgaCompose : %s",drm_hwc_layer.uId_,drm_hwc_layer.sLayerName_.c_str());
+    }else if(drm_hwc_layer.bMatch_){
+      auto map_hwc2layer = layers_.find(drm_hwc_layer.uId_);
+      // SolidColor/Cursor 图层由硬件合成时保持原类型, 避免 SurfaceFlinger 认为类型被修改
+      HWC2::Composition validated_type = HWC2::Composition::Device;
+      if(drm_hwc_layer.bSolidColor_)
+        validated_type = HWC2::Composition::SolidColor;
+      else if(drm_hwc_layer.bCursor_ && compositor_->CursorFastPathEnable())
+        validated_type = HWC2::Composition::Cursor;
+      map_hwc2layer->second.set_validated_type(validated_type);
       if(drm_hwc_layer.bUseSvep_){
         ALOGD_IF(LogLevel(DBG_INFO),"[%.4" PRIu32 "]=Device-Svep : %s",drm_hwc_layer.uId_,drm_hwc_layer.sLayerName_.c_str());
       }else{
@@ -1313,10 +1469,99 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidatePlanes() {
   // Update svep state.
   UpdateSvepState();
 #endif
+  // Update ddr scene.
+  UpdateDmcHint();
+  UpdateTelemetry();
+
+  DrmPlaneBalancer *balancer = DrmPlaneBalancer::getInstance();
+  if(balancer->Enable()){
+    int layer_cnt = 0, gles_cnt = 0, used_cnt = 0;
+    for (auto &drm_hwc_layer : drm_hwc_layers_) {
+      if(drm_hwc_layer.bFbTarget_)
+        continue;
+      layer_cnt++;
+      if(!drm_hwc_layer.bMatch_ && !drm_hwc_layer.bRgaCompose_)
+        gles_cnt++;
+    }
+    for(auto &plane_group : plane_groups){
+      if(plane_group->bUse)
+        used_cnt++;
+    }
+    balancer->Record(crtc_, layer_cnt, gles_cnt, plane_groups.size(), used_cnt);
+  }
 
   return HWC2::Error::None;
 }
 
+// 图层分配方案签名: crtc/分辨率 + 每个 plane 及其图层的格式、尺寸、变换等属性,
+// 覆盖 MatchPlane 校验规则所依赖的全部输入.
+uint64_t DrmHwcTwo::HwcDisplay::GetPlanSignature() {
+  uint64_t hash = 14695981039346656037ULL;
+  auto hash_value = [&hash](uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+      hash ^= (value >> (i * 8)) & 0xff;
+      hash *= 1099511628211ULL;
+    }
+  };
+
+  std::vector<DrmHwcLayer *> match_layers;
+  for (auto &drm_hwc_layer : drm_hwc_layers_) {
+    if(drm_hwc_layer.bMatch_)
+      match_layers.push_back(&drm_hwc_layer);
+  }
+
+  hash_value(crtc_->id());
+  hash_value(connector_->active_mode().h_display());
+  hash_value(connector_->active_mode().v_display());
+  for (auto &comp_plane : composition_planes_) {
+    if(comp_plane.type() != DrmCompositionPlane::Type::kLayer ||
+       comp_plane.source_layers().empty())
+      continue;
+    hash_value(comp_plane.plane()->id());
+    hash_value(comp_plane.get_zpos());
+
+    size_t index = comp_plane.source_layers().front();
+    if(index >= match_layers.size())
+      continue;
+    DrmHwcLayer *layer = match_layers[index];
+    hash_value(layer->uFourccFormat_);
+    hash_value(layer->uModifier_);
+    hash_value(layer->bAfbcd_);
+    hash_value(layer->iStride_);
+    hash_value((int)layer->source_crop.left);
+    hash_value((int)layer->source_crop.top);
+    hash_value((int)layer->source_crop.right);
+    hash_value((int)layer->source_crop.bottom);
+    hash_value(layer->display_frame.left);
+    hash_value(layer->display_frame.top);
+    hash_value(layer->display_frame.right);
+    hash_value(layer->display_frame.bottom);
+    hash_value(layer->transform);
+    hash_value((int)layer->blending);
+    hash_value(layer->alpha);
+    hash_value(layer->uEOTF);
+    hash_value(layer->bUseRga_);
+    hash_value(layer->bUseSvep_);
+  }
+
+  // CropSpilt 副屏随主屏提交, 克隆配置一并计入签名
+  for (int display_id : setCloneDisplay_) {
+    DrmConnector *conn = drm_->GetConnectorForDisplay(display_id);
+    if(!conn)
+      continue;
+    int32_t src_x, src_y, src_w, src_h;
+    conn->getCropInfo(&src_x, &src_y, &src_w, &src_h);
+    hash_value(display_id);
+    hash_value(conn->current_mode().h_display());
+    hash_value(conn->current_mode().v_display());
+    hash_value(src_x);
+    hash_value(src_y);
+    hash_value(src_w);
+    hash_value(src_h);
+  }
+  return hash;
+}
+
 void DrmHwcTwo::HwcDisplay::UpdateSvepState() {
 
   // 只有主屏可以开启SVEP模式，其他屏幕不需要更新SVEP状态
@@ -1341,23 +1586,88 @@ void DrmHwcTwo::HwcDisplay::UpdateSvepState() {
     }
 
     // update ddr state
-    int fd_ddr_state = open("/sys/class/devfreq/dmc/system_status", O_WRONLY);
-    if (fd_ddr_state < 0) {
-        HWC2_ALOGD_IF_DEBUG("failed to open /sys/class/devfreq/dmc/system_status ret =%d", fd_ddr_state);
-    }else{
-      if(exist_svep_layer){
-        // S 状态是专门提供给SVEP的场景变频, 进入SVEP场景变频
-        write(fd_ddr_state, "S", sizeof(char));
-      }else{
-        // s 状态是专门提供给SVEP的场景变频, 退出SVEP场景变频
-        write(fd_ddr_state, "s", sizeof(char));
-      }
-      close(fd_ddr_state);
-    }
+    DrmDmcHint::getInstance()->SetSvepState(exist_svep_layer);
   }
   return ;
 }
 
+void DrmHwcTwo::HwcDisplay::UpdateDmcHint() {
+  if(crtc_ == NULL)
+    return;
+
+  // 扫描带宽 + RGA/SVEP 预处理带宽
+  DrmBandwidth *bandwidth = DrmBandwidth::getInstance();
+  uint64_t total = bandwidth->DisplayBandwidth(crtc_);
+  for (auto &drm_hwc_layer : drm_hwc_layers_) {
+    if(drm_hwc_layer.bMatch_)
+      total += bandwidth->PostProcessBandwidth(&drm_hwc_layer, crtc_);
+  }
+  DrmDmcHint::getInstance()->UpdateDisplay(handle_, total);
+}
+
+void DrmHwcTwo::HwcDisplay::UpdateTelemetry() {
+  TelemetryFrameInfo info;
+  memset(&info, 0, sizeof(info));
+  bool use_gles = false;
+  int64_t gles_area = 0;
+  for (auto &drm_hwc_layer : drm_hwc_layers_) {
+    if(drm_hwc_layer.bFbTarget_){
+      use_gles = drm_hwc_layer.bMatch_;
+      continue;
+    }
+    if(drm_hwc_layer.bRgaCompose_){
+      info.rga_cnt++;
+      continue;
+    }
+    if(!drm_hwc_layer.bMatch_){
+      info.gles_cnt++;
+      gles_area += (int64_t)(drm_hwc_layer.display_frame.right - drm_hwc_layer.display_frame.left) *
+                   (drm_hwc_layer.display_frame.bottom - drm_hwc_layer.display_frame.top);
+      continue;
+    }
+    info.overlay_cnt++;
+    if(drm_hwc_layer.bUseRga_)
+      info.rga_cnt++;
+    if(drm_hwc_layer.bUseSvep_)
+      info.svep_cnt++;
+  }
+
+  if(info.svep_cnt > 0)
+    info.policy = kTmPolicySvep;
+  else if(info.rga_cnt > 0)
+    info.policy = kTmPolicyRga;
+  else if(!use_gles)
+    info.policy = kTmPolicyOverlay;
+  else if(info.overlay_cnt == 0)
+    info.policy = kTmPolicyGles;
+  else
+    info.policy = kTmPolicyMix;
+
+  if(crtc_ != NULL)
+    info.bandwidth_mb = DrmBandwidth::getInstance()->DisplayBandwidth(crtc_) / 1000000;
+  DrmTelemetry::getInstance()->SetFrameInfo(handle_, frame_no_, info);
+
+  if(!HwcTraceEnabled())
+    return;
+  int plane_cnt = 0;
+  for (auto &comp_plane : composition_planes_) {
+    if(comp_plane.type() == DrmCompositionPlane::Type::kLayer)
+      plane_cnt++;
+  }
+  int buffer_cnt = 0, buffer_hit_cnt = 0;
+  for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_){
+    if(l.second.buffer() == NULL)
+      continue;
+    buffer_cnt++;
+    buffer_hit_cnt += l.second.buffer_cache_hit();
+  }
+  HwcTraceCounter(handle_, "Planes", plane_cnt);
+  HwcTraceCounter(handle_, "GlesArea", gles_area);
+  HwcTraceCounter(handle_, "BandwidthMB", info.bandwidth_mb);
+  if(buffer_cnt > 0)
+    HwcTraceCounter(handle_, "BufferCacheHit%", buffer_hit_cnt * 100 / buffer_cnt);
+}
+
 bool DrmHwcTwo::HwcDisplay::IsLayerStateChange() {
   bool is_state_change = false;
   if(!resource_manager_->IsDropMode()){
@@ -1383,6 +1693,11 @@ bool DrmHwcTwo::HwcDisplay::IsLayerStateChange() {
     is_state_change = true;
   }
 
+  // 刷新率 / gamma / 3D LUT 需要随帧提交, 不能跳过
+  if(crtc_ && drm_->HasPendingCrtcState(crtc_)){
+    is_state_change = true;
+  }
+
   if(is_state_change){
     return is_state_change;
   }else{
@@ -1394,6 +1709,7 @@ bool DrmHwcTwo::HwcDisplay::IsLayerStateChange() {
 
 int DrmHwcTwo::HwcDisplay::ImportBuffers() {
   int ret = 0;
+  int gem_cnt = 0, gem_hit_cnt = 0;
   // 匹配 DrmPlane 图层，请求获取 GemHandle
   bool use_client_layer = false;
   for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_){
@@ -1412,6 +1728,9 @@ int DrmHwcTwo::HwcDisplay::ImportBuffers() {
       // 如果是超分处理后的图层，已经更新了GemHandle参数，则不再获取GemHandle
       if(drm_hwc_layer.bUseRga_)
         continue;
+      // SolidColor 图层使用填充 buffer 的 GemHandle
+      if(drm_hwc_layer.bSolidColor_)
+        continue;
 
       if(drm_hwc_layer.uId_ == l.first){
         int ret = l.second.initOrGetGemhanleFromCache(&drm_hwc_layer);
@@ -1419,6 +1738,8 @@ int DrmHwcTwo::HwcDisplay::ImportBuffers() {
           ALOGE("Failed to get_gemhanle layer-id=%" PRIu64  ", ret=%d", l.first, ret);
           return ret;
         }
+        gem_cnt++;
+        gem_hit_cnt += l.second.gem_cache_hit();
       }
     }
   }
@@ -1434,6 +1755,8 @@ int DrmHwcTwo::HwcDisplay::ImportBuffers() {
           ALOGE("Failed to get_gemhanle client_layer, ret=%d", ret);
           return ret;
         }
+        gem_cnt++;
+        gem_hit_cnt += client_layer_.gem_cache_hit();
 #ifdef USE_LIBPQ
         if(handle_ == 0){
           int ret = client_layer_.DoPq(false, &drm_hwc_layer, &ctx_);
@@ -1446,7 +1769,11 @@ int DrmHwcTwo::HwcDisplay::ImportBuffers() {
     }
   }
 
+  if(gem_cnt > 0)
+    HwcTraceCounter(handle_, "GemCacheHit%", gem_hit_cnt * 100 / gem_cnt);
+
   // 所有匹配 DrmPlane 图层，请求 Import 获取 FbId
+  int fb_cnt = 0;
   for (auto &drm_hwc_layer : drm_hwc_layers_) {
     if(!use_client_layer && drm_hwc_layer.bFbTarget_)
       continue;
@@ -1459,7 +1786,10 @@ int DrmHwcTwo::HwcDisplay::ImportBuffers() {
       ALOGE("Failed to import layer, ret=%d", ret);
       return ret;
     }
+    fb_cnt++;
   }
+  // FbId 每帧重新创建，没有缓存，记录每帧 AddFB 次数
+  HwcTraceCounter(handle_, "FbImport", fb_cnt);
 
   return ret;
 }
@@ -1500,14 +1830,22 @@ HWC2::Error DrmHwcTwo::HwcDisplay::CreateComposition() {
       HWC2_ALOGE("Failed to ImportBuffers, ret=%d", ret);
       return HWC2::Error::NoResources;
   }
+  DrmTelemetry::getInstance()->Mark(handle_, frame_no_, kTmImportEnd);
 
+  // 仅 FB-target 送显的 GLES 方案已无可回退, 不做 TEST_ONLY 校验
+  bool fb_target_only = true;
   for (auto &drm_hwc_layer : drm_hwc_layers_) {
+    if(drm_hwc_layer.bMatch_ && !drm_hwc_layer.bFbTarget_)
+      fb_target_only = false;
     if(drm_hwc_layer.bMatch_)
       map.layers.emplace_back(std::move(drm_hwc_layer));
   }
 
   std::unique_ptr<DrmDisplayComposition> composition = compositor_->CreateComposition();
   composition->Init(drm_, crtc_, importer_.get(), planner_.get(), frame_no_, handle_);
+  // 帧级 trace 交给 composition，在 SignalCompositionDone 时结束
+  composition->set_trace_frame(bTraceFrame_);
+  bTraceFrame_ = false;
 
   // TODO: Don't always assume geometry changed
   ret = composition->SetLayers(map.layers.data(), map.layers.size(), true);
@@ -1524,13 +1862,51 @@ HWC2::Error DrmHwcTwo::HwcDisplay::CreateComposition() {
     return HWC2::Error::BadConfig;
   }
 
+  // CropSpilt 副屏复用主屏 FB-target, 与主屏在同一次原子提交中更新
+  int clone_cnt = AddCloneComposition(composition.get());
+
+  // 新的分配方案先经内核 TEST_ONLY 校验, 失败则保持上一帧并请求重新 Validate,
+  // 下一次 Validate 将回退 GLES 合成, 避免提交失败导致 ClearDisplay.
+  // 签名与 ValidatePlanes 查询时一致, 已包含克隆配置.
+  composition->set_plan_signature(iPlanSignature_);
+  if((!fb_target_only || clone_cnt > 0) &&
+     compositor_->TestPlan(composition.get(), clone_cnt == 0)){
+    HWC2_ALOGE("display=%" PRIu64 " frame_no=%d plan=0x%" PRIx64 " TEST_ONLY fail, drop frame.",
+               handle_, frame_no_, iPlanSignature_);
+    // 克隆提交失败不作为永久拒绝, 副屏退回 DoMirrorDisplay 重新完成 modeset
+    if(clone_cnt > 0)
+      setCloneDisplay_.clear();
+    for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_){
+        l.second.set_release_fence(l.second.back_release_fence());
+    }
+    d_retire_fence_.add(d_retire_fence_.get_back());
+    InvalidateControl(60, 1);
+    return HWC2::Error::None;
+  }
+
+  // 方案已确定送显, 提交 Validate 中推迟的 RGA 预合成任务
+  ret = planner_->RunDeferredJobs(composition->layers());
+  if(ret){
+    HWC2_ALOGE("display=%" PRIu64 " frame_no=%d run deferred jobs fail ret=%d, drop frame.",
+               handle_, frame_no_, ret);
+    for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_){
+        l.second.set_release_fence(l.second.back_release_fence());
+    }
+    d_retire_fence_.add(d_retire_fence_.get_back());
+    InvalidateControl(60, 1);
+    return HWC2::Error::None;
+  }
+
+  if(UseKernelOutFence())
+    return CreateCompositionWithOutFence(std::move(composition));
+
   // 利用 vendor.hwc.disable_releaseFence 属性强制关闭ReleaseFence，主要用于调试
   char value[PROPERTY_VALUE_MAX];
   property_get("vendor.hwc.disable_releaseFence", value, "0");
   if(atoi(value) == 0){
     ret = composition->CreateAndAssignReleaseFences(sync_timeline_);
     for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_){
-      if(l.second.sf_type() == HWC2::Composition::Device){
+      if(l.second.plane_backed()){
         sp<ReleaseFence> rf = composition->GetReleaseFence(l.first);
         l.second.set_release_fence(rf);
       }else{
@@ -1549,6 +1925,40 @@ HWC2::Error DrmHwcTwo::HwcDisplay::CreateComposition() {
   return HWC2::Error::None;
 }
 
+// crtc OUT_FENCE_PTR 模式: 第 N 帧的 out fence 即是第 N 帧的 RetireFence,
+// 也是第 N-1 帧图层的 ReleaseFence, 所以无需再延迟一帧返回.
+HWC2::Error DrmHwcTwo::HwcDisplay::CreateCompositionWithOutFence(
+    std::unique_ptr<DrmDisplayComposition> composition) {
+  HWC2_ALOGD_IF_VERBOSE("display-id=%" PRIu64,handle_);
+
+  // 配置 HDR mode
+  composition->SetDisplayHdrMode(ctx_.hdr_mode, ctx_.dataspace);
+
+  int out_fence = -1;
+  uint64_t frame_no = composition->frame_no();
+  int ret = compositor_->QueueComposition(std::move(composition));
+  if(!ret)
+    out_fence = compositor_->WaitOutFence(static_cast<int>(handle_), frame_no);
+
+  sp<ReleaseFence> rf = ReleaseFence::NO_FENCE;
+  if(out_fence >= 0){
+    char acBuf[32];
+    sprintf(acBuf,"OFD%" PRIu64 "-FN%d", handle_, frame_no_);
+    rf = sp<ReleaseFence>(new ReleaseFence(out_fence, acBuf));
+  }
+
+  for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_){
+    if(l.second.plane_backed()){
+      l.second.set_release_fence(rf);
+    }else{
+      l.second.set_release_fence(ReleaseFence::NO_FENCE);
+    }
+  }
+  client_layer_.set_release_fence(rf);
+  d_retire_fence_.add(rf);
+  return HWC2::Error::None;
+}
+
 HWC2::Error DrmHwcTwo::HwcDisplay::PresentVirtualDisplay(int32_t *retire_fence) {
   ATRACE_CALL();
 
@@ -1777,6 +2187,7 @@ HWC2::Error DrmHwcTwo::HwcDisplay::PresentDisplay(int32_t *retire_fence) {
   }
 
   DumpAllLayerData();
+  HWC_FRAME_TRACE("Present", handle_, frame_no_);
 
   HWC2::Error ret;
   ret = CheckDisplayState();
@@ -1795,30 +2206,38 @@ HWC2::Error DrmHwcTwo::HwcDisplay::PresentDisplay(int32_t *retire_fence) {
       return ret;
   }
 
+  // crtc out fence 模式下当前帧的 fence 已经是真实的上屏时刻, 无需延迟一帧.
+  const sp<ReleaseFence> d_retire_fence = UseKernelOutFence() ? d_retire_fence_.get_back()
+                                                              : d_retire_fence_.get();
   int32_t merge_retire_fence = -1;
   DoMirrorDisplay(&merge_retire_fence);
   if(merge_retire_fence > 0){
-    if(d_retire_fence_.get()->isValid()){
+    if(d_retire_fence->isValid()){
       char acBuf[32];
       sprintf(acBuf,"RTD%" PRIu64 "M-FN%d-%d", handle_, frame_no_, 0);
       sp<ReleaseFence> rt = sp<ReleaseFence>(new ReleaseFence(merge_retire_fence, acBuf));
-      *retire_fence = rt->merge(d_retire_fence_.get()->getFd(), acBuf);
+      *retire_fence = rt->merge(d_retire_fence->getFd(), acBuf);
     }else{
       *retire_fence = merge_retire_fence;
     }
   }else{
     // The retire fence returned here is for the last frame, so return it and
     // promote the next retire fence
-    *retire_fence = d_retire_fence_.get()->isValid() ? dup(d_retire_fence_.get()->getFd()) : -1;
+    *retire_fence = d_retire_fence->isValid() ? dup(d_retire_fence->getFd()) : -1;
     if(LogLevel(DBG_DEBUG)){
       HWC2_ALOGD_IF_DEBUG("Return RetireFence(%d) %s frame = %d Info: size=%d act=%d signal=%d err=%d",
-                      d_retire_fence_.get()->isValid(),
-                      d_retire_fence_.get()->getName().c_str(), frame_no_,
-                      d_retire_fence_.get()->getSize(),d_retire_fence_.get()->getActiveCount(),
-                      d_retire_fence_.get()->getSignaledCount(),d_retire_fence_.get()->getErrorCount());
+                      d_retire_fence->isValid(),
+                      d_retire_fence->getName().c_str(), frame_no_,
+                      d_retire_fence->getSize(),d_retire_fence->getActiveCount(),
+                      d_retire_fence->getSignaledCount(),d_retire_fence->getErrorCount());
     }
   }
 
+  // 本帧未生成 composition (丢帧或 Validate 失败)，在此结束帧级 trace
+  if(bTraceFrame_){
+    HwcTraceFrameEnd(handle_, frame_no_);
+    bTraceFrame_ = false;
+  }
   ++frame_no_;
 
   UpdateTimerState(!static_screen_opt_);
@@ -2213,13 +2632,28 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidateDisplay(uint32_t *num_types,
     HWC2_ALOGE("init_success_=%d skip.",init_success_);
     return HWC2::Error::BadDisplay;
   }
-  // Enable/disable debug log
-  UpdateLogLevel();
-  UpdateBCSH();
-  UpdateHdmiOutputFormat();
-  UpdateOverscan();
+  DrmTelemetry::getInstance()->Begin(handle_, frame_no_);
+  // 同一帧可能多次 Validate，只在第一次开始帧级 trace
+  if(!bTraceFrame_){
+    HwcTraceFrameBegin(handle_, frame_no_);
+    bTraceFrame_ = true;
+  }
+  HWC_FRAME_TRACE("Validate", handle_, frame_no_);
+  // 显示设置只在 generation 变化或热插拔后重新读取
+  DrmSettings *settings = DrmSettings::getInstance();
+  uint64_t settings_generation = settings->Generation();
+  if(!settings->Enable() || settings_generation != uSettingsGeneration_ ||
+     ctx_.hotplug_timeline != drm_->timeline()){
+    uSettingsGeneration_ = settings_generation;
+    // Enable/disable debug log
+    UpdateLogLevel();
+    UpdateBCSH();
+    UpdateHdmiOutputFormat();
+    UpdateOverscan();
+    if(!ctx_.bStandardSwitchResolution)
+      UpdateDisplayMode();
+  }
   if(!ctx_.bStandardSwitchResolution){
-    UpdateDisplayMode();
     drm_->UpdateDisplayMode(handle_);
     if(isRK3566(resource_manager_->getSocId())){
       int display_id = drm_->GetCommitMirrorDisplayId();
@@ -2264,6 +2698,11 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidateDisplay(uint32_t *num_types,
     HWC2_ALOGD_IF_DEBUG("display=%d drop frame_no=%d!", static_cast<int>(handle_), frame_no_);
     for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_)
       l.second.set_validated_type(HWC2::Composition::Device);
+    TelemetryFrameInfo info;
+    memset(&info, 0, sizeof(info));
+    info.policy = kTmPolicyDrop;
+    DrmTelemetry::getInstance()->SetFrameInfo(handle_, frame_no_, info);
+    DrmTelemetry::getInstance()->Mark(handle_, frame_no_, kTmValidateEnd);
     return HWC2::Error::None;
   }
 
@@ -2282,7 +2721,9 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidateDisplay(uint32_t *num_types,
   for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_) {
     DrmHwcTwo::HwcLayer &layer = l.second;
     // We can only handle layers of Device type, send everything else to SF
-    if (layer.validated_type() != HWC2::Composition::Device) {
+    if (layer.validated_type() != HWC2::Composition::Device &&
+        layer.validated_type() != HWC2::Composition::SolidColor &&
+        layer.validated_type() != HWC2::Composition::Cursor) {
       layer.set_validated_type(HWC2::Composition::Client);
       ++*num_types;
     }
@@ -2292,6 +2733,7 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidateDisplay(uint32_t *num_types,
     ++(*num_requests);
   }
   validate_success_ = true;
+  DrmTelemetry::getInstance()->Mark(handle_, frame_no_, kTmValidateEnd);
   return *num_types ? HWC2::Error::HasChanges : HWC2::Error::None;
 }
 
@@ -2302,6 +2744,43 @@ HWC2::Error DrmHwcTwo::HwcLayer::SetCursorPosition(int32_t x, int32_t y) {
   return HWC2::Error::None;
 }
 
+HWC2::Error DrmHwcTwo::HwcDisplay::SetCursorPosition(hwc2_layer_t layer,
+                                                     int32_t x, int32_t y) {
+  auto map_layer = layers_.find(layer);
+  if (map_layer == layers_.end())
+    return HWC2::Error::BadLayer;
+
+  HwcLayer &hwc_layer = map_layer->second;
+  hwc_layer.SetCursorPosition(x, y);
+  if(compositor_ == NULL ||
+     hwc_layer.validated_type() != HWC2::Composition::Cursor)
+    return HWC2::Error::None;
+
+  // 光标独占 plane 时只更新该 plane 的位置, 不需要 SF 重新 validate/present
+  const hwc_rect_t &frame = hwc_layer.display_frame();
+  hwc_rect_t cursor_frame;
+  cursor_frame.left   = x;
+  cursor_frame.top    = y;
+  cursor_frame.right  = x + frame.right - frame.left;
+  cursor_frame.bottom = y + frame.bottom - frame.top;
+
+  DrmHwcLayer cursor_layer;
+  cursor_layer.SetDisplayFrame(cursor_frame, &ctx_);
+  const hwc_rect_t &dst = cursor_layer.display_frame;
+  int ret = -EINVAL;
+  if(dst.left >= 0 && dst.top >= 0 &&
+     dst.right <= (int)connector_->active_mode().h_display() &&
+     dst.bottom <= (int)connector_->active_mode().v_display())
+    ret = compositor_->SetCursorPosition(handle_, dst.left, dst.top);
+
+  if(ret){
+    HWC2_ALOGD_IF_DEBUG("display-id=%" PRIu64 " layer-id=%" PRIu64 " cursor fast path fail ret=%d, invalidate.",
+                        handle_, layer, ret);
+    InvalidateControl(60, 1);
+  }
+  return HWC2::Error::None;
+}
+
 int DrmHwcTwo::HwcDisplay::DumpDisplayInfo(String8 &output){
 
   output.appendFormat(" DisplayId=%" PRIu64 ", Connector %u, Type = %s-%u, Connector state = %s\n",handle_,
@@ -2714,6 +3193,92 @@ int DrmHwcTwo::HwcDisplay::InvalidateControl(uint64_t refresh, int refresh_cnt){
     return 0;
 }
 
+int DrmHwcTwo::HwcDisplay::AddCloneComposition(DrmDisplayComposition *composition){
+  if(handle_ != 0 || !connector_->isCropSpilt() || setCloneDisplay_.empty())
+    return 0;
+
+  // CropSpilt 模式下主屏强制 GLES, FB-target 即完整画面
+  std::vector<DrmHwcLayer> &layers = composition->layers();
+  size_t fb_index = layers.size();
+  for(size_t i = 0; i < layers.size(); i++){
+    if(layers[i].bFbTarget_){
+      fb_index = i;
+      break;
+    }
+  }
+  if(fb_index == layers.size())
+    return 0;
+  DrmHwcLayer &fb_layer = layers[fb_index];
+
+  int clone_cnt = 0;
+  for (auto &conn : drm_->connectors()) {
+    int display_id = conn->display();
+    if(!conn->isCropSpilt() || display_id == 0 ||
+       conn->state() != DRM_MODE_CONNECTED ||
+       !setCloneDisplay_.count(display_id))
+      continue;
+
+    DrmCrtc *crtc = drm_->GetCrtcForDisplay(display_id);
+    const DrmMode &mode = conn->current_mode();
+    if(!crtc || mode.h_display() == 0 || mode.v_display() == 0)
+      continue;
+
+    int32_t src_x, src_y, src_w, src_h;
+    conn->getCropInfo(&src_x, &src_y, &src_w, &src_h);
+    hwc_frect_t crop = {.left = src_x + 0.0f,
+                        .top = src_y + 0.0f,
+                        .right = src_x + src_w + 0.0f,
+                        .bottom = src_y + src_h + 0.0f};
+    hwc_rect_t frame = {.left = 0,
+                        .top = 0,
+                        .right = static_cast<int>(mode.h_display()),
+                        .bottom = static_cast<int>(mode.v_display())};
+    float h_scale = (src_w * 1.0) / mode.h_display();
+    float v_scale = (src_h * 1.0) / mode.v_display();
+
+    // 在副屏自己的 PlaneGroup 中选一个 plane 送显, 其余 plane 一并关闭
+    DrmPlane *clone_plane = NULL;
+    std::vector<DrmPlane *> disable_planes;
+    uint32_t crtc_mask = 1 << crtc->pipe();
+    for(PlaneGroup *plane_group : drm_->GetPlaneGroups()){
+      if(plane_group->bReserved || !plane_group->acquire(crtc_mask, display_id))
+        continue;
+      for(DrmPlane *plane : plane_group->planes){
+        if(clone_plane == NULL &&
+           plane->is_support_format(fb_layer.uFourccFormat_, fb_layer.bAfbcd_) &&
+           plane->is_support_input(src_w, src_h) &&
+           plane->is_support_output(frame.right, frame.bottom) &&
+           plane->is_support_scale(h_scale) &&
+           plane->is_support_scale(v_scale)){
+          clone_plane = plane;
+          continue;
+        }
+        disable_planes.push_back(plane);
+      }
+    }
+
+    // 未找到可用 plane 时不触碰副屏, 保持上一帧
+    if(clone_plane == NULL){
+      HWC2_ALOGE("display=%d connector %u can't find plane to clone FB-target, keep last frame.",
+                 display_id, conn->id());
+      continue;
+    }
+    for(DrmPlane *plane : disable_planes)
+      composition->AddPlaneDisable(plane);
+
+    DrmCompositionPlane clone(DrmCompositionPlane::Type::kLayer, clone_plane,
+                              crtc, fb_index, true);
+    clone.set_zpos(0);
+    clone.set_mirror_rect(crop, frame);
+    composition->AddPlaneComposition(std::move(clone));
+    clone_cnt++;
+    HWC2_ALOGD_IF_DEBUG("display=%d clone plane=%d crtc=%d crop[%d,%d,%d,%d] frame[%d,%d]",
+                        display_id, clone_plane->id(), crtc->id(),
+                        src_x, src_y, src_w, src_h, frame.right, frame.bottom);
+  }
+  return clone_cnt;
+}
+
 int DrmHwcTwo::HwcDisplay::DoMirrorDisplay(int32_t *retire_fence){
   if(handle_ != 0)
     return 0;
@@ -2722,64 +3287,83 @@ int DrmHwcTwo::HwcDisplay::DoMirrorDisplay(int32_t *retire_fence){
     return 0;
   }
 
-  int32_t merge_rt_fence;
+  // 副屏尚未完成后台初始化
+  if(!resource_manager_->GetHwc2()->IsDisplayInitDone())
+    return 0;
+
+  int32_t merge_rt_fence = -1;
   int32_t display_cnt = 1;
   for (auto &conn : drm_->connectors()) {
     if(!conn->isCropSpilt()){
       continue;
     }
     int display_id = conn->display();
-    if(display_id != 0){
-      auto &display = resource_manager_->GetHwc2()->displays_.at(display_id);
-      if (conn->state() == DRM_MODE_CONNECTED) {
-        static hwc2_layer_t layer_id = 0;
-        if(display.has_layer(layer_id)){
-        }else{
-          display.CreateLayer(&layer_id);
-        }
-        HwcLayer &layer = display.get_layer(layer_id);
-        hwc_rect_t frame = {0,0,1920,1080};
-        layer.SetLayerDisplayFrame(frame);
-        hwc_frect_t crop = {0.0, 0.0, 1920.0, 1080.0};
-        layer.SetLayerSourceCrop(crop);
-        layer.SetLayerZOrder(0);
-        layer.SetLayerBlendMode(HWC2_BLEND_MODE_NONE);
-        layer.SetLayerPlaneAlpha(1.0);
-        layer.SetLayerCompositionType(HWC2_COMPOSITION_DEVICE);
-        // layer.SetLayerBuffer(NULL,-1);
-        layer.SetLayerTransform(0);
-        uint32_t num_types;
-        uint32_t num_requests;
-        display.ValidateDisplay(&num_types,&num_requests);
-        // display.GetChangedCompositionTypes();
-        // display.GetDisplayRequests();
-        display.AcceptDisplayChanges();
-        hwc_region_t damage;
-        display.SetClientTarget(client_layer_.buffer(),
-                                dup(client_layer_.acquire_fence()->getFd()),
-                                0,
-                                damage);
-        int32_t rt_fence;
-        display.PresentDisplay(&rt_fence);
-        if(merge_rt_fence > 0){
-            char acBuf[32];
-            sprintf(acBuf,"RTD%" PRIu64 "M-FN%d-%d", handle_, frame_no_, display_cnt++);
-            sp<ReleaseFence> rt = sp<ReleaseFence>(new ReleaseFence(rt_fence, acBuf));
-            if(rt->isValid()){
-              sprintf(acBuf,"RTD%" PRIu64 "M-FN%d-%d",handle_, frame_no_, display_cnt++);
-              int32_t merge_rt_fence_temp = merge_rt_fence;
-              merge_rt_fence = rt->merge(merge_rt_fence, acBuf);
-              close(merge_rt_fence_temp);
-            }else{
-              HWC2_ALOGE("connector %u type=%s, type_id=%d is MirrorDisplay get retireFence fail.\n",
-                          conn->id(),
-                          drm_->connector_type_str(conn->type()),
-                          conn->type_id());
-            }
+    if(display_id == 0)
+      continue;
+
+    if(conn->state() != DRM_MODE_CONNECTED){
+      // 断开后重新连接需要副屏自己再完成一次 modeset
+      setCloneDisplay_.erase(display_id);
+      continue;
+    }
+
+    // 已完成首次 modeset 的副屏由 AddCloneComposition 随主屏一起提交
+    if(setCloneDisplay_.count(display_id))
+      continue;
+
+    // 首帧: 副屏走一次完整的 Validate/Present 完成 modeset
+    auto &display = resource_manager_->GetHwc2()->displays_.at(display_id);
+    const DrmMode &mode = conn->current_mode();
+    static hwc2_layer_t layer_id = 0;
+    if(display.has_layer(layer_id)){
+    }else{
+      display.CreateLayer(&layer_id);
+    }
+    HwcLayer &layer = display.get_layer(layer_id);
+    hwc_rect_t frame = {0, 0,
+                        static_cast<int>(mode.h_display()),
+                        static_cast<int>(mode.v_display())};
+    layer.SetLayerDisplayFrame(frame);
+    hwc_frect_t crop = {0.0, 0.0, mode.h_display() + 0.0f, mode.v_display() + 0.0f};
+    layer.SetLayerSourceCrop(crop);
+    layer.SetLayerZOrder(0);
+    layer.SetLayerBlendMode(HWC2_BLEND_MODE_NONE);
+    layer.SetLayerPlaneAlpha(1.0);
+    layer.SetLayerCompositionType(HWC2_COMPOSITION_DEVICE);
+    layer.SetLayerTransform(0);
+    uint32_t num_types;
+    uint32_t num_requests;
+    display.ValidateDisplay(&num_types,&num_requests);
+    display.AcceptDisplayChanges();
+    hwc_region_t damage;
+    display.SetClientTarget(client_layer_.buffer(),
+                            dup(client_layer_.acquire_fence()->getFd()),
+                            0,
+                            damage);
+    int32_t rt_fence = -1;
+    if(display.PresentDisplay(&rt_fence) == HWC2::Error::None){
+      setCloneDisplay_.insert(display_id);
+      HWC2_ALOGI("connector %u type=%s, type_id=%d display=%d switch to clone commit.",
+                 conn->id(), drm_->connector_type_str(conn->type()),
+                 conn->type_id(), display_id);
+    }
+    if(merge_rt_fence > 0){
+        char acBuf[32];
+        sprintf(acBuf,"RTD%" PRIu64 "M-FN%d-%d", handle_, frame_no_, display_cnt++);
+        sp<ReleaseFence> rt = sp<ReleaseFence>(new ReleaseFence(rt_fence, acBuf));
+        if(rt->isValid()){
+          sprintf(acBuf,"RTD%" PRIu64 "M-FN%d-%d",handle_, frame_no_, display_cnt++);
+          int32_t merge_rt_fence_temp = merge_rt_fence;
+          merge_rt_fence = rt->merge(merge_rt_fence, acBuf);
+          close(merge_rt_fence_temp);
         }else{
-          merge_rt_fence = rt_fence;
+          HWC2_ALOGE("connector %u type=%s, type_id=%d is MirrorDisplay get retireFence fail.\n",
+                      conn->id(),
+                      drm_->connector_type_str(conn->type()),
+                      conn->type_id());
         }
-      }
+    }else{
+      merge_rt_fence = rt_fence;
     }
   }
   *retire_fence = merge_rt_fence;
@@ -2812,7 +3396,7 @@ HWC2::Error DrmHwcTwo::HwcLayer::SetLayerBuffer(buffer_handle_t buffer,
 
 HWC2::Error DrmHwcTwo::HwcLayer::SetLayerColor(hwc_color_t color) {
   HWC2_ALOGD_IF_VERBOSE("layer-id=%d"", color [r,g,b,a]=[%d,%d,%d,%d]" ,id_,color.r,color.g,color.b,color.a);
-  // TODO: Punt to client composition here?
+  // 在 PopulateDrmLayer 中转换为填充 buffer, 参考 GetSolidColorBuffer
   mCurrentState.color_ = color;
   return HWC2::Error::None;
 }
@@ -2895,6 +3479,10 @@ void DrmHwcTwo::HwcLayer::PopulateDrmLayer(hwc2_layer_t layer_id, DrmHwcLayer *d
   drmHwcLayer->iBestPlaneType = 0;
   drmHwcLayer->bSidebandStreamLayer_ = false;
   drmHwcLayer->bMatch_ = false;
+  drmHwcLayer->bCursor_ = sf_type() == HWC2::Composition::Cursor;
+  drmHwcLayer->bRgaCompose_ = false;
+  drmHwcLayer->vRgaComposeIds_.clear();
+  drmHwcLayer->bRgaTransform_ = false;
 
   drmHwcLayer->acquire_fence = acquire_fence_;
 
@@ -2905,6 +3493,10 @@ void DrmHwcTwo::HwcLayer::PopulateDrmLayer(hwc2_layer_t layer_id, DrmHwcLayer *d
   drmHwcLayer->uDclk_ = ctx->dclk;
   drmHwcLayer->SetBlend(mCurrentState.blending_);
 
+  std::shared_ptr<DrmBuffer> solid_color_buffer = NULL;
+  if(sf_type() == HWC2::Composition::SolidColor)
+    solid_color_buffer = GetSolidColorBuffer(ctx);
+
   //
   bool sidebandStream = false;
   if(sf_type() == HWC2::Composition::Sideband){
@@ -2949,6 +3541,44 @@ void DrmHwcTwo::HwcLayer::PopulateDrmLayer(hwc2_layer_t layer_id, DrmHwcLayer *d
       drmHwcLayer->uGemHandle_ = 0;
       drmHwcLayer->sLayerName_.clear();
     }
+  }else if(solid_color_buffer != NULL){
+    // 填充 buffer 为纯色，只需取 display_frame 的 1/SOLID_COLOR_SCALE 由 plane 放大
+    int dst_w = mCurrentState.display_frame_.right - mCurrentState.display_frame_.left;
+    int dst_h = mCurrentState.display_frame_.bottom - mCurrentState.display_frame_.top;
+    int src_w = solid_color_buffer->GetWidth();
+    int src_h = solid_color_buffer->GetHeight();
+    hwc_frect_t source_crop;
+    source_crop.left   = 0;
+    source_crop.top    = 0;
+    source_crop.right  = dst_w <= src_w ? dst_w : std::min(src_w, (dst_w + SOLID_COLOR_SCALE - 1) / SOLID_COLOR_SCALE);
+    source_crop.bottom = dst_h <= src_h ? dst_h : std::min(src_h, (dst_h + SOLID_COLOR_SCALE - 1) / SOLID_COLOR_SCALE);
+
+    drmHwcLayer->sf_handle = solid_color_buffer->GetHandle();
+    drmHwcLayer->acquire_fence = AcquireFence::NO_FENCE;
+    // 填充 buffer 不透明, 颜色 alpha 叠加到 plane alpha
+    drmHwcLayer->alpha = static_cast<uint16_t>(mCurrentState.alpha_ * mCurrentState.color_.a + 0.5f);
+    drmHwcLayer->SetDisplayFrame(mCurrentState.display_frame_, ctx);
+    drmHwcLayer->SetSourceCrop(source_crop);
+    drmHwcLayer->SetTransform(HWC2::Transform::None);
+    // Commit mirror function
+    drmHwcLayer->SetDisplayFrameMirror(mCurrentState.display_frame_);
+
+    drmHwcLayer->uBufferId_ = solid_color_buffer->GetBufferId();
+    drmHwcLayer->iFd_     = solid_color_buffer->GetFd();
+    drmHwcLayer->iWidth_  = solid_color_buffer->GetWidth();
+    drmHwcLayer->iHeight_ = solid_color_buffer->GetHeight();
+    drmHwcLayer->iStride_ = solid_color_buffer->GetStride();
+    drmHwcLayer->iSize_   = solid_color_buffer->GetSize();
+    drmHwcLayer->iFormat_ = solid_color_buffer->GetFormat();
+    drmHwcLayer->iUsage   = solid_color_buffer->GetUsage();
+    drmHwcLayer->iHeightStride_   = solid_color_buffer->GetHeightStride();
+    drmHwcLayer->iByteStride_     = solid_color_buffer->GetByteStride();
+    drmHwcLayer->uFourccFormat_   = solid_color_buffer->GetFourccFormat();
+    drmHwcLayer->uModifier_       = solid_color_buffer->GetModifier();
+    drmHwcLayer->uGemHandle_      = solid_color_buffer->GetGemHandle();
+    drmHwcLayer->sLayerName_      = solid_color_buffer->GetName();
+    drmHwcLayer->bSolidColor_     = true;
+    drmHwcLayer->pSolidColorBuffer_ = solid_color_buffer;
   }else{
     drmHwcLayer->sf_handle = buffer_;
     drmHwcLayer->SetDisplayFrame(mCurrentState.display_frame_, ctx);
@@ -2991,6 +3621,20 @@ void DrmHwcTwo::HwcLayer::PopulateDrmLayer(hwc2_layer_t layer_id, DrmHwcLayer *d
   return;
 }
 
+std::shared_ptr<DrmBuffer> DrmHwcTwo::HwcLayer::GetSolidColorBuffer(hwc2_drm_display_t* ctx) {
+  ResourceManager *resource_manager = ResourceManager::getInstance();
+  if(!resource_manager->IsSolidColorMode())
+    return NULL;
+
+  // 全透明图层无需送显, 交给 GLES 处理即可
+  if(mCurrentState.color_.a == 0)
+    return NULL;
+
+  int width  = std::max(ALIGN(ctx->framebuffer_width / SOLID_COLOR_SCALE, 16), 16);
+  int height = std::max(ALIGN(ctx->framebuffer_height / SOLID_COLOR_SCALE, 16), 16);
+  return resource_manager->GetSolidColorBuffer(mCurrentState.color_, width, height);
+}
+
 void DrmHwcTwo::HwcLayer::PopulateFB(hwc2_layer_t layer_id, DrmHwcLayer *drmHwcLayer,
                                          hwc2_drm_display_t* ctx, uint32_t frame_no, bool validate) {
   drmHwcLayer->uId_        = layer_id;
@@ -3404,6 +4048,45 @@ void DrmHwcTwo::HandleInitialHotplugState(DrmDevice *drmDevice) {
 }
 
 void DrmHwcTwo::DrmHotplugHandler::HandleEvent(uint64_t timestamp_us) {
+  // 事件线程同时分发 page-flip 事件, 不能阻塞等待副屏初始化,
+  // 记录后由 InitSecondaryDisplays 完成时重放
+  {
+    std::lock_guard<std::mutex> lock(hwc2_->mtxDisplayInit_);
+    if(!hwc2_->bDisplayInitDone_){
+      bHotplugDeferred_ = true;
+      HWC2_ALOGI("defer hotplug event until secondary displays init done.");
+      return;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mtxEvent_);
+  HandleHotplug(timestamp_us);
+}
+
+void DrmHwcTwo::DrmHotplugHandler::ReplayDeferredEvent() {
+  bool hotplug = false;
+  std::set<int> resolution;
+  {
+    std::lock_guard<std::mutex> lock(hwc2_->mtxDisplayInit_);
+    hotplug = bHotplugDeferred_;
+    bHotplugDeferred_ = false;
+    resolution.swap(setResolutionDeferred_);
+  }
+  if(!hotplug && resolution.empty())
+    return;
+
+  std::lock_guard<std::mutex> lock(mtxEvent_);
+  if(hotplug){
+    struct timespec ts;
+    uint64_t timestamp = 0;
+    if(!clock_gettime(CLOCK_MONOTONIC, &ts))
+      timestamp = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+    HandleHotplug(timestamp);
+  }
+  for(int display_id : resolution)
+    HandleResolutionSwitch(display_id);
+}
+
+void DrmHwcTwo::DrmHotplugHandler::HandleHotplug(uint64_t timestamp_us) {
   int32_t ret = 0;
   bool primary_change = true;
   bool unplug_event = false;
@@ -3556,6 +4239,18 @@ void DrmHwcTwo::DrmHotplugHandler::HandleEvent(uint64_t timestamp_us) {
 }
 
 void DrmHwcTwo::DrmHotplugHandler::HandleResolutionSwitchEvent(int display_id) {
+  {
+    std::lock_guard<std::mutex> lock(hwc2_->mtxDisplayInit_);
+    if(!hwc2_->bDisplayInitDone_){
+      setResolutionDeferred_.insert(display_id);
+      return;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mtxEvent_);
+  HandleResolutionSwitch(display_id);
+}
+
+void DrmHwcTwo::DrmHotplugHandler::HandleResolutionSwitch(int display_id) {
   // 若系统没有设置为动态更新模式的话，则不进行分辨率更新
   ResourceManager* rm = ResourceManager::getInstance();
   if(!rm->IsDynamicDisplayMode()){
@@ -3750,8 +4445,8 @@ hwc2_function_pointer_t DrmHwcTwo::HookDevGetFunction(
     // Layer functions
     case HWC2::FunctionDescriptor::SetCursorPosition:
       return ToHook<HWC2_PFN_SET_CURSOR_POSITION>(
-          LayerHook<decltype(&HwcLayer::SetCursorPosition),
-                    &HwcLayer::SetCursorPosition, int32_t, int32_t>);
+          DisplayHook<decltype(&HwcDisplay::SetCursorPosition),
+                      &HwcDisplay::SetCursorPosition, hwc2_layer_t, int32_t, int32_t>);
     case HWC2::FunctionDescriptor::SetLayerBlendMode:
       return ToHook<HWC2_PFN_SET_LAYER_BLEND_MODE>(
           LayerHook<decltype(&HwcLayer::SetLayerBlendMode),
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DRM_BLOB_CACHE_H_
+#define ANDROID_DRM_BLOB_CACHE_H_
+
+#include <utils/String8.h>
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+
+class DrmDevice;
+
+// 空闲 (引用计数为 0) 的 blob 最多保留个数
+#define BLOB_CACHE_SIZE_DEFAULT "16"
+
+// 按内容缓存 KMS property blob (HDR metadata / gamma LUT / 3D LUT / mode):
+//   1. Acquire() 以内容哈希查找, 内容一致则复用已有 blob_id, 不再 CREATEPROPBLOB;
+//   2. Release() 只减引用, 引用为 0 的 blob 进入 LRU 链表, 超出上限才 DESTROYPROPBLOB;
+//   3. 内容相同 blob_id 必然相同, 调用方可据此跳过未变化的属性.
+class DrmBlobCache {
+ public:
+  DrmBlobCache(DrmDevice *drm);
+  ~DrmBlobCache();
+
+  int Acquire(const void *data, size_t length, uint32_t *blob_id);
+  int Release(uint32_t blob_id);
+  // 销毁所有缓存的 blob, DrmDevice 析构时调用
+  void Clear();
+  void Dump(String8 &output);
+
+ private:
+  DrmBlobCache(const DrmBlobCache&);
+  DrmBlobCache& operator=(const DrmBlobCache&);
+
+  struct BlobEntry {
+    uint32_t uBlobId_;
+    uint64_t uHash_;
+    int iRefCnt_;
+    std::vector<uint8_t> vData_;
+    // 引用计数为 0 时在 listIdle_ 中的位置
+    std::list<uint32_t>::iterator itIdle_;
+  };
+
+  void EvictIdle();
+
+  DrmDevice *drm_;
+  size_t iIdleSize_;
+  std::unordered_map<uint32_t, BlobEntry> mapBlob_;
+  std::multimap<uint64_t, uint32_t> mapHash_;
+  // 链表头为最近释放的 blob
+  std::list<uint32_t> listIdle_;
+
+  uint64_t iHitCnt_ = 0;
+  uint64_t iMissCnt_ = 0;
+  uint64_t iEvictCnt_ = 0;
+  mutable std::mutex mtx_;
+};
+
+}  // namespace android
+
+#endif  // ANDROID_DRM_BLOB_CACHE_H_
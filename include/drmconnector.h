@@ -127,6 +127,8 @@ class DrmConnector {
   bool is_hdmi_support_hdr() const;
   int switch_hdmi_hdr_mode(drmModeAtomicReqPtr pset,
                            android_dataspace_t colorspace);
+  // 提交完成后调用, 成功则更新 blob_id_, 失败则释放本次 Blob
+  void complete_hdmi_hdr_mode(int commit_ret);
 
   int GetSpiltModeId() const;
   bool isHorizontalSpilt() const;
@@ -257,6 +259,7 @@ class DrmConnector {
   std::map<DrmCrtc*, std::vector<int>> mMapCrtcDisplays_;
 
   uint32_t blob_id_ = 0;
+  uint32_t pending_blob_id_ = 0;
 
   mutable std::recursive_mutex mRecursiveMutex;
 };
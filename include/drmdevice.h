@@ -17,6 +17,7 @@
 #ifndef ANDROID_DRM_H_
 #define ANDROID_DRM_H_
 
+#include "drmblobcache.h"
 #include "drmconnector.h"
 #include "drmcrtc.h"
 #include "drmencoder.h"
@@ -26,6 +27,7 @@
 #include "rockchip/drmbaseparameter.h"
 #include "rockchip/drmxml.h"
 #include <stdint.h>
+#include <atomic>
 #include <tuple>
 
 namespace android {
@@ -34,6 +36,9 @@ namespace android {
 #define DRM_CLIENT_CAP_SHARE_PLANES     6
 #define DRM_CLIENT_CAP_ASPECT_RATIO     4
 
+// 初始化阶段并行读取 KMS 对象属性的线程数
+#define INIT_THREADS_DEFAULT "4"
+
 #define type_name_define(res) const char * res##_str(int type);
 
 #define DRM_ATOMIC_ADD_PROP(object_id, prop_id, value) \
@@ -50,6 +55,18 @@ enum DrmModeChangeUsage{
   DmcuReleaseByPowerMode = 1,
 };
 
+// CRTC 待提交状态: 刷新率 / gamma / 3D LUT 不再单独提交,
+// 由 DrmDisplayCompositor 在下一帧的原子提交中一并生效
+struct DrmCrtcPendingState{
+  uint32_t uCrtcId_ = 0;
+  bool bVrr_ = false;
+  uint64_t uRefreshRate_ = 0;
+  bool bGamma_ = false;
+  uint32_t uGammaBlob_ = 0;
+  bool bCubicLut_ = false;
+  uint32_t uCubicLutBlob_ = 0;
+};
+
 class DrmDevice {
  public:
   DrmDevice();
@@ -103,6 +120,10 @@ class DrmDevice {
 
   int CreatePropertyBlob(void *data, size_t length, uint32_t *blob_id);
   int DestroyPropertyBlob(uint32_t blob_id);
+  // 经 DrmBlobCache 按内容复用 blob, 与 ReleasePropertyBlob 成对使用
+  int AcquirePropertyBlob(const void *data, size_t length, uint32_t *blob_id);
+  int ReleasePropertyBlob(uint32_t blob_id);
+  DrmBlobCache *blob_cache(){ return &blob_cache_; }
   bool HandlesDisplay(int display) const;
   void RegisterHotplugHandler(DrmEventHandler *handler) {
     event_listener_.RegisterHotplugHandler(handler);
@@ -121,6 +142,12 @@ class DrmDevice {
   int UpdateDisplayGamma(int display_id);
   int UpdateDisplayMode(int display_id);
   int UpdateVrrRefreshRate(int display_id, int refresh_rate);
+  // 取出 crtc 的待提交状态并加入 pset, 提交后需调用 CompletePendingCrtcState
+  int CollectPendingCrtcState(DrmCrtc *crtc, drmModeAtomicReqPtr pset,
+                              DrmCrtcPendingState *state);
+  // commit_ret 为 -EBUSY/-EINTR/-EAGAIN 时重新入队, 其余错误丢弃
+  void CompletePendingCrtcState(DrmCrtcPendingState &state, int commit_ret);
+  bool HasPendingCrtcState(DrmCrtc *crtc);
   int BindDpyRes(int display_id);
   int ReleaseDpyRes(int display_id, DrmModeChangeUsage usage = DrmModeChangeUsage::DmcuNone);
   void ClearDisplay(void);
@@ -202,7 +229,8 @@ class DrmDevice {
   // Kernel 4.19 = 2.0.0
   // Kernel 5.10 = 3.0.0
   int drm_version_;
-  uint32_t mode_id_ = 0;
+  // connector 并行初始化时可能同时分配 mode id
+  std::atomic<uint32_t> mode_id_{0};
   bool enable_changed_;
   int hotplug_timeline;
   int prop_timeline_;
@@ -226,6 +254,13 @@ class DrmDevice {
   struct DisplayModeXml DmXml_;
 
   std::map<int, std::vector<DrmConnector*>> mMapMirrorStateStore_;
+  // 各 CRTC 当前生效的 gamma / 3D LUT blob
+  std::map<uint32_t, uint32_t> mapGammaBlob_;
+  std::map<uint32_t, uint32_t> mapCubicLutBlob_;
+  // crtc-id -> 待提交状态
+  std::map<uint32_t, DrmCrtcPendingState> mapPendingCrtcState_;
+  // 需先于 fd_ 析构
+  DrmBlobCache blob_cache_;
 
   mutable std::recursive_mutex mRecursiveMutex;
 };
@@ -70,6 +70,9 @@ class DrmCompositionPlane {
     plane_ = rhs.plane();
     crtc_  = rhs.crtc();
     mirror_ = rhs.mirror();
+    bMirrorRect_ = rhs.has_mirror_rect();
+    mirror_crop_ = rhs.mirror_crop();
+    mirror_frame_ = rhs.mirror_frame();
 
     if(rhs.type() == Type::kLayer){
       zpos_ = rhs.get_zpos();
@@ -82,6 +85,9 @@ class DrmCompositionPlane {
     plane_ = rhs.plane();
     crtc_  = rhs.crtc();
     mirror_ = rhs.mirror();
+    bMirrorRect_ = rhs.has_mirror_rect();
+    mirror_crop_ = rhs.mirror_crop();
+    mirror_frame_ = rhs.mirror_frame();
 
     if(rhs.type() == Type::kLayer){
       zpos_ = rhs.get_zpos();
@@ -112,6 +118,16 @@ class DrmCompositionPlane {
     return mirror_;
   }
 
+  // 克隆送显时 mirror plane 使用独立的 source_crop/display_frame, 不修改共享图层
+  void set_mirror_rect(const hwc_frect_t &crop, const hwc_rect_t &frame){
+    bMirrorRect_ = true;
+    mirror_crop_ = crop;
+    mirror_frame_ = frame;
+  }
+  bool has_mirror_rect() const { return bMirrorRect_; }
+  const hwc_frect_t &mirror_crop() const { return mirror_crop_; }
+  const hwc_rect_t &mirror_frame() const { return mirror_frame_; }
+
   DrmPlane *plane() const {
     return plane_;
   }
@@ -140,6 +156,9 @@ class DrmCompositionPlane {
   DrmCrtc *crtc_ = NULL;
   std::vector<size_t> source_layers_;
   bool mirror_;
+  bool bMirrorRect_ = false;
+  hwc_frect_t mirror_crop_;
+  hwc_rect_t mirror_frame_;
 };
 
 class DrmDisplayComposition {
@@ -159,9 +178,11 @@ class DrmDisplayComposition {
   int SetDisplayHdrMode(bool hdr_mode, android_dataspace_t dataspace);
 
   int DisableUnusedPlanes();
+  bool IsPlaneInComposition(DrmPlane *plane);
   int CreateAndAssignReleaseFences(SyncTimeline &sync_timeline);
   sp<ReleaseFence> GetReleaseFence(hwc2_layer_t layer_id);
   int SignalCompositionDone();
+  int SetReleaseFence(int fd);
 
   std::vector<DrmHwcLayer> &layers() {
     return layers_;
@@ -221,6 +242,13 @@ class DrmDisplayComposition {
   bool hdr_mode() const{ return hdr_mode_;}
   android_dataspace_t dataspace() const{ return dataspace_;}
 
+  // Validate 阶段的图层分配方案签名, 作为 TEST_ONLY 校验缓存的 key
+  uint64_t plan_signature() const{ return plan_signature_;}
+  void set_plan_signature(uint64_t signature){ plan_signature_ = signature;}
+
+  // 由该 composition 结束 ValidateDisplay 开始的帧级 async trace
+  void set_trace_frame(bool trace){ trace_frame_ = trace;}
+
   void Dump(std::ostringstream *out) const;
 
  private:
@@ -250,6 +278,8 @@ class DrmDisplayComposition {
 
   uint64_t frame_no_ = 0;
   uint64_t display_id_;
+  uint64_t plan_signature_ = 0;
+  bool trace_frame_ = false;
 
   // mutable since we need to acquire in HaveQueuedComposites
   mutable pthread_mutex_t lock_;
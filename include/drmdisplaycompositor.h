@@ -17,18 +17,24 @@
 #ifndef ANDROID_DRM_DISPLAY_COMPOSITOR_H_
 #define ANDROID_DRM_DISPLAY_COMPOSITOR_H_
 
+#include "drmbuffer.h"
 #include "drmdisplaycomposition.h"
 #include "drmframebuffer.h"
 #include "drmlayer.h"
 #include "resourcemanager.h"
 #include "vsyncworker.h"
 #include "drmcompositorworker.h"
+#include "utils/spscqueue.h"
 
 #include <pthread.h>
+#include <atomic>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <tuple>
 #include <queue>
+#include <unordered_map>
 
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer.h>
@@ -44,6 +50,20 @@
 // consumption.
 #define FLATTEN_COUNTDOWN_INIT 60
 
+// Late-latch is off by default, it delays every commit close to the vblank.
+#define LATE_LATCH_DEFAULT "0"
+// Late-latch: wake up this many microseconds (plus the estimated commit cost)
+// before the next vblank, then commit the newest ready composition.
+#define LATE_LATCH_MARGIN_US_DEFAULT "2000"
+
+// Per-display composite queue depth, must be a power of two.
+#define DRM_COMPOSITOR_QUEUE_SIZE 4
+// A crtc drives at most the display and its spilt half.
+#define DRM_COMPOSITOR_MAX_DISPLAY 2
+
+// Number of plan signatures whose TEST_ONLY result is kept.
+#define PLAN_TEST_CACHE_SIZE_DEFAULT "64"
+
 namespace android {
 class ResourceManager;
 
@@ -61,7 +81,21 @@ class DrmDisplayCompositor {
   int Composite();
   void Dump(std::ostringstream *out) const;
   void Vsync(int display, int64_t timestamp);
+  void FlipDone(uint64_t sequence, int64_t timestamp_ns);
+  // Kernel OUT_FENCE_PTR mode.
+  bool UseKernelOutFence() const { return bKernelOutFence_; }
+  int WaitOutFence(int display, uint64_t frame_no);
+  // TEST_ONLY plan validation cache.
+  bool PlanTestEnable() const { return bPlanTest_; }
+  int LookupPlan(uint64_t signature);
+  // cache_reject=false: 拒绝结果不写入缓存, 仅用于本帧
+  int TestPlan(DrmDisplayComposition *composition, bool cache_reject = true);
   void SingalCompsition(std::unique_ptr<DrmDisplayComposition> composition);
+  // Cursor fast path: plane-only commit of the cursor position.
+  bool CursorFastPathEnable() const { return bCursorFastPath_; }
+  int SetCursorPosition(int display, int x, int y);
+  bool HaveCursorUpdate() const;
+  int CommitCursor();
   void ClearDisplay();
   bool DropCurrentFrame(int display, int64_t frame_no);
   int display() { return display_;};
@@ -86,8 +120,13 @@ class DrmDisplayCompositor {
     HdrState hdr_;
   };
 
+  typedef SpscQueue<std::unique_ptr<DrmDisplayComposition>,
+                    DRM_COMPOSITOR_QUEUE_SIZE> CompositionQueue;
+
   DrmDisplayCompositor(const DrmDisplayCompositor &) = delete;
 
+  CompositionQueue &GetCompositeQueue(int display);
+
   // We'll wait for acquire fences to fire for kAcquireWaitTimeoutMs,
   // kAcquireWaitTries times, logging a warning in between.
   static const int kAcquireWaitTries = 5;
@@ -97,9 +136,24 @@ class DrmDisplayCompositor {
   int GetTimestamp();
   int64_t GetPhasedVSync(int64_t frame_ns, int64_t current);
   int SyntheticWaitVBlank();
+  // Late-latch commit scheduling.
+  int64_t GetRefreshPeriodNs();
+  void GetCrtcVBlank(DrmCrtc *crtc, int64_t *vblank_ns, int64_t *period_ns);
+  int WaitCommitDeadline();
+  void UpdateCommitCost(int64_t cost_ns);
+  bool IsCompositionReady(DrmDisplayComposition *composition);
   int CollectInfo(std::unique_ptr<DrmDisplayComposition> composition,
                   int status, bool writeback = false);
+  bool IsSingleCrtcCommit(DrmDevice *drm);
   void Commit();
+  int WaitFlipDone();
+  void SetOutFence(int display, uint64_t frame_no, int fd);
+  void RetireCompositions(
+      std::map<int, std::unique_ptr<DrmDisplayComposition>> &compositions,
+      std::vector<std::unique_ptr<DrmDisplayComposition>> &superseded);
+  void UpdateCursorPlane(
+      std::map<int, std::unique_ptr<DrmDisplayComposition>> &compositions,
+      bool committed);
   int CollectCommitInfo(drmModeAtomicReqPtr pset,
                   DrmDisplayComposition *display_comp,
                   bool test_only,
@@ -129,6 +183,7 @@ class DrmDisplayCompositor {
                   int status, bool writeback = false);
   int FlattenActiveComposition();
   int FlattenSerial(DrmConnector *writeback_conn);
+  void ExitFlatten();
   int FlattenConcurrent(DrmConnector *writeback_conn);
   int FlattenOnDisplay(std::unique_ptr<DrmDisplayComposition> &src,
                        DrmConnector *writeback_conn, DrmMode &src_mode,
@@ -142,10 +197,10 @@ class DrmDisplayCompositor {
   int display_;
   DrmCompositorWorker worker_;
 
-  // Store the display request from SF.
-  std::queue<std::unique_ptr<DrmDisplayComposition>> composite_queue_;
-  // Store the display request from SF.
-  std::queue<std::unique_ptr<DrmDisplayComposition>> composite_queue_temp_;
+  // Store the display request from SF, one lock-free queue per display.
+  // Producer: the display's present thread. Consumer: worker_, serialized
+  // with ClearDisplay() by lock_.
+  CompositionQueue composite_queue_[DRM_COMPOSITOR_MAX_DISPLAY];
   // Store the request that is about to be submitted for display.
   std::map<int,std::unique_ptr<DrmDisplayComposition>> collect_composition_map_;
   // Store the request currently being displayed on the screen.
@@ -159,7 +214,8 @@ class DrmDisplayCompositor {
   bool active_;
   bool use_hw_overlays_;
   // Enter ClearDisplay state must SignalCompositionDone to signal releaseFence
-  bool clear_;
+  // QueueComposition() 不持 lock_ 写入, 使用 atomic
+  std::atomic<bool> clear_{false};
 
   ModeState mode_;
 
@@ -180,19 +236,91 @@ class DrmDisplayCompositor {
   mutable uint64_t dump_last_timestamp_ns_;
   VSyncWorker vsync_worker_;
   int64_t flatten_countdown_;
+  // WriteBack flatten of static scenes.
+  bool bFlattenEnable_;
+  bool bFlattened_;
+  bool bFlattenTried_;
+  int iFlattenIdleVsync_;
+  std::shared_ptr<DrmBuffer> pFlattenBuffer_;
+  uint64_t iFlattenCnt_;
+  int64_t iFlattenStartNs_;
+  // Estimated scan-out bytes saved per vsync while flattened.
+  uint64_t iFlattenSavingPerFrame_;
+  uint64_t iFlattenSavedBytes_;
   std::unique_ptr<Planner> planner_;
   int writeback_fence_;
   // Multi Thread function.
   int64_t last_timestamp_;
   struct timespec vsync_;
   drmModeAtomicReqPtr pset_ = NULL;
-
-  std::map<int, uint64_t> mapDisplayHaveQeueuCnt_;
+  // 本次提交中携带的 CRTC 待提交状态 (刷新率 / gamma / 3D LUT)
+  std::vector<DrmCrtcPendingState> vCrtcPendingState_;
 
   int64_t iLastDropFrameNo_;
 
   bool bWriteBackRequestDisable_;
   bool bWriteBackEnable_;
+
+  // Late-latch commit scheduling.
+  bool bLateLatch_;
+  int64_t iLatchMarginNs_;
+  // Moving average of collect + commit submit cost.
+  int64_t iCommitCostNs_;
+  int64_t iCollectStartNs_;
+  int64_t iCommitDeadlineNs_;
+  // vblank period of the crtc the deadline was computed for.
+  int64_t iCommitPeriodNs_;
+  struct CrtcVBlank {
+    uint32_t sequence = 0;
+    int64_t timestamp_ns = 0;
+    int64_t period_ns = 0;
+  };
+  std::map<uint32_t, CrtcVBlank> mapCrtcVBlank_;
+  uint64_t iLateLatchDropCnt_;
+  uint64_t iLateLatchMissCnt_;
+  // Superseded compositions, signaled after the active one is replaced.
+  std::vector<std::unique_ptr<DrmDisplayComposition>> superseded_compositions_;
+
+  // Non-blocking commit, compositions are retired on page-flip event.
+  bool bNonBlockCommit_;
+  bool bFlipPending_;
+  uint64_t iFlipSequence_;
+  pthread_cond_t flip_done_cond_;
+  std::map<int, std::unique_ptr<DrmDisplayComposition>> flip_composition_map_;
+  std::vector<std::unique_ptr<DrmDisplayComposition>> flip_superseded_compositions_;
+
+  // Kernel OUT_FENCE_PTR mode: the crtc out fence of commit N is both the
+  // retire fence of frame N and the release fence of frame N-1.
+  struct OutFence {
+    uint64_t frame_no = 0;
+    int fd = -1;
+  };
+  bool bKernelOutFence_;
+  pthread_cond_t out_fence_cond_;
+  std::map<int, OutFence> mapDisplayOutFence_;
+
+  // TEST_ONLY 校验结果 LRU 缓存, key 为图层分配方案签名, value 为是否通过.
+  typedef std::list<std::pair<uint64_t, bool>> PlanCacheList;
+  bool bPlanTest_;
+  size_t iPlanCacheSize_;
+  mutable std::mutex mPlanCacheMutex_;
+  PlanCacheList listPlanCache_;
+  std::unordered_map<uint64_t, PlanCacheList::iterator> mapPlanCache_;
+  uint64_t iPlanCacheHitCnt_;
+  uint64_t iPlanCacheMissCnt_;
+  uint64_t iPlanRejectCnt_;
+
+  // 光标快速路径: 光标独占一个 plane 时, 位置更新只提交该 plane 的 CRTC_X/Y.
+  struct CursorState {
+    DrmPlane *plane = NULL;
+    int x = 0;
+    int y = 0;
+    bool pending = false;
+  };
+  bool bCursorFastPath_;
+  mutable std::mutex mCursorMutex_;
+  std::map<int, CursorState> mapDisplayCursor_;
+  uint64_t iCursorCommitCnt_;
 };
 }  // namespace android
 
@@ -23,6 +23,7 @@
 #include "platform.h"
 #include "rockchip/drmgralloc.h"
 #include "rockchip/invalidateworker.h"
+#include "rockchip/utils/drmeventlog.h"
 #include "utils/drmfence.h"
 
 #include "drmbufferqueue.h"
@@ -37,6 +38,9 @@
 
 #include <map>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace android {
 
@@ -49,6 +53,8 @@ class DrmDisplayCompositor;
 static DrmHwcTwo *g_ctx = NULL;
 
 #define MAX_NUM_BUFFER_SLOTS 32
+// 主屏同步初始化, 副屏在后台线程完成初始化
+#define ASYNC_DISPLAY_INIT_DEFAULT "1"
 
 class DrmHwcTwo : public hwc2_device_t {
  public:
@@ -79,6 +85,7 @@ class DrmHwcTwo : public hwc2_device_t {
         }
         sidebandStreamHandle_ = NULL;
       }
+      sidebandStreamOrigin_ = NULL;
     }
 
     HWC2::Composition sf_type() const {
@@ -96,10 +103,18 @@ class DrmHwcTwo : public hwc2_device_t {
     bool type_changed() const {
       return mCurrentState.sf_type_ != mCurrentState.validated_type_;
     }
+    // DrmPlane 直接扫描 SF buffer 的图层, 需要返回 ReleaseFence
+    bool plane_backed() const {
+      return mCurrentState.sf_type_ == HWC2::Composition::Device ||
+             mCurrentState.sf_type_ == HWC2::Composition::Cursor;
+    }
 
     uint32_t z_order() const {
       return mCurrentState.z_order_;
     }
+    const hwc_rect_t &display_frame() const {
+      return mCurrentState.display_frame_;
+    }
 
     class GemHandle {
       public:
@@ -246,25 +261,24 @@ class DrmHwcTwo : public hwc2_device_t {
 
       // Get Buffer info
       const auto mapBuffer = bufferInfoMap_.find(buffer_id);
+      bBufferCacheHit_ = mapBuffer != bufferInfoMap_.end();
       if(mapBuffer == bufferInfoMap_.end()){
         // If bHasCache_ is true, the new buffer_id need to reset mapBuffer
         if(bHasCache_){
-          HWC2_ALOGD_IF_VERBOSE("bHasCache=%d to reset bufferInfoMap_ BufferId=%" PRIx64 " Name=%s",
-                               bHasCache_,buffer_id,pBufferInfo_->sLayerName_.c_str());
+          HWC2_EVENT(kEvBufferCacheReset, id_, buffer_id);
           bufferInfoMap_.clear();
           bHasCache_  = false;
         }
 
         // If size is too big, the new buffer_id need to reset mapBuffer
         if(bufferInfoMap_.size() > MAX_NUM_BUFFER_SLOTS){
-          HWC2_ALOGD_IF_VERBOSE("MapSize=%zu too large to reset bufferInfoMap_ BufferId=%" PRIx64 " Name=%s",
-                               bufferInfoMap_.size(),buffer_id,pBufferInfo_->sLayerName_.c_str());
+          HWC2_EVENT(kEvBufferCacheOverflow, id_, bufferInfoMap_.size(), buffer_id);
           bufferInfoMap_.clear();
         }
 
         auto ret = bufferInfoMap_.emplace(std::make_pair(buffer_id, std::make_shared<bufferInfo_t>(bufferInfo())));
         if(ret.second == false){
-          HWC2_ALOGD_IF_VERBOSE("bufferInfoMap_ emplace fail! BufferHandle=%p",buffer_);
+          HWC2_EVENT(kEvBufferCacheEmplaceFail, id_, buffer_id);
         }else{
           pBufferInfo_ = ret.first->second;
           pBufferInfo_->uBufferId_ = buffer_id;
@@ -281,23 +295,13 @@ class DrmHwcTwo : public hwc2_device_t {
           pBufferInfo_->uModifier_ = drmGralloc_->hwc_get_handle_format_modifier(buffer_);
           drmGralloc_->hwc_get_handle_name(buffer_,pBufferInfo_->sLayerName_);
           layer_name_ = pBufferInfo_->sLayerName_;
-          HWC2_ALOGD_IF_VERBOSE("bufferInfoMap_ size = %zu insert success! BufferId=%" PRIx64
-                                "w=%d h=%d format=%d fourcc=%c%c%c%c Name=%s",
-                               bufferInfoMap_.size(),buffer_id,
-                               pBufferInfo_->iWidth_,
-                               pBufferInfo_->iHeight_,
-                               pBufferInfo_->iFormat_,
-                               pBufferInfo_->uFourccFormat_,
-                               pBufferInfo_->uFourccFormat_ >> 8,
-                               pBufferInfo_->uFourccFormat_ >> 16,
-                               pBufferInfo_->uFourccFormat_ >> 24,
-                               pBufferInfo_->sLayerName_.c_str());
+          HWC2_EVENT(kEvBufferCacheInsert, id_, buffer_id, bufferInfoMap_.size(),
+                     pBufferInfo_->iWidth_, pBufferInfo_->iHeight_, pBufferInfo_->uFourccFormat_);
         }
       }else{
         bHasCache_ = true;
         pBufferInfo_ = mapBuffer->second;
-        HWC2_ALOGD_IF_VERBOSE("bufferInfoMap_ size = %zu has cache! BufferId=%" PRIx64 " Name=%s",
-                             bufferInfoMap_.size(),buffer_id,pBufferInfo_->sLayerName_.c_str());
+        HWC2_EVENT(kEvBufferCacheHit, id_, buffer_id, bufferInfoMap_.size());
       }
 
       mFrameCount_++;
@@ -346,8 +350,9 @@ class DrmHwcTwo : public hwc2_device_t {
     }
 
     int initOrGetGemhanleFromCache(DrmHwcLayer* drmHwcLayer) {
+      bGemCacheHit_ = false;
       if(pBufferInfo_ == NULL){
-        HWC2_ALOGD_IF_VERBOSE("Id=%d pBufferInfo_ is NULL can't find BufferInfoCache!",id_);
+        HWC2_EVENT(kEvGemHandleNoCache, id_);
         return -1;
       }
 
@@ -361,51 +366,56 @@ class DrmHwcTwo : public hwc2_device_t {
                                                 buffer_id);
         pBufferInfo_->uGemHandle_ = pBufferInfo_->gemHandle_.GetGemHandle();
         drmHwcLayer->uGemHandle_ = pBufferInfo_->gemHandle_.GetGemHandle();
-        HWC2_ALOGD_IF_VERBOSE("bufferInfoMap_ init GemHandle success! BufferId=%" PRIx64 " Name=%s GemHandle=%d ptr=%p",
-                              buffer_id,pBufferInfo_->sLayerName_.c_str(),
-                              drmHwcLayer->uGemHandle_,
-                              drmHwcLayer);
+        HWC2_EVENT(kEvGemHandleInit, id_, drmHwcLayer->uGemHandle_, buffer_id);
         return 0;
       }
 
       drmHwcLayer->uGemHandle_ = pBufferInfo_->gemHandle_.GetGemHandle();
-      HWC2_ALOGD_IF_VERBOSE("bufferInfoMap_ GemHandle cache! BufferId=%" PRIx64 " Name=%s  GemHandle=%d ptr=%p",
-                            buffer_id,pBufferInfo_->sLayerName_.c_str(),
-                            drmHwcLayer->uGemHandle_,
-                            drmHwcLayer);
+      bGemCacheHit_ = true;
+      HWC2_EVENT(kEvGemHandleHit, id_, drmHwcLayer->uGemHandle_, buffer_id);
       return 0;
     }
 
     void setSidebandStream(buffer_handle_t stream) {
-      if(stream != sidebandStreamHandle_){
-        if(sidebandStreamHandle_ != NULL){
-          int ret = drmGralloc_->freeBuffer(sidebandStreamHandle_);
-          if(ret){
-            ALOGE("freeBuffer sidebandStreamHandle = %p fail, ret=%d",sidebandStreamHandle_,ret);
-          }
-          sidebandStreamHandle_ = NULL;
-        }
+      // SurfaceFlinger 每次事务都会重新设置 stream, 未变化时复用已 import 的 handle,
+      // 避免每帧 importBuffer 以及 mCurrentState 变化导致图层被认为有更新
+      if(stream == sidebandStreamOrigin_)
+        return;
+      sidebandStreamOrigin_ = stream;
 
-        if(stream != NULL){
-          buffer_handle_t tempHandle;
-          int ret = drmGralloc_->importBuffer(stream,&tempHandle);
-          if(ret){
-            ALOGE("importBuffer stream=%p, tempHandle=%p fail, ret=%d",stream,tempHandle,ret);
-          }
-          sidebandStreamHandle_ = tempHandle;
-          mCurrentState.sidebandStreamHandle_ = tempHandle;
+      if(sidebandStreamHandle_ != NULL){
+        int ret = drmGralloc_->freeBuffer(sidebandStreamHandle_);
+        if(ret){
+          ALOGE("freeBuffer sidebandStreamHandle = %p fail, ret=%d",sidebandStreamHandle_,ret);
         }
+        sidebandStreamHandle_ = NULL;
       }
-      // Bufferinfo Cache
+      mCurrentState.sidebandStreamHandle_ = NULL;
+
+      if(stream == NULL)
+        return;
+
+      buffer_handle_t tempHandle = NULL;
+      int ret = drmGralloc_->importBuffer(stream,&tempHandle);
+      if(ret){
+        ALOGE("importBuffer stream=%p, tempHandle=%p fail, ret=%d",stream,tempHandle,ret);
+        sidebandStreamOrigin_ = NULL;
+        return;
+      }
+      sidebandStreamHandle_ = tempHandle;
+      mCurrentState.sidebandStreamHandle_ = tempHandle;
+
+      // Bufferinfo Cache, stream 切换时重新获取全部信息,
+      // 同一 BufferId 的 stream 属性 (宽高/格式等) 也可能已改变
       uint64_t buffer_id;
       drmGralloc_->hwc_get_handle_buffer_id(sidebandStreamHandle_, &buffer_id);
 
       bufferInfoMap_.clear();
-      auto ret = bufferInfoMap_.emplace(std::make_pair(buffer_id, std::make_shared<bufferInfo_t>(bufferInfo())));
-      if(ret.second == false){
+      auto ret_emplace = bufferInfoMap_.emplace(std::make_pair(buffer_id, std::make_shared<bufferInfo_t>(bufferInfo())));
+      if(ret_emplace.second == false){
         HWC2_ALOGD_IF_VERBOSE("bufferInfoMap_ emplace fail! BufferHandle=%p",sidebandStreamHandle_);
       }else{
-        pBufferInfo_ = ret.first->second;
+        pBufferInfo_ = ret_emplace.first->second;
         pBufferInfo_->uBufferId_ = buffer_id;
         pBufferInfo_->iFd_     = drmGralloc_->hwc_get_handle_primefd(sidebandStreamHandle_);
         pBufferInfo_->iWidth_  = drmGralloc_->hwc_get_handle_attibute(sidebandStreamHandle_,ATT_WIDTH);
@@ -461,6 +471,9 @@ class DrmHwcTwo : public hwc2_device_t {
                     uint32_t frame_no,
                     bool validate);
 
+    // SolidColor 图层获取填充 buffer，失败则回退 GLES 合成
+    std::shared_ptr<DrmBuffer> GetSolidColorBuffer(hwc2_drm_display_t* ctx);
+
     const std::shared_ptr<bufferInfo_t> GetBufferInfo() { return pBufferInfo_;};
     void DumpLayerInfo(String8 &output);
 
@@ -469,6 +482,9 @@ class DrmHwcTwo : public hwc2_device_t {
     void EnableAfbc() { is_afbc_ = true;};
     void DisableAfbc() { is_afbc_ = false;};
     bool isAfbc() { return is_afbc_;};
+    // 最近一次 CacheBufferInfo / initOrGetGemhanleFromCache 是否命中缓存, 用于 trace 统计
+    bool buffer_cache_hit() const { return bBufferCacheHit_;};
+    bool gem_cache_hit() const { return bGemCacheHit_;};
     bool StateChange() {
       if(mCurrentState == mDrawingState){
         return false;
@@ -515,6 +531,8 @@ class DrmHwcTwo : public hwc2_device_t {
     buffer_handle_t buffer_ = NULL;
     // SidebandStream Handle
     buffer_handle_t sidebandStreamHandle_ = NULL;
+    // SurfaceFlinger 传入的原始 stream, 用于判断 stream 是否变化
+    buffer_handle_t sidebandStreamOrigin_ = NULL;
     // current frame state
     Hwc2LayerState_t mCurrentState;
     // last frame state
@@ -525,6 +543,8 @@ class DrmHwcTwo : public hwc2_device_t {
 
     // Buffer info map
     bool bHasCache_ = false;
+    bool bBufferCacheHit_ = false;
+    bool bGemCacheHit_ = false;
     std::map<uint64_t, std::shared_ptr<bufferInfo_t>> bufferInfoMap_;
     std::string layer_name_;
     bool is_afbc_;
@@ -570,6 +590,8 @@ class DrmHwcTwo : public hwc2_device_t {
                HWC2::DisplayType type);
     HwcDisplay(const HwcDisplay &) = delete;
     HWC2::Error Init();
+    // 绑定 crtc 并分配 PlaneGroup, 副屏异步初始化时也需在主屏首次 Validate 前完成
+    HWC2::Error InitDpyRes();
 
     HWC2::Error InitVirtual();
 
@@ -624,6 +646,7 @@ class DrmHwcTwo : public hwc2_device_t {
     HWC2::Error SetClientTarget(buffer_handle_t target, int32_t acquire_fence,
                                 int32_t dataspace, hwc_region_t damage);
     HWC2::Error SetColorMode(int32_t mode);
+    HWC2::Error SetCursorPosition(hwc2_layer_t layer, int32_t x, int32_t y);
     HWC2::Error SetColorTransform(const float *matrix, int32_t hint);
     HWC2::Error SetOutputBuffer(buffer_handle_t buffer, int32_t release_fence);
     HWC2::Error SetPowerMode(int32_t mode);
@@ -654,6 +677,8 @@ class DrmHwcTwo : public hwc2_device_t {
    int UpdateOverscan();
    int SwitchHdrMode();
    void UpdateSvepState();
+   void UpdateDmcHint();
+   void UpdateTelemetry();
 
    // Static Screen opt function
    int UpdateTimerEnable();
@@ -666,12 +691,19 @@ class DrmHwcTwo : public hwc2_device_t {
 
    private:
     HWC2::Error ValidatePlanes();
+    uint64_t GetPlanSignature();
     HWC2::Error InitDrmHwcLayer();
     HWC2::Error CreateComposition();
+    HWC2::Error CreateCompositionWithOutFence(
+        std::unique_ptr<DrmDisplayComposition> composition);
+    bool UseKernelOutFence() const {
+      return compositor_ && compositor_->UseKernelOutFence();
+    }
     bool IsLayerStateChange();
     int ImportBuffers();
     void AddFenceToRetireFence(int fd);
     int DoMirrorDisplay(int32_t *retire_fence);
+    int AddCloneComposition(DrmDisplayComposition *composition);
 
     ResourceManager *resource_manager_;
     DrmDevice *drm_;
@@ -681,6 +713,7 @@ class DrmHwcTwo : public hwc2_device_t {
 
     std::vector<DrmHwcLayer> drm_hwc_layers_;
     std::vector<DrmCompositionPlane> composition_planes_;
+    uint64_t iPlanSignature_ = 0;
 
     std::vector<PlaneGroup*> plane_group;
 
@@ -700,6 +733,7 @@ class DrmHwcTwo : public hwc2_device_t {
 
     int32_t color_mode_;
     bool init_success_;
+    bool dpy_res_bound_ = false;
     bool validate_success_;
     bool present_finish_;
     hwc2_drm_display_t ctx_;
@@ -712,6 +746,8 @@ class DrmHwcTwo : public hwc2_device_t {
     int iLastLayerSize_;
 
     uint32_t frame_no_ = 0;
+    // 当前帧的 async trace 已开始且尚未交给 composition 结束
+    bool bTraceFrame_ = false;
     SyncTimeline sync_timeline_;
     DeferredRetireFence d_retire_fence_;
     bool bDropFrame_;
@@ -719,6 +755,10 @@ class DrmHwcTwo : public hwc2_device_t {
     bool bVrrDisplay_;
 
     bool bUseWriteBack_;
+    // 上次读取显示设置时的 DrmSettings generation
+    uint64_t uSettingsGeneration_ = 0;
+    // CropSpilt 副屏已完成首次 modeset, 之后由主屏 composition 克隆送显
+    std::set<int> setCloneDisplay_;
   };
 
   class DrmHotplugHandler : public DrmEventHandler {
@@ -728,10 +768,20 @@ class DrmHwcTwo : public hwc2_device_t {
     }
     void HandleEvent(uint64_t timestamp_us);
     void HandleResolutionSwitchEvent(int display_id);
+    // 副屏后台初始化完成后重放期间被推迟的事件
+    void ReplayDeferredEvent();
 
    private:
+    void HandleHotplug(uint64_t timestamp_us);
+    void HandleResolutionSwitch(int display_id);
+
     DrmHwcTwo *hwc2_;
     DrmDevice *drm_;
+    // 串行处理事件, 重放与事件线程可能同时进入
+    std::mutex mtxEvent_;
+    // 以下由 hwc2_->mtxDisplayInit_ 保护
+    bool bHotplugDeferred_ = false;
+    std::set<int> setResolutionDeferred_;
   };
 
   static DrmHwcTwo *toDrmHwcTwo(hwc2_device_t *dev) {
@@ -794,10 +844,15 @@ class DrmHwcTwo : public hwc2_device_t {
   uint32_t GetMaxVirtualDisplayCount();
   HWC2::Error RegisterCallback(int32_t descriptor, hwc2_callback_data_t data,
                                hwc2_function_pointer_t function);
-  HWC2::Error CreateDisplay(hwc2_display_t displ, HWC2::DisplayType type);
+  HWC2::Error CreateDisplay(hwc2_display_t displ, HWC2::DisplayType type,
+                            bool init = true);
   void HandleDisplayHotplug(hwc2_display_t displayid, int state);
   void HandleInitialHotplugState(DrmDevice *drmDevice);
   bool IsHasRegisterDisplayId(hwc2_display_t displayid);
+  // 副屏后台初始化, 完成后向 SurfaceFlinger 补报热插拔
+  void InitSecondaryDisplays(std::vector<hwc2_display_t> displays);
+  void WaitDisplayInit();
+  bool IsDisplayInitDone() const { return bDisplayInitDone_; }
 
   static void StaticScreenOptHandler(int sig){
     if (sig == SIGALRM)
@@ -815,6 +870,11 @@ class DrmHwcTwo : public hwc2_device_t {
   std::atomic<int> mVirtualDisplayCount_;
   // 通过 mHasRegisterDisplay_ 存储已向SurfaceFlinger注册的display
   std::set<hwc2_display_t> mHasRegisterDisplay_;
+  // 副屏后台初始化状态, mtxDisplayInit_ 同时保护 callbacks_
+  std::mutex mtxDisplayInit_;
+  std::vector<DrmHotplugHandler *> vHotplugHandler_;
+  std::condition_variable cvDisplayInit_;
+  std::atomic<bool> bDisplayInitDone_{true};
 };
 }  // namespace android
 #endif // DRM_HWC_TWO_H
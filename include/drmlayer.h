@@ -215,6 +215,9 @@ struct DrmHwcLayer {
   bool bSkipLayer_;
   float fHScaleMul_;
   float fVScaleMul_;
+  // Plane 能力预筛需求，Init() 时计算，见 DrmPlane::is_caps_match()
+  uint64_t uPlaneFormatBit_=0;
+  uint32_t uPlaneCapsReq_=0;
 
   // Buffer info
   uint64_t uBufferId_;
@@ -254,6 +257,12 @@ struct DrmHwcLayer {
   // Use Rga
   bool bUseRga_;
   std::shared_ptr<DrmBuffer> pRgaBuffer_;
+  // 图层已由 RGA 合成到其他图层的 pRgaBuffer_ 中, 不占用 DrmPlane
+  bool bRgaCompose_=false;
+  // 承载 RGA 合成结果的图层记录被合成图层的 id, 共用 ReleaseFence
+  std::vector<uint32_t> vRgaComposeIds_;
+  // DrmPlane 不支持的旋转/缩放由 RGA 预处理, pRgaBuffer_ 为处理结果
+  bool bRgaTransform_=false;
 
   bool bUseSvep_;
   std::shared_ptr<DrmBuffer> pSvepBuffer_;
@@ -261,6 +270,13 @@ struct DrmHwcLayer {
   bool bUsePq_;
   std::shared_ptr<DrmBuffer> pPqBuffer_;
 
+  // SolidColor 图层使用填充 buffer 送显
+  bool bSolidColor_=false;
+  std::shared_ptr<DrmBuffer> pSolidColorBuffer_;
+
+  // Cursor 图层, 独占 plane 时位置更新走 DrmDisplayCompositor::CommitCursor()
+  bool bCursor_=false;
+
   DrmLayerInfoStore storeLayerInfo_;
 
   int ImportBuffer(Importer *importer);
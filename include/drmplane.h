@@ -38,11 +38,17 @@ typedef struct tagPlaneGroup{
 	std::vector<DrmPlane*> planes;
 
   uint32_t current_crtc_ = 0;
+  // 跨 CRTC 迁移中, 旧 CRTC 提交 disable 之前新 CRTC 不可使用, 见 DrmPlaneBalancer
+  uint32_t release_crtc_ = 0;
+  int64_t release_display_ = -1;
 
   bool acquire(uint32_t crtc_mask){
     if(bReserved)
       return false;
 
+    if(release_crtc_)
+      return false;
+
     if(!(possible_crtcs & crtc_mask))
       return false;
 
@@ -56,6 +62,9 @@ typedef struct tagPlaneGroup{
     if(bReserved)
       return false;
 
+    if(release_crtc_)
+      return false;
+
     if(!(possible_crtcs & crtc_mask))
       return false;
 
@@ -82,6 +91,10 @@ typedef struct tagPlaneGroup{
     return true;
   }
 
+  bool is_releasing(uint32_t crtc_mask, int64_t display){
+    return (release_crtc_ & crtc_mask) && release_display_ == display;
+  }
+
 }PlaneGroup;
 
 
@@ -236,6 +249,35 @@ enum DrmPlaneFeatureTypeBit{
       DRM_PLANE_FEARURE_BIT_AFBDC   = 1 << DRM_PLANE_FEARURE_AFBDC,
 };
 
+// Plane 能力位，与 DrmHwcLayer::uPlaneCapsReq_ 按位与做预筛
+enum DrmPlaneCapBit{
+      DRM_PLANE_CAP_SCALE = 1 << 0,
+      DRM_PLANE_CAP_ALPHA = 1 << 1,
+      DRM_PLANE_CAP_HDR   = 1 << 2,
+      DRM_PLANE_CAP_YUV   = 1 << 3,
+      DRM_PLANE_CAP_AFBC  = 1 << 4,
+};
+
+// Plane 能力表，DrmPlane::Init() 时计算一次
+typedef struct tagDrmPlaneCaps{
+  // 格式位图，bit 由 DrmPlaneFormatBit() 给出
+  uint64_t format_mask=0;
+  uint64_t afbc_format_mask=0;
+  uint32_t features=0;
+  // 普通模式与 8K 模式可能支持的 transform 并集
+  uint32_t transform_mask=0;
+  float scale_min=1.0;
+  float scale_max=1.0;
+  bool  scale_min_inclusive=true;
+  int input_w_max=0;
+  int input_h_max=0;
+  int output_w_max=0;
+  int output_h_max=0;
+}DrmPlaneCaps;
+
+// fourcc 对应的格式位，不在格式表中的返回 0
+uint64_t DrmPlaneFormatBit(uint32_t fourcc);
+
 class DrmDevice;
 
 class DrmPlane {
@@ -302,6 +344,20 @@ class DrmPlane {
   bool is_support_output(int output_w, int output_h);
   bool is_support_format(uint32_t format, bool afbcd);
   bool is_support_transform(int transform);
+  const DrmPlaneCaps &get_caps() const{ return caps_; }
+  // 能力预筛，只做位运算，通过后仍需完整的 is_support_* 检查
+  // format_bit 为 0 时不检查格式
+  inline bool is_caps_match(uint64_t format_bit, uint64_t format_mask,
+                            uint32_t caps_req, uint32_t transform) const{
+    if(format_bit && !(format_bit & format_mask))
+      return false;
+    if(caps_req & ~caps_.features)
+      return false;
+    return (transform & ~caps_.transform_mask) == 0;
+  }
+  inline uint64_t get_format_mask(bool afbcd) const{
+    return afbcd ? caps_.afbc_format_mask : caps_.format_mask;
+  }
   inline uint32_t get_possible_crtc_mask() const{ return possible_crtc_mask_; }
   inline void set_current_crtc_bit(uint32_t current_crtc) { current_crtc_ = current_crtc;}
   inline uint32_t get_current_crtc_bit() const{ return current_crtc_; }
@@ -319,6 +375,9 @@ class DrmPlane {
 
 
  private:
+  void UpdateCaps();
+  bool is_support_format_slow(uint32_t format, bool afbcd);
+
   DrmDevice *drm_;
   uint32_t id_;
 
@@ -375,6 +434,7 @@ class DrmPlane {
   float scale_max_=0.0;
 
   std::set<uint32_t> support_format_list;
+  DrmPlaneCaps caps_;
   drmModePlanePtr plane_;
   int soc_id_;
 };
@@ -75,6 +75,10 @@ class Planner {
                                 std::vector<DrmHwcLayer*> &layers,
                                 DrmCrtc *crtc,
                                 std::vector<PlaneGroup *> &plane_groups) = 0;
+    // Validate 中推迟的硬件任务 (如 RGA 预合成), 方案确定送显后再提交
+    virtual int RunDeferredJobs(std::vector<DrmHwcLayer> & /*layers*/) {
+      return 0;
+    }
    protected:
     // Inserts the given layer:plane in the composition at the back
     virtual int MatchPlane(std::vector<DrmCompositionPlane> *composition_planes,
@@ -101,6 +105,9 @@ class Planner {
       DrmCrtc *crtc,
       bool gles_policy);
 
+  // 提交各 stage 推迟的硬件任务, layers 为最终送显的图层
+  int RunDeferredJobs(std::vector<DrmHwcLayer> &layers);
+
   template <typename T, typename... A>
   void AddStage(A &&... args) {
     stages_.emplace_back(
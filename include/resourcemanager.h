@@ -32,6 +32,12 @@
 #include <set>
 #include <map>
 #include <mutex>
+
+// SolidColor 图层填充 buffer：尺寸为 framebuffer 的 1/SOLID_COLOR_SCALE，
+// 由 plane 放大到 display_frame，最多缓存 SOLID_COLOR_BUFFER_MAX 种颜色
+#define SOLID_COLOR_SCALE 4
+#define SOLID_COLOR_BUFFER_MAX 8
+
 namespace android {
 class DrmDisplayCompositor;
 class DrmHwcTwo;
@@ -85,6 +91,9 @@ class ResourceManager {
   int SwapWBBuffer();
   // WriteBack interface.
 
+  // SolidColor 图层填充 buffer，按颜色缓存，失败返回 NULL
+  std::shared_ptr<DrmBuffer> GetSolidColorBuffer(hwc_color_t color, int width, int height);
+
   // 判断同显与异显的方法
   int ClearBufferId(int display);
   int AddBufferId(int display, uint64_t buffer_id);
@@ -94,6 +103,7 @@ class ResourceManager {
   // 系统属性开关
   bool IsDropMode() const { return mDropMode_;}
   bool IsDynamicDisplayMode() const { return mDynamicDisplayMode_;}
+  bool IsSolidColorMode() const { return mSolidColorMode_;}
 
  private:
   ResourceManager();
@@ -127,11 +137,15 @@ class ResourceManager {
   std::shared_ptr<DrmBuffer> mFinishWriteBackBuffer_;
 
   std::map<int, std::set<uint64_t>> mMapDisplayBufferSet_;
+  // SolidColor 填充 buffer 缓存, key 为 RGB 与尺寸
+  std::map<uint64_t, std::shared_ptr<DrmBuffer>> mapSolidColorBuffer_;
 
   // 关闭丢帧模式
   bool mDropMode_;
   // 使能动态分辨率切换模式
   bool mDynamicDisplayMode_;
+  // 使能 SolidColor 图层硬件合成
+  bool mSolidColorMode_;
 
   mutable std::mutex mtx_;
 };
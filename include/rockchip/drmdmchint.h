@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DRM_DMC_HINT_H_
+#define _DRM_DMC_HINT_H_
+
+#include <utils/String8.h>
+
+#include <map>
+#include <mutex>
+#include <stdint.h>
+
+namespace android {
+
+#define DMC_HINT_DEFAULT "1"
+// 场景切换阈值，单位 MB/s
+#define DMC_LOW_MB_DEFAULT "400"
+#define DMC_4K_MB_DEFAULT "1500"
+#define DMC_PERF_MB_DEFAULT "3000"
+// 降档需低于阈值的百分比
+#define DMC_HYSTERESIS_DEFAULT "20"
+// 降档需持续的时间
+#define DMC_HINT_INTERVAL_MS_DEFAULT "500"
+// 升档需持续的时间, 约两帧
+#define DMC_UP_INTERVAL_MS_DEFAULT "32"
+
+// DDR 场景变频提示：
+//   汇总所有 display 的扫描带宽 + RGA/SVEP 带宽，映射到 dmc system_status 场景码。
+//   升档需超过阈值并持续约两帧，降档需低于阈值一定比例并持续一段时间，避免频繁切换。
+class DrmDmcHint{
+public:
+  static DrmDmcHint* getInstance(){
+    static DrmDmcHint drmDmcHint_;
+    return &drmDmcHint_;
+  }
+
+  enum DmcScene{
+    kDmcSceneLow = 0,
+    kDmcSceneNormal,
+    kDmcScene4K,
+    kDmcScenePerf,
+    kDmcSceneCnt,
+  };
+
+  // 更新 display 每帧的带宽估算，单位 Byte/s
+  void UpdateDisplay(int display, uint64_t bandwidth);
+  // display 关闭后移除
+  void RemoveDisplay(int display);
+  // SVEP 场景变频
+  void SetSvepState(bool enable);
+  void Dump(String8 &output);
+
+private:
+  DrmDmcHint();
+  ~DrmDmcHint();
+  DrmDmcHint(const DrmDmcHint&);
+  DrmDmcHint& operator=(const DrmDmcHint&);
+
+  int WriteStatus(char status);
+  DmcScene TargetScene(uint64_t total_mb);
+  void ApplyScene(DmcScene scene, uint64_t total_mb, int64_t now);
+
+  bool bEnable_;
+  int iFd_;
+  int64_t iOpenFailNs_;
+  uint64_t uThresholdMb_[kDmcSceneCnt - 1];
+  int iHysteresis_;
+  int64_t iIntervalNs_;
+  int64_t iUpIntervalNs_;
+
+  DmcScene eScene_;
+  int64_t iSceneNs_;
+  int64_t iDownSinceNs_;
+  int64_t iUpSinceNs_;
+  uint32_t uTransitionCnt_;
+  uint64_t uTotalMb_;
+  std::map<int, uint64_t> mapDisplayBw_;
+  std::mutex mtx_;
+};
+
+} // namespace android
+
+#endif // _DRM_DMC_HINT_H_
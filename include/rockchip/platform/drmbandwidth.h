@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DRM_BANDWIDTH_H_
+#define _DRM_BANDWIDTH_H_
+
+#include "drmlayer.h"
+#include "drmcrtc.h"
+
+#include <utils/String8.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace android {
+
+#define BANDWIDTH_CHECK_DEFAULT "1"
+// AFBC 压缩后读带宽占原始数据的百分比
+#define AFBC_COMPRESS_RATIO_DEFAULT "60"
+
+// VOP 读 DDR 带宽模型：
+//   layer_bw = src_w * bpp * (src_h / dst_h) * line_rate * afbc_ratio
+// 其中 line_rate = v_total * refresh，即每条扫描线时间内 VOP 需取回的源数据。
+// 预算按 SoC + 当前 DDR 最高频点查表，多个 display 共享同一预算。
+class DrmBandwidth{
+public:
+  static DrmBandwidth* getInstance(){
+    static DrmBandwidth drmBandwidth_;
+    return &drmBandwidth_;
+  }
+
+  // 单个图层的读带宽估算，单位 Byte/s
+  uint64_t LayerBandwidth(DrmHwcLayer *layer, DrmCrtc *crtc);
+  // 一组图层的读带宽估算，单位 Byte/s
+  uint64_t PlanBandwidth(std::vector<DrmHwcLayer*> &layers, DrmCrtc *crtc);
+  // RGA/SVEP 预处理的读写带宽估算，单位 Byte/s
+  uint64_t PostProcessBandwidth(DrmHwcLayer *layer, DrmCrtc *crtc);
+  // crtc 当前生效方案的扫描带宽，单位 Byte/s
+  uint64_t DisplayBandwidth(DrmCrtc *crtc);
+  // 检查 crtc 上的方案是否超出剩余预算，超出返回 -1
+  int CheckPlan(DrmCrtc *crtc, uint64_t plan_bw);
+  // 记录 crtc 当前生效方案的带宽
+  void UpdatePlan(DrmCrtc *crtc, uint64_t plan_bw);
+  // display 关闭后释放其占用的预算
+  void ClearPlan(DrmCrtc *crtc);
+  bool Enable(){ return bEnable_; };
+  void Dump(String8 &output);
+
+private:
+  DrmBandwidth();
+  ~DrmBandwidth(){};
+  DrmBandwidth(const DrmBandwidth&);
+  DrmBandwidth& operator=(const DrmBandwidth&);
+
+  // 当前 SoC / DDR 频点下的 VOP 总预算，单位 Byte/s
+  uint64_t Budget(uint32_t soc_id);
+  uint32_t GetDdrMaxFreqMHz();
+  void GetModeRate(DrmCrtc *crtc, uint64_t *line_rate, uint64_t *refresh);
+  uint64_t OtherDisplayBandwidth(int display);
+
+  struct BandwidthInfo{
+    uint64_t uPlanBw_ = 0;
+    uint64_t uBudget_ = 0;
+    uint32_t uRejectCnt_ = 0;
+  };
+
+  bool bEnable_;
+  int iAfbcRatio_;
+  uint64_t uBudgetOverride_;
+  uint32_t uSocId_;
+  uint32_t uDdrFreqMHz_;
+  int64_t iDdrFreqUpdateNs_;
+  std::map<int, BandwidthInfo> mapDisplayBw_;
+  mutable std::mutex mtx_;
+};
+
+} // namespace android
+
+#endif // _DRM_BANDWIDTH_H_
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DRM_PLANE_BALANCER_H_
+#define _DRM_PLANE_BALANCER_H_
+
+#include "drmplane.h"
+#include "drmcrtc.h"
+
+#include <utils/String8.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace android {
+
+class DrmDevice;
+class DrmDisplayComposition;
+
+#define PLANE_BALANCE_DEFAULT "0"
+// 统计窗口帧数
+#define PLANE_BALANCE_WINDOW_DEFAULT "60"
+// 窗口内 GLES 回退帧占比超过该值认为 Plane 不足
+#define PLANE_BALANCE_HUNGRY_PERCENT_DEFAULT "50"
+// 连续多少个窗口满足条件才迁移
+#define PLANE_BALANCE_HOLD_WINDOWS 2
+// 迁移后两个 display 的冷却时间
+#define PLANE_BALANCE_COOLDOWN_MS_DEFAULT "3000"
+// 旧 CRTC 在该时间内未提交 disable 则取消迁移
+#define PLANE_BALANCE_RELEASE_TIMEOUT_MS 1000
+// 供出方超过该时间未送显则不参与迁移
+#define PLANE_BALANCE_ACTIVE_MS 1000
+
+// 跨 CRTC 的 PlaneGroup 动态调配：
+//   1. 每帧 ValidatePlanes 结束时 Record() 统计各 display 的 Plane 需求;
+//   2. 某 display 连续多个窗口因 Plane 不足回退 GLES, 且另一 display 连续多个窗口
+//      至少空闲两个 PlaneGroup 时, 在需求方 ValidatePlanes 开始处 (Rebalance) 迁移一个 PlaneGroup;
+//   3. 迁移中的 PlaneGroup 先由旧 CRTC 在下一帧提交 disable (DisableUnusedPlanes),
+//      供出方可能是静态画面, 由需求方主动刷新供出方, CommitDone() 确认后新 CRTC 才可 acquire;
+//   4. 迁移后双方进入冷却期, 迁回同样需要满足以上条件, 避免来回迁移.
+class DrmPlaneBalancer{
+public:
+  static DrmPlaneBalancer* getInstance(){
+    static DrmPlaneBalancer drmPlaneBalancer_;
+    return &drmPlaneBalancer_;
+  }
+
+  bool Enable(){ return bEnable_; }
+  // 记录一帧的需求, owned/used 为当前 display 可用/已用的 PlaneGroup 数
+  void Record(DrmCrtc *crtc, int layer_cnt, int gles_cnt, int owned, int used);
+  // display 开始分配 Plane 前调用, 处理超时并在需要时发起迁移,
+  // 返回需要刷新以提交 disable 的供出方 display, 无则返回 -1
+  int Rebalance(DrmDevice *drm, DrmCrtc *crtc);
+  // 提交上屏后 (blocking commit 返回或 page flip 事件) 调用,
+  // 确认迁移中的 PlaneGroup 已在旧 CRTC 上关闭
+  void CommitDone(DrmDisplayComposition *composition);
+  // TryAssignPlane 重新分配后, 清空迁移状态
+  void Reset(DrmDevice *drm);
+  void Dump(String8 &output);
+
+private:
+  DrmPlaneBalancer();
+  ~DrmPlaneBalancer(){};
+  DrmPlaneBalancer(const DrmPlaneBalancer&);
+  DrmPlaneBalancer& operator=(const DrmPlaneBalancer&);
+
+  struct DisplayLoad{
+    uint32_t uCrtcMask_ = 0;
+    int iFrameCnt_ = 0;
+    int iGlesFrameCnt_ = 0;
+    int iMaxUsed_ = 0;
+    int iMinOwned_ = 0;
+    int iHungryWindow_ = 0;
+    int iIdleWindow_ = 0;
+    int iSpare_ = 0;
+    int64_t iLastRecordNs_ = 0;
+    int64_t iCooldownNs_ = 0;
+    uint32_t uMigrateIn_ = 0;
+    uint32_t uMigrateOut_ = 0;
+  };
+
+  struct PendingRelease{
+    PlaneGroup *pPlaneGroup_;
+    int iFromDisplay_;
+    uint32_t uFromCrtcMask_;
+    int iToDisplay_;
+    uint32_t uToCrtcMask_;
+    int64_t iStartNs_;
+  };
+
+  bool IsMigratable(PlaneGroup *plane_group, uint32_t soc_id);
+  PlaneGroup *FindDonorGroup(DrmDevice *drm, int donor, uint32_t donor_mask,
+                             uint32_t recv_mask, uint32_t soc_id);
+  void CheckReleaseTimeout(int64_t now);
+
+  bool bEnable_;
+  int iWindow_;
+  int iHungryPercent_;
+  int64_t iCooldownNs_;
+  std::map<int, DisplayLoad> mapDisplayLoad_;
+  std::vector<PendingRelease> vPendingRelease_;
+  mutable std::mutex mtx_;
+};
+
+} // namespace android
+
+#endif // _DRM_PLANE_BALANCER_H_
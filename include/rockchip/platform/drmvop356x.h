@@ -121,6 +121,7 @@ typedef struct StateContext{
   // Multi area
   bool bMultiAreaEnable=false;
   bool bMultiAreaScaleEnable=false;
+  bool bCombineLayerCheck=false;
   bool bMultiAreaMode=false;
   bool bSmartScaleEnable=false;
 
@@ -200,6 +201,7 @@ typedef struct DrmVop2Context{
   bool HasLayer(std::vector<DrmHwcLayer*>& layer_vector,DrmHwcLayer *layer);
   int  IsXIntersect(hwc_rect_t* rec,hwc_rect_t* rec2);
   bool IsRec1IntersectRec2(hwc_rect_t* rec1, hwc_rect_t* rec2);
+  bool IsLayerCombineAttr(DrmHwcLayer *layer_one,DrmHwcLayer *layer_two);
   bool IsLayerCombine(DrmHwcLayer *layer_one,DrmHwcLayer *layer_two);
   bool HasGetNoAfbcUsablePlanes(DrmCrtc *crtc, std::vector<PlaneGroup *> &plane_groups);
   bool HasGetNoYuvUsablePlanes(DrmCrtc *crtc, std::vector<PlaneGroup *> &plane_groups);
@@ -209,6 +211,7 @@ typedef struct DrmVop2Context{
   bool GetCrtcSupported(const DrmCrtc &crtc, uint32_t possible_crtc_mask);
   bool HasPlanesWithSize(DrmCrtc *crtc, int layer_size, std::vector<PlaneGroup *> &plane_groups);
   int  CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*>& layers,uint32_t iPlaneSize);
+  void CombineLayerLegacy(LayerMap& layer_map,std::vector<DrmHwcLayer*>& layers);
   int  GetPlaneGroups(DrmCrtc *crtc, std::vector<PlaneGroup *>&out_plane_groups);
   void ResetLayerFromTmpExceptFB(std::vector<DrmHwcLayer*>& layers, std::vector<DrmHwcLayer*>& tmp_layers);
   void ResetLayerFromTmp(std::vector<DrmHwcLayer*>& layers, std::vector<DrmHwcLayer*>& tmp_layers);
@@ -42,6 +42,11 @@
 
 #ifdef USE_LIBSVEP
 #include "Svep.h"
+// SVEP 上下文数量, 多帧的 SVEP 任务可以同时排队
+#define SVEP_CTX_NUM 2
+// 连续 SVEP_MISS_FALLBACK_CNT 帧无法按时处理, 则 SVEP_FALLBACK_FRAMES 帧内退回 VOP 缩放
+#define SVEP_MISS_FALLBACK_CNT 3
+#define SVEP_FALLBACK_FRAMES 120
 #endif
 
 #include <cutils/properties.h>
@@ -64,9 +69,20 @@
 #define MALI_GRALLOC_USAGE_NO_AFBC (1ULL << 29)
 #endif
 
+// RGA 多图层预合成最多合成的图层数
+#define RGA_COMPOSE_MAX_LAYERS "4"
+// DrmPlane 不支持的旋转/缩放/宽度由 RGA 预处理
+#define RGA_TRANSFORM_OFFLOAD_DEFAULT "1"
+// RGA 处理的源宽度上限
+#define RGA_MAX_INPUT_WIDTH 8176
+// 同时由 RGA 预处理的图层数上限, 每个图层缓存一个 DrmBufferQueue
+#define RGA_TRANSFORM_MAX_LAYERS 2
+
 namespace android {
 class DrmDevice;
 
+struct RgaComposePending;
+
 // This plan stage places as many layers on dedicated planes as possible (first
 // come first serve), and then sticks the rest in a precomposition plane (if
 // needed).
@@ -85,6 +101,7 @@ typedef enum tagComposeMode{
    HWC_GLES_SIDEBAND_LOPICY,
    HWC_GLES_POLICY,
    HWC_RGA_OVERLAY_LOPICY,
+   HWC_RGA_COMPOSE_LOPICY,
    HWC_SVEP_OVERLAY_LOPICY,
    HWC_3D_LOPICY,
    HWC_DEBUG_POLICY
@@ -167,10 +184,16 @@ typedef struct StateContext{
   // Multi area
   bool bMultiAreaEnable=false;
   bool bMultiAreaScaleEnable=false;
+  bool bCombineLayerCheck=false;
   bool bMultiAreaMode=false;
   bool bSmartScaleEnable=false;
   // rga policy
   bool bRgaPolicyEnable=false;
+  // rga compose policy
+  bool bRgaComposeEnable=false;
+  int iRgaComposeMaxCnt=0;
+  // rga transform offload
+  bool bRgaTransformEnable=false;
 
   int iVopMaxOverlay4KPlane=0;
 
@@ -212,9 +235,42 @@ struct SvepXml{
   std::vector<std::string> mSvepBlacklist_;
 };
 
+// RGA 预处理结果缓存, 源 buffer 及参数不变时复用上一次的输出
+struct RgaTransformCache{
+  std::shared_ptr<DrmBufferQueue> bufferQueue_;
+  uint64_t uSrcBufferId_ = 0;
+  uint32_t uTransform_ = 0;
+  hwc_frect_t mSrcCrop_ = {0, 0, 0, 0};
+  int iDstWidth_ = 0;
+  int iDstHeight_ = 0;
+  bool bActive_ = false;
+};
+
+#ifdef USE_LIBSVEP
+// SVEP 上下文, 源图像几何信息不变时只更新 buffer
+struct SvepJobSlot{
+  SvepContext mCtx_;
+  bool bInit_ = false;
+  int iSrcWidth_ = 0;
+  int iSrcHeight_ = 0;
+  int iSrcFormat_ = 0;
+  int iSrcStride_ = 0;
+  bool bSrcAfbc_ = false;
+  int iOutputMode_ = 0;
+  hwc_frect_t mSrcCrop_ = {0, 0, 0, 0};
+  SvepImageInfo mRequire_;
+  int iEnhancementRate_ = -1;
+  int iOsdMode_ = -1;
+  // 最近一次任务的输出, FinishFence 未 signal 表示任务仍在执行
+  std::shared_ptr<DrmBuffer> pOutput_;
+};
+#endif
+
  public:
   Vop3588()
-    : rgaBufferQueue_((std::make_shared<DrmBufferQueue>()))
+    : rgaBufferQueue_((std::make_shared<DrmBufferQueue>())),
+      rgaComposeBufferQueue_((std::make_shared<DrmBufferQueue>())),
+      uRgaComposeSignature_(0)
 #ifdef USE_LIBSVEP
      ,
      bufferQueue_((std::make_shared<DrmBufferQueue>()))
@@ -229,6 +285,7 @@ struct SvepXml{
                    std::vector<PlaneGroup *> &plane_groups,
                    DrmCrtc *crtc,
                    bool gles_policy);
+  int RunDeferredJobs(std::vector<DrmHwcLayer> &layers);
   // Try to assign DrmPlane to display
   int TryAssignPlane(DrmDevice* drm, const std::map<int,int> map_dpys);
  protected:
@@ -238,6 +295,20 @@ struct SvepXml{
   int TryRgaOverlayPolicy(std::vector<DrmCompositionPlane> *composition,
                       std::vector<DrmHwcLayer*> &layers, DrmCrtc *crtc,
                       std::vector<PlaneGroup *> &plane_groups);
+  int TryRgaComposePolicy(std::vector<DrmCompositionPlane> *composition,
+                      std::vector<DrmHwcLayer*> &layers, DrmCrtc *crtc,
+                      std::vector<PlaneGroup *> &plane_groups);
+  bool RgaComposeAllowed(DrmHwcLayer *layer);
+  void DropRgaComposePending();
+  int TryRgaTransformOffload(std::vector<DrmHwcLayer*> &layers,
+                             std::vector<PlaneGroup *> &plane_groups,
+                             DrmCrtc *crtc);
+  bool PlaneSupportLayer(DrmHwcLayer *layer,
+                         std::vector<PlaneGroup *> &plane_groups,
+                         DrmCrtc *crtc,
+                         bool *format_support);
+  bool RgaTransformAllowed(DrmHwcLayer *layer,
+                           std::vector<PlaneGroup *> &plane_groups);
   int TryMixSidebandPolicy(std::vector<DrmCompositionPlane> *composition,
                     std::vector<DrmHwcLayer*> &layers, DrmCrtc *crtc,
                     std::vector<PlaneGroup *> &plane_groups);
@@ -281,6 +352,7 @@ struct SvepXml{
   bool SvepAllowedByWhitelist(DrmHwcLayer *layer);
   bool SvepAllowedByLocalPolicy(DrmHwcLayer *layer);
   bool TrySvepOverlay();
+  bool SvepSlotBusy(const SvepJobSlot &slot);
 #endif
 
   void TryMix();
@@ -302,6 +374,7 @@ struct SvepXml{
   bool HasLayer(std::vector<DrmHwcLayer*>& layer_vector,DrmHwcLayer *layer);
   int  IsXIntersect(hwc_rect_t* rec,hwc_rect_t* rec2);
   bool IsRec1IntersectRec2(hwc_rect_t* rec1, hwc_rect_t* rec2);
+  bool IsLayerCombineAttr(DrmHwcLayer *layer_one,DrmHwcLayer *layer_two);
   bool IsLayerCombine(DrmHwcLayer *layer_one,DrmHwcLayer *layer_two);
   bool HasGetNoAfbcUsablePlanes(DrmCrtc *crtc, std::vector<PlaneGroup *> &plane_groups);
   bool HasGetNoYuvUsablePlanes(DrmCrtc *crtc, std::vector<PlaneGroup *> &plane_groups);
@@ -311,6 +384,7 @@ struct SvepXml{
   bool GetCrtcSupported(const DrmCrtc &crtc, uint32_t possible_crtc_mask);
   bool HasPlanesWithSize(DrmCrtc *crtc, int layer_size, std::vector<PlaneGroup *> &plane_groups);
   int  CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*>& layers,uint32_t iPlaneSize);
+  void CombineLayerLegacy(LayerMap& layer_map,std::vector<DrmHwcLayer*>& layers);
   int  GetPlaneGroups(DrmCrtc *crtc, std::vector<PlaneGroup *>&out_plane_groups);
   void ResetLayerFromTmpExceptFB(std::vector<DrmHwcLayer*>& layers, std::vector<DrmHwcLayer*>& tmp_layers);
   void ResetLayerFromTmp(std::vector<DrmHwcLayer*>& layers, std::vector<DrmHwcLayer*>& tmp_layers);
@@ -327,14 +401,31 @@ struct SvepXml{
  private:
   Vop2Ctx ctx;
   std::shared_ptr<DrmBufferQueue> rgaBufferQueue_;
+  // RGA 多图层预合成输出, 与屏幕同尺寸
+  std::shared_ptr<DrmBufferQueue> rgaComposeBufferQueue_;
+  // 上一次 RGA 合成的图层信息, 未变化时复用输出
+  uint64_t uRgaComposeSignature_;
+  std::shared_ptr<RgaComposePending> pRgaComposePending_;
+  // key: crtc id << 32 | layer id
+  std::map<uint64_t, RgaTransformCache> mapRgaTransform_;
 #ifdef USE_LIBSVEP
   Svep* svep_;
   bool bSvepReady_;
-  SvepContext svepCtx_;
+  SvepJobSlot mSvepSlots_[SVEP_CTX_NUM];
+  int iSvepSlot_;
   std::shared_ptr<DrmBufferQueue> bufferQueue_;
   SvepXml mSvepEnv_;
   int mLastMode_;
   int mLastModeCnt_;
+  // 上一次提交 SVEP 任务时的参数, 变化后需要重新处理
+  int iLastSvepMode_;
+  uint64_t uLastSvepBufferId_;
+  int iLastEnhancementRate_;
+  int iLastContrastMode_;
+  int iLastContrastOffset_;
+  // 连续无法按时完成的帧数, 以及剩余的退回帧数
+  int iSvepMissCnt_;
+  int iSvepFallbackCnt_;
 #endif
 };
 
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DRM_EVENT_LOG_H_
+#define _DRM_EVENT_LOG_H_
+
+#include <utils/String8.h>
+
+#include <inttypes.h>
+#include <stdint.h>
+
+namespace android {
+
+#define EVENT_LOG_DEFAULT "1"
+#define EVENT_LOG_RING_SIZE  2048
+#define EVENT_LOG_MAX_THREAD 32
+#define EVENT_LOG_MAX_ARGS   6
+// dumpsys 中输出的最近事件条数
+#define EVENT_LOG_DUMP_CNT   256
+
+// 事件表：id 与格式串，热路径只记录 id + 整型参数，格式串在 Dump 时解析。
+// 参数统一按 uint64_t 传给格式串，新增事件只需在此追加一行。
+#define HWC_EVENT_LIST(X) \
+  X(kEvBufferCacheReset,     "layer=%" PRIu64 " reset buffer cache, BufferId=0x%" PRIx64) \
+  X(kEvBufferCacheOverflow,  "layer=%" PRIu64 " cache size=%" PRIu64 " too large, reset, BufferId=0x%" PRIx64) \
+  X(kEvBufferCacheEmplaceFail,"layer=%" PRIu64 " cache emplace fail, BufferId=0x%" PRIx64) \
+  X(kEvBufferCacheInsert,    "layer=%" PRIu64 " cache insert BufferId=0x%" PRIx64 " size=%" PRIu64 " w=%" PRIu64 " h=%" PRIu64 " fourcc=0x%" PRIx64) \
+  X(kEvBufferCacheHit,       "layer=%" PRIu64 " cache hit BufferId=0x%" PRIx64 " size=%" PRIu64) \
+  X(kEvGemHandleNoCache,     "layer=%" PRIu64 " no BufferInfo cache") \
+  X(kEvGemHandleInit,        "layer=%" PRIu64 " init GemHandle=%" PRIu64 " BufferId=0x%" PRIx64) \
+  X(kEvGemHandleHit,         "layer=%" PRIu64 " GemHandle=%" PRIu64 " cache hit BufferId=0x%" PRIx64) \
+  X(kEvCommitPlane,          "frame=%" PRIu64 " display=%" PRIu64 " plane=%" PRIu64 " crtc=%" PRIu64 " fb=%" PRIu64 " zpos=%" PRIu64) \
+  X(kEvCommitPlaneDst,       "plane=%" PRIu64 " display_frame[%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 "]") \
+  X(kEvCommitPlaneSrc,       "plane=%" PRIu64 " source_crop[%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 "]") \
+  X(kEvCommitPlaneAttr,      "plane=%" PRIu64 " rotation=%" PRIu64 " alpha=0x%" PRIx64 " blend=%" PRIu64 " eotf=0x%" PRIx64 " colorspace=0x%" PRIx64) \
+  X(kEvSignalSkip,           "frame=%" PRIu64 " have been signal") \
+  X(kEvSignalInvalid,        "frame=%" PRIu64 " layer=%" PRIu64 " BufferId=0x%" PRIx64 " invalid release fence") \
+  X(kEvSignal,               "frame=%" PRIu64 " layer=%" PRIu64 " BufferId=0x%" PRIx64 " signal ret=%" PRId64) \
+  X(kEvDequeueBuffer,        "dequeue Id=%" PRIu64 " w=%" PRIu64 " h=%" PRIu64 " format=%" PRIu64 " queue.size=%" PRIu64) \
+  X(kEvDequeueRealloc,       "dequeue realloc Id=%" PRIu64 " w=%" PRIu64 " h=%" PRIu64 " format=%" PRIu64) \
+  X(kEvDequeueAlloc,         "dequeue alloc Id=%" PRIu64 " w=%" PRIu64 " h=%" PRIu64 " format=%" PRIu64 " queue.size=%" PRIu64) \
+  X(kEvQueueBuffer,          "queue Id=%" PRIu64 " queue.size=%" PRIu64)
+
+#define HWC_EVENT_ENUM(id, fmt) id,
+enum HwcEventId : uint32_t {
+  HWC_EVENT_LIST(HWC_EVENT_ENUM)
+  kEvCnt,
+};
+#undef HWC_EVENT_ENUM
+
+struct HwcEventRecord{
+  int64_t  ts;
+  uint32_t id;
+  uint32_t reserved;
+  uint64_t args[EVENT_LOG_MAX_ARGS];
+};
+
+class DrmEventLog{
+public:
+  static bool Enabled(){ return bEnable_; }
+  // 写入当前线程的环形缓冲区，无锁，单线程写
+  static void Log(HwcEventId id, uint64_t a0 = 0, uint64_t a1 = 0, uint64_t a2 = 0,
+                  uint64_t a3 = 0, uint64_t a4 = 0, uint64_t a5 = 0);
+  static void Init();
+  static void Dump(String8 &output);
+
+private:
+  static bool bEnable_;
+};
+
+#define HWC2_EVENT(id, ...)                     \
+  do {                                          \
+    if (DrmEventLog::Enabled())                 \
+      DrmEventLog::Log(id, ##__VA_ARGS__);      \
+  } while (false)
+
+} // namespace android
+
+#endif // _DRM_EVENT_LOG_H_
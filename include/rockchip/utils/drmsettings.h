@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DRM_SETTINGS_H_
+#define _DRM_SETTINGS_H_
+
+#include "utils/worker.h"
+
+#include <utils/String8.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct prop_info;
+
+namespace android {
+
+#define SETTINGS_NOTIFIER_DEFAULT "1"
+// 无属性变化时的最长等待时间, 用于响应 Exit
+#define SETTINGS_WAIT_TIMEOUT_MS 2000
+
+// 显示设置快照, 发布后只读
+struct DrmSettingsSnapshot{
+  uint64_t uGeneration_ = 0;
+  // name -> value, 只包含关注的显示设置属性
+  std::map<std::string, std::string> mapProps_;
+};
+
+// 显示设置变化通知:
+//   Init 时确定关注的属性 (vendor.display.timeline / vendor.hwc.log /
+//   persist.vendor.{resolution,color,overscan,framebuffer,brightness,contrast,
+//   saturation,hue}.{main,aux,<connector>}), 各自缓存 prop_info 与 serial.
+//   后台线程通过 __system_property_wait 等待属性区 serial 变化后只比较这些属性的 serial,
+//   有变化时发布新的快照并递增 generation.
+//   Baseparameter 分区更新后由设置服务递增 vendor.display.timeline, 同样会被捕获.
+//   ValidateDisplay 每帧只比较 generation, 变化时才重新读取设置.
+class DrmSettings : public Worker{
+public:
+  static DrmSettings* getInstance(){
+    static DrmSettings drmSettings_;
+    return &drmSettings_;
+  }
+
+  // connector_names 为各 connector 的 unique name
+  int Init(const std::vector<std::string> &connector_names);
+  // 未启用时调用方需每帧读取设置
+  bool Enable() const { return bEnable_; }
+  uint64_t Generation() const {
+    return uGeneration_.load(std::memory_order_acquire);
+  }
+  std::shared_ptr<const DrmSettingsSnapshot> GetSnapshot() const;
+  void Dump(String8 &output);
+
+protected:
+  void Routine() override;
+
+private:
+  DrmSettings();
+  ~DrmSettings() override;
+  DrmSettings(const DrmSettings&);
+  DrmSettings& operator=(const DrmSettings&);
+
+  struct WatchProp{
+    std::string sName_;
+    const prop_info *pInfo_ = NULL;
+    uint32_t uSerial_ = 0;
+    bool bValid_ = false;
+    std::string sValue_;
+  };
+
+  void Watch(const std::string &name);
+  // 检查关注属性的 serial, 有变化时发布新快照
+  void Refresh();
+
+  bool bEnable_;
+  // 只在 Init 和后台线程中访问
+  std::vector<WatchProp> vWatchProps_;
+  uint32_t uAreaSerial_;
+  std::atomic<uint64_t> uGeneration_;
+  std::shared_ptr<const DrmSettingsSnapshot> pSnapshot_;
+  mutable std::mutex mtx_;
+};
+
+} // namespace android
+
+#endif // _DRM_SETTINGS_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DRM_TELEMETRY_H_
+#define _DRM_TELEMETRY_H_
+
+#include <utils/String8.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+#define TELEMETRY_DEFAULT "1"
+// 共享内存文件路径，为空则只在进程内记录
+#define TELEMETRY_FILE_DEFAULT ""
+
+#define TELEMETRY_MAGIC        0x54435748 /* "HWCT" */
+#define TELEMETRY_VERSION      2
+// 环形缓冲区个数, 拼接屏的 display id 单独占用一个
+#define TELEMETRY_MAX_DISPLAY  8
+#define TELEMETRY_FREE_SLOT    (-1)
+#define TELEMETRY_RING_SIZE    128
+
+// 每帧各阶段时间戳，CLOCK_MONOTONIC ns，0 表示未经过该阶段
+enum TelemetryStage{
+  kTmValidateStart = 0,
+  kTmValidateEnd,
+  kTmPlanEnd,
+  kTmImportEnd,
+  kTmQueue,
+  kTmFenceWaitEnd,
+  kTmCommitStart,
+  kTmCommitEnd,
+  kTmFlipDone,
+  kTmRelease,
+  kTmStageCnt,
+};
+
+enum TelemetryPolicy{
+  kTmPolicyNone = 0,
+  kTmPolicyOverlay,
+  kTmPolicyMix,
+  kTmPolicyGles,
+  kTmPolicyRga,
+  kTmPolicySvep,
+  kTmPolicyDrop,
+  kTmPolicyCnt,
+};
+
+// 共享内存布局：TelemetryHeader 之后是 TELEMETRY_MAX_DISPLAY 个环形缓冲区，
+// 每个 TELEMETRY_RING_SIZE 条 TelemetryRecord，第 N 帧位于 N % TELEMETRY_RING_SIZE。
+// 第 i 个缓冲区属于 display_id[i]，按首次出现的完整 display id 分配，-1 表示未使用。
+// 读者需在拷贝记录前后各读一次 frame_no，两次相同且不为 UINT64_MAX 时记录有效。
+struct TelemetryHeader{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t max_display;
+  uint32_t ring_size;
+  uint32_t record_size;
+  uint32_t stage_cnt;
+  int32_t  display_id[TELEMETRY_MAX_DISPLAY];
+};
+
+struct TelemetryRecord{
+  uint64_t frame_no;
+  int64_t  ts[kTmStageCnt];
+  uint32_t policy;
+  uint16_t overlay_cnt;
+  uint16_t gles_cnt;
+  uint16_t rga_cnt;
+  uint16_t svep_cnt;
+  uint32_t bandwidth_mb;
+};
+
+struct TelemetryFrameInfo{
+  TelemetryPolicy policy;
+  uint16_t overlay_cnt;
+  uint16_t gles_cnt;
+  uint16_t rga_cnt;
+  uint16_t svep_cnt;
+  uint32_t bandwidth_mb;
+};
+
+// 每个 display 一个无锁环形缓冲区，各阶段由不同线程按 frame_no 写入，
+// 写者之间不会写同一字段，frame_no 不匹配（已被新帧覆盖）的写入直接丢弃。
+class DrmTelemetry{
+public:
+  static DrmTelemetry* getInstance(){
+    static DrmTelemetry drmTelemetry_;
+    return &drmTelemetry_;
+  }
+
+  // 新的一帧开始，清空对应槽位并记录 kTmValidateStart
+  void Begin(int display, uint64_t frame_no);
+  void Mark(int display, uint64_t frame_no, TelemetryStage stage);
+  void SetFrameInfo(int display, uint64_t frame_no, const TelemetryFrameInfo &info);
+  void Dump(String8 &output);
+
+private:
+  DrmTelemetry();
+  ~DrmTelemetry();
+  DrmTelemetry(const DrmTelemetry&);
+  DrmTelemetry& operator=(const DrmTelemetry&);
+
+  int GetSlot(int display);
+  TelemetryRecord *GetRecord(int display, uint64_t frame_no);
+  bool ReadRecord(int slot, int index, TelemetryRecord *out);
+  void DumpDisplay(String8 &output, int slot);
+
+  bool bEnable_;
+  bool bShared_;
+  void *pMem_;
+  size_t iMemSize_;
+  TelemetryHeader *pHeader_;
+  TelemetryRecord *pRing_;
+};
+
+} // namespace android
+
+#endif // _DRM_TELEMETRY_H_
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DRM_TRACE_H_
+#define _DRM_TRACE_H_
+
+#include <cutils/trace.h>
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace android {
+
+// 帧级 trace，基于 atrace async slice / counter，Perfetto 的 atrace 数据源 (gfx) 可直接显示:
+//   "HWC-D<n> Frame"      : async slice，cookie 为 (display, frame_no)，ValidateDisplay 开始, SignalCompositionDone 结束
+//   "D<n>-F<frame> <stage>": 各阶段同步 slice，跨线程按名字检索同一帧
+//   "HWC-D<n> <counter>"  : counter 轨道
+#define HWC_TRACE_TAG ATRACE_TAG_GRAPHICS
+
+static inline bool HwcTraceEnabled(){
+  return atrace_is_tag_enabled(HWC_TRACE_TAG);
+}
+
+static inline int32_t HwcTraceCookie(int display, uint64_t frame_no){
+  return static_cast<int32_t>(((static_cast<uint32_t>(display) & 0xff) << 24) |
+                              (frame_no & 0xffffff));
+}
+
+static inline void HwcTraceFrameBegin(int display, uint64_t frame_no){
+  if(!HwcTraceEnabled())
+    return;
+  char name[32];
+  snprintf(name, sizeof(name), "HWC-D%d Frame", display);
+  atrace_async_begin(HWC_TRACE_TAG, name, HwcTraceCookie(display, frame_no));
+}
+
+static inline void HwcTraceFrameEnd(int display, uint64_t frame_no){
+  if(!HwcTraceEnabled())
+    return;
+  char name[32];
+  snprintf(name, sizeof(name), "HWC-D%d Frame", display);
+  atrace_async_end(HWC_TRACE_TAG, name, HwcTraceCookie(display, frame_no));
+}
+
+static inline void HwcTraceCounter(int display, const char *counter, int64_t value){
+  if(!HwcTraceEnabled())
+    return;
+  char name[48];
+  snprintf(name, sizeof(name), "HWC-D%d %s", display, counter);
+  atrace_int64(HWC_TRACE_TAG, name, value);
+}
+
+// 作用域内的阶段 slice，trace 未开启时不做格式化
+class HwcFrameTrace{
+public:
+  HwcFrameTrace(const char *stage, int display, uint64_t frame_no) : bTraced_(false){
+    if(!HwcTraceEnabled())
+      return;
+    char name[64];
+    snprintf(name, sizeof(name), "D%d-F%" PRIu64 " %s", display, frame_no, stage);
+    atrace_begin(HWC_TRACE_TAG, name);
+    bTraced_ = true;
+  }
+  ~HwcFrameTrace(){
+    if(bTraced_)
+      atrace_end(HWC_TRACE_TAG);
+  }
+
+private:
+  HwcFrameTrace(const HwcFrameTrace&);
+  HwcFrameTrace& operator=(const HwcFrameTrace&);
+  bool bTraced_;
+};
+
+#define HWC_FRAME_TRACE(stage, display, frame_no) \
+  HwcFrameTrace __hwc_frame_trace(stage, display, frame_no)
+
+} // namespace android
+
+#endif // _DRM_TRACE_H_
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SPSC_QUEUE_H_
+#define ANDROID_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <utility>
+
+namespace android {
+
+// Bounded single-producer / single-consumer ring.
+// Push() must only be called from one thread and Pop()/Peek() from another
+// (or from callers serialized by a lock of their own). Capacity must be a
+// power of two.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity && !(Capacity & (Capacity - 1)),
+                "SpscQueue capacity must be a power of two");
+
+ public:
+  SpscQueue() : head_(0), tail_(0) {
+  }
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  // Producer side.
+  bool Push(T &&item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= Capacity)
+      return false;
+    slots_[head & (Capacity - 1)] = std::move(item);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.
+  bool Pop(T *item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+      return false;
+    *item = std::move(slots_[tail & (Capacity - 1)]);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side, index 0 is the oldest entry. Valid while index < Size().
+  T &Peek(size_t index) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    return slots_[(tail + index) & (Capacity - 1)];
+  }
+
+  size_t Size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+  }
+
+  bool Empty() const {
+    return Size() == 0;
+  }
+
+  size_t capacity() const {
+    return Capacity;
+  }
+
+ private:
+  T slots_[Capacity];
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+};
+}  // namespace android
+#endif
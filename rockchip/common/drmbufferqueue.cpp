@@ -19,6 +19,7 @@
 
 #include <drmbufferqueue.h>
 #include <rockchip/utils/drmdebug.h>
+#include <rockchip/utils/drmeventlog.h>
 
 namespace android{
 
@@ -78,7 +79,6 @@ std::shared_ptr<DrmBuffer> DrmBufferQueue::DequeueDrmBuffer(int w,
                                                             uint64_t usage,
                                                             std::string name,
                                                             int parent_id){
-  HWC2_ALOGD_IF_DEBUG("w=%d, h=%d, format=%d usage=0x%" PRIx64 " name=%s",w, h, format, usage, name.c_str());
   if(bufferQueue_.size() == iMaxBufferSize_){
     currentBuffer_ = bufferQueue_.front();
     bufferQueue_.pop();
@@ -89,14 +89,13 @@ std::shared_ptr<DrmBuffer> DrmBufferQueue::DequeueDrmBuffer(int w,
                    w, h, format, name.c_str());
         return NULL;
       }
-      HWC2_ALOGD_IF_DEBUG(" NeedsReallocation sucess! w=%d h=%d format=%d name=%s",w, h, format, name.c_str());
+      HWC2_EVENT(kEvDequeueRealloc, currentBuffer_->GetId(), w, h, format);
       return currentBuffer_;
     }
     currentBuffer_->WaitReleaseFence();
     currentBuffer_->WaitFinishFence();
     currentBuffer_->SetParentId(parent_id);
-    HWC2_ALOGD_IF_DEBUG("Id=%" PRIu64 " fd=%d Buffer=%p, queue.size()=%zu, dequeue success!",
-      currentBuffer_->GetId(),currentBuffer_->GetFd(),currentBuffer_.get(),bufferQueue_.size());
+    HWC2_EVENT(kEvDequeueBuffer, currentBuffer_->GetId(), w, h, format, bufferQueue_.size());
     return currentBuffer_;
   }else{
     currentBuffer_ = std::make_shared<DrmBuffer>(w, h, format, usage, name, parent_id);
@@ -106,18 +105,15 @@ std::shared_ptr<DrmBuffer> DrmBufferQueue::DequeueDrmBuffer(int w,
       return NULL;
     }
   }
-  HWC2_ALOGD_IF_DEBUG("Id=%" PRIu64 " fd=%d Buffer=%p, queue.size()=%zu, dequeue success!",
-      currentBuffer_->GetId(),currentBuffer_->GetFd(),currentBuffer_.get(),bufferQueue_.size());
+  HWC2_EVENT(kEvDequeueAlloc, currentBuffer_->GetId(), w, h, format, bufferQueue_.size());
   return currentBuffer_;
 }
 
 int DrmBufferQueue::QueueBuffer(const std::shared_ptr<DrmBuffer> buffer){
-  HWC2_ALOGD_IF_DEBUG("Id=%" PRIu64 " Buffer=%p , queue.size()=%zu",buffer->GetId(),buffer.get(),bufferQueue_.size());
   if(currentBuffer_ != NULL){
     if(buffer == currentBuffer_){
-      HWC2_ALOGD_IF_DEBUG("Id=%" PRIu64 " fd=%d Buffer=%p , queue.size()=%zu, queue success!",buffer->GetId(),
-        currentBuffer_->GetFd(), buffer.get(),bufferQueue_.size());
       bufferQueue_.push(currentBuffer_);
+      HWC2_EVENT(kEvQueueBuffer, buffer->GetId(), bufferQueue_.size());
       return 0;
     }
   }
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-dmc-hint"
+
+#include "rockchip/drmdmchint.h"
+#include "rockchip/utils/drmdebug.h"
+
+#include <log/log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace android {
+
+#define DMC_SYSTEM_STATUS_PATH "/sys/class/devfreq/dmc/system_status"
+// 打开节点失败后的重试间隔
+#define DMC_REOPEN_NS 1000000000LL
+
+// dmc system_status 场景码 (rockchip_dmc.c system_status_write)，大写进入、小写退出:
+//   L/l SYS_STATUS_LOW_POWER, V/v SYS_STATUS_VIDEO_4K, P/p SYS_STATUS_PERFORMANCE,
+//   Normal 无对应场景
+static const char kSceneEnter[DrmDmcHint::kDmcSceneCnt] = { 'L', 0, 'V', 'P' };
+static const char kSceneExit[DrmDmcHint::kDmcSceneCnt]  = { 'l', 0, 'v', 'p' };
+static const char *kSceneName[DrmDmcHint::kDmcSceneCnt] = { "low", "normal", "4k", "perf" };
+
+static int64_t DmcNowNs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+DrmDmcHint::DrmDmcHint()
+  : bEnable_(hwc_get_bool_property("vendor.hwc.dmc_hint", DMC_HINT_DEFAULT)),
+    iFd_(-1),
+    iOpenFailNs_(0),
+    iHysteresis_(hwc_get_int_property("vendor.hwc.dmc_hysteresis", DMC_HYSTERESIS_DEFAULT)),
+    iIntervalNs_(hwc_get_int_property("vendor.hwc.dmc_hint_interval_ms", DMC_HINT_INTERVAL_MS_DEFAULT) * 1000000LL),
+    iUpIntervalNs_(hwc_get_int_property("vendor.hwc.dmc_up_interval_ms", DMC_UP_INTERVAL_MS_DEFAULT) * 1000000LL),
+    eScene_(kDmcSceneNormal),
+    iSceneNs_(0),
+    iDownSinceNs_(0),
+    iUpSinceNs_(0),
+    uTransitionCnt_(0),
+    uTotalMb_(0){
+  uThresholdMb_[kDmcSceneLow] = hwc_get_int_property("vendor.hwc.dmc_low_mb", DMC_LOW_MB_DEFAULT);
+  uThresholdMb_[kDmcSceneNormal] = hwc_get_int_property("vendor.hwc.dmc_4k_mb", DMC_4K_MB_DEFAULT);
+  uThresholdMb_[kDmcScene4K] = hwc_get_int_property("vendor.hwc.dmc_perf_mb", DMC_PERF_MB_DEFAULT);
+  if(iHysteresis_ < 0 || iHysteresis_ >= 100)
+    iHysteresis_ = atoi(DMC_HYSTERESIS_DEFAULT);
+  if(iUpIntervalNs_ < 0)
+    iUpIntervalNs_ = atoi(DMC_UP_INTERVAL_MS_DEFAULT) * 1000000LL;
+}
+
+DrmDmcHint::~DrmDmcHint(){
+  if(iFd_ >= 0)
+    close(iFd_);
+}
+
+int DrmDmcHint::WriteStatus(char status){
+  if(iFd_ < 0){
+    int64_t now = DmcNowNs();
+    if(iOpenFailNs_ != 0 && now - iOpenFailNs_ < DMC_REOPEN_NS)
+      return -ENODEV;
+    iFd_ = open(DMC_SYSTEM_STATUS_PATH, O_WRONLY | O_CLOEXEC);
+    if(iFd_ < 0){
+      int ret = -errno;
+      iOpenFailNs_ = now;
+      HWC2_ALOGD_IF_DEBUG("failed to open %s ret =%d", DMC_SYSTEM_STATUS_PATH, ret);
+      return ret;
+    }
+  }
+
+  if(write(iFd_, &status, sizeof(char)) != sizeof(char)){
+    int ret = -errno;
+    HWC2_ALOGD_IF_DEBUG("write %c to %s fail ret =%d", status, DMC_SYSTEM_STATUS_PATH, ret);
+    // 节点异常时关闭，下次重新打开
+    if(ret != -EINVAL){
+      close(iFd_);
+      iFd_ = -1;
+    }
+    return ret;
+  }
+  return 0;
+}
+
+DrmDmcHint::DmcScene DrmDmcHint::TargetScene(uint64_t total_mb){
+  int scene = eScene_;
+  // 升档：超过当前档位的上限阈值
+  while(scene < kDmcScenePerf && total_mb > uThresholdMb_[scene])
+    scene++;
+  // 降档：需低于下限阈值 iHysteresis_%
+  if(scene == eScene_){
+    while(scene > kDmcSceneLow &&
+          total_mb * 100 < uThresholdMb_[scene - 1] * (100 - iHysteresis_))
+      scene--;
+  }
+  return static_cast<DmcScene>(scene);
+}
+
+void DrmDmcHint::ApplyScene(DmcScene scene, uint64_t total_mb, int64_t now){
+  if(kSceneExit[eScene_])
+    WriteStatus(kSceneExit[eScene_]);
+  if(kSceneEnter[scene])
+    WriteStatus(kSceneEnter[scene]);
+
+  HWC2_ALOGI("dmc scene %s -> %s, bandwidth=%" PRIu64 "MB/s, hold=%" PRIi64 "ms",
+             kSceneName[eScene_], kSceneName[scene], total_mb,
+             iSceneNs_ ? (now - iSceneNs_) / 1000000 : 0);
+  eScene_ = scene;
+  iSceneNs_ = now;
+  uTransitionCnt_++;
+}
+
+void DrmDmcHint::UpdateDisplay(int display, uint64_t bandwidth){
+  if(!bEnable_)
+    return;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  mapDisplayBw_[display] = bandwidth;
+
+  uint64_t total = 0;
+  for(auto &map_bw : mapDisplayBw_)
+    total += map_bw.second;
+  uTotalMb_ = total / 1000000;
+
+  int64_t now = DmcNowNs();
+  DmcScene scene = TargetScene(uTotalMb_);
+  if(scene > eScene_){
+    // 升档同样需持续一段时间, 过滤单帧带宽尖峰
+    iDownSinceNs_ = 0;
+    if(iUpSinceNs_ == 0)
+      iUpSinceNs_ = now;
+    if(now - iUpSinceNs_ >= iUpIntervalNs_){
+      iUpSinceNs_ = 0;
+      ApplyScene(scene, uTotalMb_, now);
+    }
+  }else if(scene < eScene_){
+    iUpSinceNs_ = 0;
+    if(iDownSinceNs_ == 0)
+      iDownSinceNs_ = now;
+    if(now - iDownSinceNs_ >= iIntervalNs_){
+      iDownSinceNs_ = 0;
+      ApplyScene(scene, uTotalMb_, now);
+    }
+  }else{
+    iDownSinceNs_ = 0;
+    iUpSinceNs_ = 0;
+  }
+}
+
+void DrmDmcHint::RemoveDisplay(int display){
+  std::lock_guard<std::mutex> lock(mtx_);
+  mapDisplayBw_.erase(display);
+}
+
+void DrmDmcHint::SetSvepState(bool enable){
+  std::lock_guard<std::mutex> lock(mtx_);
+  // S 状态是专门提供给SVEP的场景变频, 进入/退出SVEP场景变频
+  WriteStatus(enable ? 'S' : 's');
+}
+
+void DrmDmcHint::Dump(String8 &output){
+  std::lock_guard<std::mutex> lock(mtx_);
+  output.appendFormat("DmcHint: enable=%d scene=%s bandwidth=%" PRIu64 "MB/s threshold=%" PRIu64 "/%" PRIu64 "/%" PRIu64 "MB/s transitions=%u\n",
+                      bEnable_, kSceneName[eScene_], uTotalMb_,
+                      uThresholdMb_[kDmcSceneLow], uThresholdMb_[kDmcSceneNormal],
+                      uThresholdMb_[kDmcScene4K], uTransitionCnt_);
+}
+
+} // namespace android
@@ -18,6 +18,7 @@
 #define LOG_TAG "hwc-drm-utils"
 
 #include "drmlayer.h"
+#include "drmplane.h"
 #include "platform.h"
 
 #include <drm_fourcc.h>
@@ -170,6 +171,10 @@ int DrmHwcLayer::Init() {
     uColorSpace = V4L2_COLORSPACE_BT2020;
   }
   uEOTF = GetEOTF(eDataSpace_);
+
+  // Plane 能力预筛需求位
+  uPlaneFormatBit_ = DrmPlaneFormatBit(uFourccFormat_);
+  uPlaneCapsReq_ = bScale_ ? DRM_PLANE_CAP_SCALE : 0;
   return 0;
 }
 
@@ -478,8 +483,9 @@ bool DrmHwcLayer::IsGlesCompose(){
   switch(sf_composition){
     case HWC2::Composition::Client:
     //case HWC2::Composition::Sideband:
-    case HWC2::Composition::SolidColor:
       return true;
+    case HWC2::Composition::SolidColor:
+      return !bSolidColor_;
     default:
       break;
   }
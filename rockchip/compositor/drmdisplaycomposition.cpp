@@ -24,6 +24,8 @@
 #include "platform.h"
 #include "utils/drmfence.h"
 #include "utils/autolock.h"
+#include "rockchip/utils/drmeventlog.h"
+#include "rockchip/utils/drmtrace.h"
 
 #include <stdlib.h>
 
@@ -130,6 +132,14 @@ int DrmDisplayComposition::AddPlaneComposition(DrmCompositionPlane &&plane) {
   return 0;
 }
 
+bool DrmDisplayComposition::IsPlaneInComposition(DrmPlane *plane) {
+  for (DrmCompositionPlane &comp_plane : composition_planes_) {
+    if (comp_plane.plane() == plane)
+      return true;
+  }
+  return false;
+}
+
 int DrmDisplayComposition::DisableUnusedPlanes() {
   if (type_ != DRM_COMPOSITION_TYPE_FRAME)
     return 0;
@@ -156,10 +166,17 @@ int DrmDisplayComposition::DisableUnusedPlanes() {
     if(isRK3566(soc_id))
       disable_plane = true;
 
+    // 迁移到其他 CRTC 的 PlaneGroup, 先在当前 CRTC 上关闭
+    bool release_plane = (*iter)->is_releasing(crtc_mask, display_id_);
+    if(release_plane)
+      disable_plane = true;
+
     if(disable_plane){
       for(std::vector<DrmPlane*> ::const_iterator iter_plane=(*iter)->planes.begin();
         !(*iter)->planes.empty() && iter_plane != (*iter)->planes.end(); ++iter_plane) {
-        if (!(*iter_plane)->is_use()) {
+        // 迁移中的 plane is_use 状态不再更新, 以本帧是否已使用为准
+        bool unused = release_plane ? !IsPlaneInComposition(*iter_plane) : !(*iter_plane)->is_use();
+        if (unused) {
             ALOGD_IF(LogLevel(DBG_DEBUG),"DisableUnusedPlanes plane_groups plane id=%d (%s)",
                       (*iter_plane)->id(),(*iter_plane)->name());
             AddPlaneDisable(*iter_plane);
@@ -246,6 +263,11 @@ sp<ReleaseFence> DrmDisplayComposition::GetReleaseFence(hwc2_layer_t layer_id) {
     if(layer->uId_ == layer_id){
       return layer->release_fence;
     }
+    // RGA 合成的图层在承载图层下屏后才能释放
+    for(uint32_t id : layer->vRgaComposeIds_){
+      if(id == layer_id)
+        return layer->release_fence;
+    }
   }
   return ReleaseFence::NO_FENCE;
 }
@@ -257,10 +279,16 @@ int DrmDisplayComposition::SignalCompositionDone() {
     return -1;
 
   if(signal_){
-    HWC2_ALOGD_IF_DEBUG("Have been signal frame = %" PRIu64", not to signal.", frame_no_);
+    HWC2_EVENT(kEvSignalSkip, frame_no_);
     return 0;
   }
 
+  HWC_FRAME_TRACE("Signal", display_id_, frame_no_);
+  if(trace_frame_){
+    HwcTraceFrameEnd(display_id_, frame_no_);
+    trace_frame_ = false;
+  }
+
   std::unordered_set<DrmHwcLayer *> comp_layers;
   for (const DrmCompositionPlane &plane : composition_planes_) {
     if (plane.type() == DrmCompositionPlane::Type::kLayer) {
@@ -277,34 +305,43 @@ int DrmDisplayComposition::SignalCompositionDone() {
   for (DrmHwcLayer *layer : comp_layers) {
     if (!layer || !layer->release_fence->isValid()){
       if(layer)
-        HWC2_ALOGD_IF_DEBUG("Fd(%d)isValid %d frame = %" PRIu64 " %s Info: size=%d act=%d signal=%d err=%d LayerName=%s ",
-                          layer->release_fence->getFd(), layer->release_fence->isValid(),
-                          frame_no_,layer->release_fence->getName().c_str(),layer->release_fence->getSize(),layer->release_fence->getActiveCount(),
-                          layer->release_fence->getSignaledCount(),layer->release_fence->getErrorCount(),
-                          layer->sLayerName_.c_str());
+        HWC2_EVENT(kEvSignalInvalid, frame_no_, layer->uId_, layer->uBufferId_);
       continue;
     }
-    int act,sig;
-    if(LogLevel(DBG_DEBUG)){
-      act = layer->release_fence->getActiveCount();
-      sig = layer->release_fence->getSignaledCount();
-    }
-
     int ret = layer->release_fence->signal();
-    if(LogLevel(DBG_DEBUG)){
-      HWC2_ALOGD_IF_DEBUG("Signal %s frame = %" PRIu64 " %s Info: size=%d act=%d signal=%d err=%d LayerName=%s BufferId=0x%" PRIx64 " SignalTime=%s" ,
-                          act == 1 && sig == 0 && layer->release_fence->getActiveCount() == 0 && layer->release_fence->getSignaledCount() == 1 ? "Sucess" : "Fail",
-                          frame_no_,layer->release_fence->getName().c_str(),layer->release_fence->getSize(),layer->release_fence->getActiveCount(),
-                          layer->release_fence->getSignaledCount(),layer->release_fence->getErrorCount(),
-                          layer->sLayerName_.c_str(),
-                          layer->uBufferId_,
-                          layer->release_fence->dump().c_str());
-    }
+    HWC2_EVENT(kEvSignal, frame_no_, layer->uId_, layer->uBufferId_, ret);
   }
   signal_ = true;
   return 0;
 }
 
+// Kernel out fence mode: the intermediate RGA/SVEP buffers of this
+// composition can be reused once fd signals.
+int DrmDisplayComposition::SetReleaseFence(int fd) {
+  ATRACE_CALL();
+  if (fd < 0)
+    return -EINVAL;
+
+  AutoLock lock(&lock_, __func__);
+  if (lock.Lock())
+    return -1;
+
+  for (const DrmCompositionPlane &plane : composition_planes_) {
+    if (plane.type() != DrmCompositionPlane::Type::kLayer)
+      continue;
+    for (auto i : plane.source_layers()) {
+      DrmHwcLayer &layer = layers_[i];
+#ifdef USE_LIBSVEP
+      if(layer.bUseSvep_ && layer.pSvepBuffer_)
+        layer.pSvepBuffer_->SetReleaseFence(dup(fd));
+#endif
+      if(layer.bUseRga_ && layer.pRgaBuffer_)
+        layer.pRgaBuffer_->SetReleaseFence(dup(fd));
+    }
+  }
+  return 0;
+}
+
 static const char *DrmCompositionTypeToString(DrmCompositionType type) {
   switch (type) {
     case DRM_COMPOSITION_TYPE_EMPTY:
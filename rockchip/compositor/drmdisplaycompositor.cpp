@@ -19,10 +19,12 @@
 
 #include "drmdisplaycompositor.h"
 
+#include <algorithm>
 #include <pthread.h>
 #include <sched.h>
 #include <stdlib.h>
 #include <time.h>
+#include <set>
 #include <sstream>
 #include <vector>
 
@@ -30,6 +32,7 @@
 #include <log/log.h>
 #include <sync/sync.h>
 #include <utils/Trace.h>
+#include <xf86drm.h>
 
 // System property
 #include <cutils/properties.h>
@@ -37,13 +40,20 @@
 #include "utils/autolock.h"
 #include "drmcrtc.h"
 #include "drmdevice.h"
+#include "drmeventlistener.h"
 #include "drmplane.h"
 #include "rockchip/drmtype.h"
 #include "rockchip/utils/drmdebug.h"
+#include "rockchip/utils/drmeventlog.h"
+#include "rockchip/platform/drmplanebalancer.h"
+#include "rockchip/utils/drmtelemetry.h"
+#include "rockchip/utils/drmtrace.h"
 
 #define DRM_DISPLAY_COMPOSITOR_MAX_QUEUE_DEPTH 1
 
 static const uint32_t kWaitWritebackFence = 100;  // ms
+static const int64_t kWaitFlipDoneNs = 100 * 1000 * 1000;
+static const int64_t kWaitOutFenceNs = 1000 * 1000 * 1000;
 
 #define hwcMIN(x, y)			(((x) <= (y)) ?  (x) :  (y))
 #define hwcMAX(x, y)			(((x) >= (y)) ?  (x) :  (y))
@@ -70,6 +80,25 @@ class CompositorVsyncCallback : public VsyncCallback {
   DrmDisplayCompositor *compositor_;
 };
 
+// Owned by the kernel event: deleted by DrmEventListener::FlipHandler.
+// 只用于单 CRTC 提交, 见 IsSingleCrtcCommit.
+class CompositorFlipHandler : public DrmEventHandler {
+ public:
+  CompositorFlipHandler(DrmDisplayCompositor *compositor, uint64_t sequence)
+      : compositor_(compositor), sequence_(sequence) {
+  }
+
+  void HandleEvent(uint64_t timestamp_us) {
+    compositor_->FlipDone(sequence_, timestamp_us * 1000);
+  }
+  void HandleResolutionSwitchEvent(int /* display_id */) {
+  }
+
+ private:
+  DrmDisplayCompositor *compositor_;
+  uint64_t sequence_;
+};
+
 DrmDisplayCompositor::DrmDisplayCompositor()
     : resource_manager_(NULL),
       display_(-1),
@@ -80,7 +109,35 @@ DrmDisplayCompositor::DrmDisplayCompositor()
       dump_frames_composited_(0),
       dump_last_timestamp_ns_(0),
       flatten_countdown_(FLATTEN_COUNTDOWN_INIT),
-      writeback_fence_(-1) {
+      writeback_fence_(-1),
+      last_timestamp_(-1),
+      bLateLatch_(false),
+      iLatchMarginNs_(0),
+      iCommitCostNs_(0),
+      iCollectStartNs_(0),
+      iCommitDeadlineNs_(0),
+      iCommitPeriodNs_(0),
+      iLateLatchDropCnt_(0),
+      iLateLatchMissCnt_(0),
+      bNonBlockCommit_(false),
+      bFlipPending_(false),
+      iFlipSequence_(0),
+      bKernelOutFence_(false),
+      bPlanTest_(false),
+      iPlanCacheSize_(0),
+      iPlanCacheHitCnt_(0),
+      iPlanCacheMissCnt_(0),
+      iPlanRejectCnt_(0),
+      bFlattenEnable_(false),
+      bFlattened_(false),
+      bFlattenTried_(false),
+      iFlattenIdleVsync_(FLATTEN_COUNTDOWN_INIT),
+      iFlattenCnt_(0),
+      iFlattenStartNs_(0),
+      iFlattenSavingPerFrame_(0),
+      iFlattenSavedBytes_(0),
+      bCursorFastPath_(false),
+      iCursorCommitCnt_(0) {
   struct timespec ts;
   if (clock_gettime(CLOCK_MONOTONIC, &ts))
     return;
@@ -100,14 +157,15 @@ DrmDisplayCompositor::~DrmDisplayCompositor() {
 
   DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
   if (mode_.blob_id)
-    drm->DestroyPropertyBlob(mode_.blob_id);
+    drm->ReleasePropertyBlob(mode_.blob_id);
   if (mode_.old_blob_id)
-    drm->DestroyPropertyBlob(mode_.old_blob_id);
+    drm->ReleasePropertyBlob(mode_.old_blob_id);
 
 
-  while (!composite_queue_.empty()) {
-    composite_queue_.front().reset();
-    composite_queue_.pop();
+  for (CompositionQueue &queue : composite_queue_) {
+    std::unique_ptr<DrmDisplayComposition> composition;
+    while (queue.Pop(&composition))
+      composition.reset();
   }
 
   active_composition_.reset();
@@ -118,6 +176,13 @@ DrmDisplayCompositor::~DrmDisplayCompositor() {
 
   pthread_mutex_destroy(&lock_);
   pthread_cond_destroy(&composite_queue_cond_);
+  pthread_cond_destroy(&flip_done_cond_);
+  pthread_cond_destroy(&out_fence_cond_);
+
+  for(auto &out_fence : mapDisplayOutFence_){
+    if(out_fence.second.fd >= 0)
+      close(out_fence.second.fd);
+  }
 }
 
 int DrmDisplayCompositor::Init(ResourceManager *resource_manager, int display) {
@@ -148,10 +213,59 @@ int DrmDisplayCompositor::Init(ResourceManager *resource_manager, int display) {
 
   pthread_cond_init(&composite_queue_cond_, NULL);
 
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&flip_done_cond_, &cond_attr);
+  pthread_cond_init(&out_fence_cond_, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
 //  vsync_worker_.Init(drm, display_);
 //  auto callback = std::make_shared<CompositorVsyncCallback>(this);
 //  vsync_worker_.RegisterCallback(callback);
 
+  bLateLatch_ = hwc_get_int_property("vendor.hwc.late_latch", LATE_LATCH_DEFAULT) > 0;
+  iLatchMarginNs_ = hwc_get_int_property("vendor.hwc.late_latch_margin_us",
+                                         LATE_LATCH_MARGIN_US_DEFAULT) * 1000LL;
+  HWC2_ALOGI("display=%d late-latch %s margin=%" PRIi64 "us", display,
+             bLateLatch_ ? "enable" : "disable", iLatchMarginNs_ / 1000);
+
+  bNonBlockCommit_ = hwc_get_int_property("vendor.hwc.nonblock_commit", "1") > 0;
+
+  // 使用 crtc OUT_FENCE_PTR 作为 Release/Retire Fence, 替代 sw_sync 模拟.
+  // 送显线程需等待提交完成才能拿到 fence, 因此默认关闭, 且不能与 late-latch 同时使用.
+  bKernelOutFence_ = hwc_get_int_property("vendor.hwc.kernel_out_fence", "0") > 0;
+  if(bKernelOutFence_){
+    DrmCrtc *crtc = drm->GetCrtcForDisplay(display);
+    if(!crtc || !crtc->out_fence_ptr_property().id()){
+      HWC2_ALOGI("display=%d crtc not support OUT_FENCE_PTR, use sw_sync fence.", display);
+      bKernelOutFence_ = false;
+    }else{
+      bLateLatch_ = false;
+    }
+  }
+  HWC2_ALOGI("display=%d release fence from %s", display,
+             bKernelOutFence_ ? "crtc OUT_FENCE_PTR" : "sw_sync timeline");
+
+  // 新的图层分配方案先用 TEST_ONLY 提交校验一次, 结果缓存, 重复的方案不再校验.
+  bPlanTest_ = hwc_get_int_property("vendor.hwc.plan_test_only", "0") > 0;
+  iPlanCacheSize_ = hwc_get_int_property("vendor.hwc.plan_test_cache_size",
+                                         PLAN_TEST_CACHE_SIZE_DEFAULT);
+  if(iPlanCacheSize_ == 0)
+    bPlanTest_ = false;
+
+  // 静态场景超过 N 个 vsync 无更新时, 通过 WriteBack 合成为单图层显示.
+  bFlattenEnable_ = hwc_get_int_property("vendor.hwc.flatten", "0") > 0;
+  iFlattenIdleVsync_ = hwc_get_int_property("vendor.hwc.flatten_idle_vsync", "60");
+  if(iFlattenIdleVsync_ <= 0)
+    iFlattenIdleVsync_ = FLATTEN_COUNTDOWN_INIT;
+  flatten_countdown_ = iFlattenIdleVsync_;
+  bWriteBackEnable_ = false;
+  bWriteBackRequestDisable_ = false;
+
+  // 光标移动不再触发完整的 validate/present, 只提交光标 plane 的位置.
+  bCursorFastPath_ = hwc_get_int_property("vendor.hwc.cursor_fast_path", "1") > 0;
+
   initialized_ = true;
   return 0;
 }
@@ -191,39 +305,26 @@ bool DrmDisplayCompositor::DropCurrentFrame(int display, int64_t frame_no) {
     return false;
   }
 
-  int ret = pthread_mutex_lock(&lock_);
-  if (ret) {
-    ALOGE("Failed to acquire compositor lock %d", ret);
-    return ret;
-  }
-
   // 通过 “frame_no - iLastDropFrameNo_ > 1” 避免跳过连续的两帧
-  if(frame_no - iLastDropFrameNo_ > 1 && mapDisplayHaveQeueuCnt_[display] >= 1){
+  if(frame_no - iLastDropFrameNo_ > 1 && GetCompositeQueue(display).Size() >= 1){
     // struct timespec current_time;
     // int ret = clock_gettime(CLOCK_MONOTONIC, &current_time);
     // int64_t current_timestamp = current_time.tv_sec * kOneSecondNs + current_time.tv_nsec;
     // float refresh = 60.0f;  // Default to 60Hz refresh rate
     // int64_t vsync_timestamp = kOneSecondNs / cur_refresh;
     // // 若当前的时间戳距离上一次 Vsync 时间大于 * T-Vsync，则考虑丢弃该帧
-    // if(mapDisplayHaveQeueuCnt_[display] >= 1){
-    ret = pthread_mutex_unlock(&lock_);
-    if (ret) {
-      ALOGE("Failed to release compositor lock %d", ret);
-      return ret;
-    }
+    // if(GetCompositeQueue(display).Size() >= 1){
     iLastDropFrameNo_ = frame_no;
     return true;
   }
 
-  ret = pthread_mutex_unlock(&lock_);
-  if (ret) {
-    ALOGE("Failed to release compositor lock %d", ret);
-    return ret;
-  }
-
   return false;
 }
 
+DrmDisplayCompositor::CompositionQueue &DrmDisplayCompositor::GetCompositeQueue(int display) {
+  return composite_queue_[(display & DRM_CONNECTOR_SPILT_MODE_MASK) ? 1 : 0];
+}
+
 int DrmDisplayCompositor::QueueComposition(
     std::unique_ptr<DrmDisplayComposition> composition) {
 
@@ -253,36 +354,48 @@ int DrmDisplayCompositor::QueueComposition(
   if(!initialized_)
     return -EPERM;
 
-  int ret = pthread_mutex_lock(&lock_);
-  if (ret) {
-    ALOGE("Failed to acquire compositor lock %d", ret);
-    return ret;
-  }
-
   display_ = composition->display();
+  HWC_FRAME_TRACE("Queue", composition->display(), composition->frame_no());
+  // 新帧已包含最新的光标位置, 丢弃之前未提交的光标更新
+  if(bCursorFastPath_){
+    std::lock_guard<std::mutex> cursor_lock(mCursorMutex_);
+    auto cursor = mapDisplayCursor_.find(composition->display());
+    if(cursor != mapDisplayCursor_.end())
+      cursor->second.pending = false;
+  }
+  DrmTelemetry::getInstance()->Mark(composition->display(), composition->frame_no(), kTmQueue);
+  CompositionQueue &queue = GetCompositeQueue(composition->display());
   // Block the queue if it gets too large. Otherwise, SurfaceFlinger will start
   // to eat our buffer handles when we get about 1 second behind.
-  int max_queue_size = 1;
+  // Late-latch 需要多缓存一帧，才能在 vblank 前选择最新帧
+  size_t max_queue_size = bLateLatch_ ? 2 : 1;
   if(composition->has_svep()){
       max_queue_size = 3;
   }
 
-  while(mapDisplayHaveQeueuCnt_[composition->display()] >= max_queue_size){
-    pthread_cond_wait(&composite_queue_cond_,&lock_);
+  // 队列未满时无需加锁, 仅在等待 Composite() 消费时使用 lock_.
+  if(queue.Size() >= max_queue_size){
+    int ret = pthread_mutex_lock(&lock_);
+    if (ret) {
+      ALOGE("Failed to acquire compositor lock %d", ret);
+      return ret;
+    }
+    while(queue.Size() >= max_queue_size){
+      pthread_cond_wait(&composite_queue_cond_,&lock_);
+    }
+    ret = pthread_mutex_unlock(&lock_);
+    if (ret) {
+      ALOGE("Failed to release compositor lock %d", ret);
+      return ret;
+    }
   }
-  // ALOGI("rk-debug display=%d wait end cond=%p composite_queue_.size = %" PRIu64 ,
-  //                                                                       composition->display(),
-  //                                                                       &composite_queue_cond_,
-  //                                                                       mapDisplayHaveQeueuCnt_[composition->display()]);
-  mapDisplayHaveQeueuCnt_[composition->display()]++;
-  composite_queue_.push(std::move(composition));
-  clear_ = false;
 
-  ret = pthread_mutex_unlock(&lock_);
-  if (ret) {
-    ALOGE("Failed to release compositor lock %d", ret);
-    return ret;
+  clear_ = false;
+  if(!queue.Push(std::move(composition))){
+    HWC2_ALOGE("display=%d composite queue is full", display_);
+    return -ENOSPC;
   }
+  HwcTraceCounter(display_, "QueueDepth", queue.Size());
   worker_.Signal();
   return 0;
 }
@@ -554,6 +667,131 @@ int DrmDisplayCompositor::SyntheticWaitVBlank() {
   return 0;
 }
 
+int64_t DrmDisplayCompositor::GetRefreshPeriodNs() {
+  float refresh = 60.0f;  // Default to 60Hz refresh rate
+  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  DrmConnector *conn = drm->GetConnectorForDisplay(display_);
+  if (conn && conn->state() == DRM_MODE_CONNECTED) {
+    if (conn->active_mode().v_refresh() > 0.0f)
+      refresh = conn->active_mode().v_refresh();
+  }
+  return kOneSecondNs / refresh;
+}
+
+/*
+ * Returns the timestamp of the latest vblank of the crtc and its vblank
+ * period. A relative vblank request with sequence 0 does not block, it only
+ * reports the current vblank count and time. The period is measured from the
+ * vblank counter of that crtc, so it follows the mode actually running on it
+ * (VRR, mirror or a mode not yet reported by the connector). Before the first
+ * measurement, or if the query fails, fall back to the display refresh rate
+ * and the last commit time.
+ */
+void DrmDisplayCompositor::GetCrtcVBlank(DrmCrtc *crtc, int64_t *vblank_ns,
+                                         int64_t *period_ns) {
+  *vblank_ns = last_timestamp_;
+  *period_ns = GetRefreshPeriodNs();
+  if (!crtc)
+    return;
+
+  CrtcVBlank &state = mapCrtcVBlank_[crtc->id()];
+  if (state.period_ns > 0)
+    *period_ns = state.period_ns;
+
+  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  uint32_t high_crtc = (crtc->pipe() << DRM_VBLANK_HIGH_CRTC_SHIFT);
+  drmVBlank vblank;
+  memset(&vblank, 0, sizeof(vblank));
+  vblank.request.type = (drmVBlankSeqType)(
+      DRM_VBLANK_RELATIVE | (high_crtc & DRM_VBLANK_HIGH_CRTC_MASK));
+  vblank.request.sequence = 0;
+  if (drmWaitVBlank(drm->fd(), &vblank))
+    return;
+
+  int64_t timestamp = (int64_t)vblank.reply.tval_sec * kOneSecondNs +
+                      (int64_t)vblank.reply.tval_usec * 1000;
+  uint32_t sequence = vblank.reply.sequence;
+  if (state.timestamp_ns > 0 && sequence > state.sequence &&
+      timestamp > state.timestamp_ns) {
+    state.period_ns = (timestamp - state.timestamp_ns) / (sequence - state.sequence);
+    *period_ns = state.period_ns;
+  }
+  if (sequence != state.sequence) {
+    state.sequence = sequence;
+    state.timestamp_ns = timestamp;
+  }
+  *vblank_ns = timestamp;
+}
+
+/*
+ * Sleep until the latest point where a commit can still reach the next
+ * vblank: deadline - (margin + estimated commit cost). If that point has
+ * already passed, the commit would land on the vblank after anyway, so aim
+ * for that one and give the producer more time to queue a fresher frame.
+ */
+int DrmDisplayCompositor::WaitCommitDeadline() {
+  ATRACE_CALL();
+  struct timespec ts;
+  int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+  if (ret)
+    return ret;
+
+  int64_t now = ts.tv_sec * kOneSecondNs + ts.tv_nsec;
+  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  int64_t frame_ns = 0;
+  int64_t last_vblank = 0;
+  GetCrtcVBlank(drm->GetCrtcForDisplay(display_), &last_vblank, &frame_ns);
+  iCommitPeriodNs_ = frame_ns;
+  int64_t lead_ns = hwcMIN(iLatchMarginNs_ + iCommitCostNs_, frame_ns / 2);
+
+  int64_t deadline = now + frame_ns;
+  if (last_vblank > 0 && last_vblank <= now)
+    deadline = last_vblank + frame_ns * ((now - last_vblank) / frame_ns + 1);
+  if (deadline - lead_ns < now)
+    deadline += frame_ns;
+  // A non-blocking commit may still be pending for the previous deadline.
+  while (deadline < iCommitDeadlineNs_ + frame_ns / 2)
+    deadline += frame_ns;
+
+  iCommitDeadlineNs_ = deadline;
+  int64_t wakeup = deadline - lead_ns;
+  ts.tv_sec = wakeup / kOneSecondNs;
+  ts.tv_nsec = wakeup - (ts.tv_sec * kOneSecondNs);
+  do {
+    ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  } while (ret == EINTR);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  iCollectStartNs_ = ts.tv_sec * kOneSecondNs + ts.tv_nsec;
+  return ret;
+}
+
+void DrmDisplayCompositor::UpdateCommitCost(int64_t cost_ns) {
+  if (cost_ns < 0)
+    return;
+  // Rise fast, decay slow: a late frame costs more than a few idle microseconds.
+  if (cost_ns > iCommitCostNs_)
+    iCommitCostNs_ = (iCommitCostNs_ + cost_ns) / 2;
+  else
+    iCommitCostNs_ = iCommitCostNs_ - (iCommitCostNs_ - cost_ns) / 8;
+}
+
+bool DrmDisplayCompositor::IsCompositionReady(DrmDisplayComposition *composition) {
+  std::vector<DrmHwcLayer> &layers = composition->layers();
+  for (DrmCompositionPlane &comp_plane : composition->composition_planes()) {
+    if (comp_plane.type() != DrmCompositionPlane::Type::kLayer)
+      continue;
+    for (auto i : comp_plane.source_layers()) {
+      if (i >= layers.size())
+        continue;
+      DrmHwcLayer &layer = layers[i];
+      if (layer.acquire_fence->isValid() && layer.acquire_fence->wait(0))
+        return false;
+    }
+  }
+  return true;
+}
+
 int DrmDisplayCompositor::CommitSidebandStream(drmModeAtomicReqPtr pset,
                                                DrmPlane* plane,
                                                DrmHwcLayer &layer,
@@ -788,17 +1026,16 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
     }
   }
 
-  // RK3566 mirror commit
-  bool mirror_commit = false;
-  DrmCrtc *mirror_commit_crtc = NULL;
+  // RK3566 mirror commit / CropSpilt 克隆送显, 可能涉及多个 mirror CRTC
+  std::vector<DrmCrtc*> mirror_commit_crtcs;
   for (DrmCompositionPlane &comp_plane : comp_planes) {
-    if(comp_plane.mirror()){
-      mirror_commit = true;
-      mirror_commit_crtc = comp_plane.crtc();
-      break;
+    if(comp_plane.mirror() &&
+       std::find(mirror_commit_crtcs.begin(), mirror_commit_crtcs.end(),
+                 comp_plane.crtc()) == mirror_commit_crtcs.end()){
+      mirror_commit_crtcs.push_back(comp_plane.crtc());
     }
   }
-  if(mirror_commit){
+  for (DrmCrtc *mirror_commit_crtc : mirror_commit_crtcs){
     if (mirror_commit_crtc->can_overscan()) {
       int mirror_display_id = mirror_commit_crtc->display();
       DrmConnector *mirror_connector = drm->GetConnectorForDisplay(mirror_display_id);
@@ -814,6 +1051,17 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
     }
   }
 
+  // 刷新率 / gamma / 3D LUT 等 CRTC 状态随本帧一起提交, 提交结果在 Commit() 中确认
+  if(!test_only){
+    mirror_commit_crtcs.insert(mirror_commit_crtcs.begin(), crtc);
+    for (DrmCrtc *pending_crtc : mirror_commit_crtcs){
+      DrmCrtcPendingState state;
+      drm->CollectPendingCrtcState(pending_crtc, pset, &state);
+      if(state.uCrtcId_)
+        vCrtcPendingState_.push_back(state);
+    }
+  }
+
   uint64_t zpos = 0;
 
   for (DrmCompositionPlane &comp_plane : comp_planes) {
@@ -856,7 +1104,8 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
 
       DrmHwcLayer &layer = layers[source_layers.front()];
 
-      if (!test_only && layer.acquire_fence->isValid()){
+      // Sideband 帧由内核直接送显, 不需要等待 SurfaceFlinger 的 AcquireFence
+      if (!test_only && !layer.bSidebandStreamLayer_ && layer.acquire_fence->isValid()){
         if(layer.acquire_fence->wait(1500)){
           HWC2_ALOGE("Wait AcquireFence failed! frame = %" PRIu64 " Info: size=%d act=%d signal=%d err=%d ,LayerName=%s ",
                             display_comp->frame_no(), layer.acquire_fence->getSize(),
@@ -874,6 +1123,11 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
       display_frame = layer.display_frame;
       display_frame_mirror = layer.display_frame_mirror;
       source_crop = layer.source_crop;
+      // 克隆送显: 同一 FB 以 plane 自己的 crop/frame 送到 mirror CRTC
+      if(comp_plane.has_mirror_rect()){
+        source_crop = comp_plane.mirror_crop();
+        display_frame_mirror = comp_plane.mirror_frame();
+      }
       if (layer.blending == DrmHwcBlending::kPreMult) alpha = layer.alpha << 8;
       eotf = layer.uEOTF;
       colorspace = layer.uColorSpace;
@@ -1003,24 +1257,10 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
       break;
     }
 
-    size_t index=0;
-    std::ostringstream out_log;
-
-    out_log << "DrmDisplayCompositor[" << index << "]"
-            << " frame_no=" << display_comp->frame_no()
-            << " display=" << display_comp->display()
-            << " plane=" << (plane ? plane->name() : "Unknow")
-            << " crct id=" << crtc->id()
-            << " fb id=" << fb_id
-            << " display_frame[" << dst_l << ","
-            << dst_t << "," << dst_w
-            << "," << dst_h << "]"
-            << " source_crop[" << src_l << ","
-            << src_t << "," << src_w
-            << "," << src_h << "]"
-            << ", zpos=" << zpos
-            ;
-    index++;
+    HWC2_EVENT(kEvCommitPlane, display_comp->frame_no(), display_comp->display(),
+               plane->id(), crtc->id(), fb_id, zpos);
+    HWC2_EVENT(kEvCommitPlaneDst, plane->id(), dst_l, dst_t, dst_w, dst_h);
+    HWC2_EVENT(kEvCommitPlaneSrc, plane->id(), src_l, src_t, src_w, src_h);
 
     if (plane->rotation_property().id()) {
       ret = drmModeAtomicAddProperty(pset, plane->id(),
@@ -1031,7 +1271,6 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
               plane->rotation_property().id(), plane->id());
         break;
       }
-      out_log << " rotation=" << rotation;
     }
 
     if (plane->alpha_property().id()) {
@@ -1042,7 +1281,6 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
               plane->alpha_property().id(), plane->id());
         break;
       }
-      out_log << " alpha=" << std::hex <<  alpha;
     }
 
     if (plane->blend_property().id()) {
@@ -1053,7 +1291,6 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
               plane->blend_property().id(), plane->id());
         break;
       }
-      out_log << " blend mode =" << blend;
     }
 
     if(plane->get_hdr2sdr() && plane->eotf_property().id()) {
@@ -1065,7 +1302,6 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
               plane->eotf_property().id(), plane->id());
         break;
       }
-      out_log << " eotf=" << std::hex <<  eotf;
     }
 
     if(plane->colorspace_property().id()) {
@@ -1077,7 +1313,6 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
               plane->colorspace_property().id(), plane->id());
         break;
       }
-      out_log << " colorspace=" << std::hex <<  colorspace;
     }
 
     if(plane->async_commit_property().id()) {
@@ -1089,12 +1324,9 @@ int DrmDisplayCompositor::CollectCommitInfo(drmModeAtomicReqPtr pset,
               plane->async_commit_property().id(), plane->id());
         break;
       }
-
-      out_log << " async_commit=" << sideband;
     }
 
-    HWC2_ALOGD_IF_DEBUG("%s",out_log.str().c_str());
-    out_log.clear();
+    HWC2_EVENT(kEvCommitPlaneAttr, plane->id(), rotation, alpha, blend, eotf, colorspace);
   }
   return ret;
 }
@@ -1125,6 +1357,8 @@ int DrmDisplayCompositor::CollectInfo(
       // signal the release fences from that composition to avoid hanging.
       return ret;
     }
+    // CollectCommitInfo 中已等待所有 AcquireFence
+    DrmTelemetry::getInstance()->Mark(composition->display(), composition->frame_no(), kTmFenceWaitEnd);
 
     // 配置 modeset 信息
     ret = CollectModeSetInfo(pset_, composition.get());
@@ -1140,6 +1374,40 @@ int DrmDisplayCompositor::CollectInfo(
   return 0;
 }
 
+// Mirror, 跨 CRTC 迁移中的 plane disable 以及其他 CRTC 的 pending state
+// 都会把别的 CRTC 拉入本次提交, 此时只能走 blocking commit.
+bool DrmDisplayCompositor::IsSingleCrtcCommit(DrmDevice *drm) {
+  DrmCrtc *crtc = drm->GetCrtcForDisplay(display_);
+  if(!crtc)
+    return false;
+  uint32_t crtc_mask = 1 << crtc->pipe();
+
+  std::set<DrmPlane*> own_planes;
+  for(PlaneGroup *plane_group : drm->GetPlaneGroups()){
+    bool own = plane_group->release_crtc_ ? plane_group->release_crtc_ == crtc_mask
+                                          : plane_group->current_crtc_ == crtc_mask;
+    if(own)
+      own_planes.insert(plane_group->planes.begin(), plane_group->planes.end());
+  }
+
+  for(auto &collect_composition : collect_composition_map_){
+    for(DrmCompositionPlane &comp_plane : collect_composition.second->composition_planes()){
+      if(comp_plane.mirror())
+        return false;
+      if(comp_plane.crtc() && comp_plane.crtc() != crtc)
+        return false;
+      if(comp_plane.plane() && !own_planes.count(comp_plane.plane()))
+        return false;
+    }
+  }
+
+  for(DrmCrtcPendingState &state : vCrtcPendingState_){
+    if(state.uCrtcId_ && state.uCrtcId_ != crtc->id())
+      return false;
+  }
+  return true;
+}
+
 void DrmDisplayCompositor::Commit() {
   ATRACE_CALL();
   if(!pset_){
@@ -1147,8 +1415,113 @@ void DrmDisplayCompositor::Commit() {
     return;
   }
   DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
-  uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
-  int ret = drmModeAtomicCommit(drm->fd(), pset_, flags, drm);
+  if(bLateLatch_){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    UpdateCommitCost(ts.tv_sec * kOneSecondNs + ts.tv_nsec - iCollectStartNs_);
+  }
+
+  // NONBLOCK commit returns -EBUSY while the previous flip is still pending.
+  WaitFlipDone();
+
+  // 只有 modeset 状态 (HDR) 或 WriteBack 连接发生变化时才需要 ALLOW_MODESET,
+  // 普通的图层更新走 non-blocking 提交, 在 page flip 事件中释放上一帧.
+  bool allow_modeset = need_mode_set_ || bWriteBackEnable_;
+  bool nonblock = bNonBlockCommit_ && !allow_modeset;
+  // 内核对提交中的每个 CRTC 各发一个 flip 事件, 而 handler 只能被释放一次.
+  if(nonblock && !IsSingleCrtcCommit(drm))
+    nonblock = false;
+  uint32_t flags = allow_modeset ? DRM_MODE_ATOMIC_ALLOW_MODESET : 0;
+  int ret = -1;
+
+  DrmTelemetry *telemetry = DrmTelemetry::getInstance();
+  // non-blocking 提交后 composition 可能已在 FlipDone 中释放, 提前记录帧号
+  std::vector<std::pair<int, uint64_t>> commit_frames;
+  for(auto &collect_composition : collect_composition_map_){
+    commit_frames.emplace_back(collect_composition.first, collect_composition.second->frame_no());
+    telemetry->Mark(collect_composition.first, collect_composition.second->frame_no(), kTmCommitStart);
+  }
+  // spilt 模式下一次提交包含多个 display，以第一帧命名
+  std::unique_ptr<HwcFrameTrace> commit_trace;
+  if(!collect_composition_map_.empty())
+    commit_trace.reset(new HwcFrameTrace("Commit", collect_composition_map_.begin()->first,
+                                         collect_composition_map_.begin()->second->frame_no()));
+
+  int32_t out_fence = -1;
+  if(bKernelOutFence_){
+    DrmCrtc *crtc = drm->GetCrtcForDisplay(display_);
+    if(crtc && crtc->out_fence_ptr_property().id()){
+      ret = drmModeAtomicAddProperty(pset_, crtc->id(),
+                                     crtc->out_fence_ptr_property().id(),
+                                     (uint64_t)(uintptr_t)&out_fence);
+      if (ret < 0)
+        ALOGE("Failed to add OUT_FENCE_PTR property %d to crtc %d", ret, crtc->id());
+    }
+    ret = -1;
+  }
+
+  if(nonblock){
+    CompositorFlipHandler *handler = NULL;
+    {
+      AutoLock lock(&lock_, __func__);
+      if (!lock.Lock()){
+        handler = new CompositorFlipHandler(this, ++iFlipSequence_);
+        bFlipPending_ = true;
+        // 提交前移交给 FlipDone, flip 事件可能在 drmModeAtomicCommit 返回前到达.
+        // 光标状态同样需要在 composition 移交前记录, 提交失败时按阻塞提交结果重新记录.
+        UpdateCursorPlane(collect_composition_map_, true);
+        for(auto &collect_composition : collect_composition_map_)
+          flip_composition_map_.insert(std::move(collect_composition));
+        collect_composition_map_.clear();
+        for(auto &superseded : superseded_compositions_)
+          flip_superseded_compositions_.push_back(std::move(superseded));
+        superseded_compositions_.clear();
+      }
+    }
+    if(handler){
+      ret = drmModeAtomicCommit(drm->fd(), pset_,
+                                flags | DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT,
+                                handler);
+      if (ret) {
+        HWC2_ALOGD_IF_INFO("display=%d nonblock commit fail ret=%d, retry blocking commit.",
+                           display_, ret);
+        delete handler;
+        AutoLock lock(&lock_, __func__);
+        if (!lock.Lock()){
+          bFlipPending_ = false;
+          for(auto &flip_composition : flip_composition_map_)
+            collect_composition_map_.insert(std::move(flip_composition));
+          flip_composition_map_.clear();
+          for(auto &superseded : flip_superseded_compositions_)
+            superseded_compositions_.push_back(std::move(superseded));
+          flip_superseded_compositions_.clear();
+        }
+        nonblock = false;
+      }
+    }else{
+      nonblock = false;
+    }
+  }
+
+  if(!nonblock){
+    ret = drmModeAtomicCommit(drm->fd(), pset_, flags, drm);
+    // Some property changes may still need a modeset, retry once with it.
+    if (ret && !allow_modeset)
+      ret = drmModeAtomicCommit(drm->fd(), pset_, DRM_MODE_ATOMIC_ALLOW_MODESET, drm);
+  }
+
+  for(auto &commit_frame : commit_frames)
+    telemetry->Mark(commit_frame.first, commit_frame.second, kTmCommitEnd);
+  commit_trace.reset();
+  UpdateCursorPlane(collect_composition_map_, ret == 0);
+
+  for(DrmCrtcPendingState &state : vCrtcPendingState_)
+    drm->CompletePendingCrtcState(state, ret);
+  vCrtcPendingState_.clear();
+  DrmConnector *connector = drm->GetConnectorForDisplay(display_);
+  if(connector)
+    connector->complete_hdmi_hdr_mode(ret);
+
   if (ret) {
     ALOGE("Failed to commit pset ret=%d\n", ret);
     drmModeAtomicFree(pset_);
@@ -1156,6 +1529,16 @@ void DrmDisplayCompositor::Commit() {
   }else{
     GetTimestamp();
     UpdateModeSetState();
+    // non-blocking 提交在 FlipDone 中确认
+    if(!nonblock){
+      for(auto &collect_composition : collect_composition_map_)
+        DrmPlaneBalancer::getInstance()->CommitDone(collect_composition.second.get());
+    }
+    if(!nonblock && bLateLatch_ && last_timestamp_ > iCommitDeadlineNs_ + iCommitPeriodNs_ / 2){
+      iLateLatchMissCnt_++;
+      HWC2_ALOGD_IF_DEBUG("display=%d miss deadline=%" PRIi64 " commit done=%" PRIi64 " cost=%" PRIi64 "us",
+                          display_, iCommitDeadlineNs_, last_timestamp_, iCommitCostNs_ / 1000);
+    }
   }
 
 
@@ -1184,23 +1567,283 @@ void DrmDisplayCompositor::Commit() {
   }
 
   AutoLock lock(&lock_, __func__);
-  if (lock.Lock())
+  if (lock.Lock()){
+    if(out_fence >= 0)
+      close(out_fence);
     return;
+  }
   ++dump_frames_composited_;
-  for(auto &collect_composition : collect_composition_map_){
+  if(bKernelOutFence_){
+    if(ret && out_fence >= 0){
+      close(out_fence);
+      out_fence = -1;
+    }
+    for(auto &commit_frame : commit_frames){
+      // 新帧上屏后, 上一帧使用的 RGA/SVEP 中间 buffer 才可以复用.
+      // FlipDone 已先完成时 active 即为本帧, 上一帧已释放.
+      auto active_composition = active_composition_map_.find(commit_frame.first);
+      if(out_fence >= 0 && active_composition != active_composition_map_.end() &&
+         active_composition->second->frame_no() != commit_frame.second)
+        active_composition->second->SetReleaseFence(out_fence);
+      SetOutFence(commit_frame.first, commit_frame.second,
+                  out_fence >= 0 ? dup(out_fence) : -1);
+    }
+    if(out_fence >= 0)
+      close(out_fence);
+  }
+  // non-blocking 提交的 composition 已移交 FlipDone, 新帧真正上屏后再释放上一帧.
+  if(!nonblock)
+    RetireCompositions(collect_composition_map_, superseded_compositions_);
+  // 新内容已上屏, flatten 图层被替换, 重新开始空闲计数.
+  if(!ret)
+    ExitFlatten();
+  bFlattenTried_ = false;
+  flatten_countdown_ = iFlattenIdleVsync_;
+}
+
+// 记录本次提交中独占一个 plane 的光标图层, 供 CommitCursor() 使用.
+void DrmDisplayCompositor::UpdateCursorPlane(
+    std::map<int, std::unique_ptr<DrmDisplayComposition>> &compositions,
+    bool committed) {
+  if(!bCursorFastPath_)
+    return;
+
+  std::lock_guard<std::mutex> cursor_lock(mCursorMutex_);
+  for(auto &collect_composition : compositions){
+    DrmPlane *cursor_plane = NULL;
+    int x = 0, y = 0;
+    DrmDisplayComposition *composition = collect_composition.second.get();
+    for(DrmCompositionPlane &comp_plane : composition->composition_planes()){
+      if(!committed)
+        break;
+      if(comp_plane.type() != DrmCompositionPlane::Type::kLayer ||
+         comp_plane.mirror() || comp_plane.source_layers().size() != 1)
+        continue;
+      size_t index = comp_plane.source_layers().front();
+      if(index >= composition->layers().size())
+        continue;
+      DrmHwcLayer &layer = composition->layers()[index];
+      if(!layer.bCursor_)
+        continue;
+      cursor_plane = comp_plane.plane();
+      x = layer.display_frame.left;
+      y = layer.display_frame.top;
+      break;
+    }
+
+    if(cursor_plane == NULL){
+      mapDisplayCursor_.erase(collect_composition.first);
+      continue;
+    }
+    CursorState &cursor = mapDisplayCursor_[collect_composition.first];
+    cursor.plane = cursor_plane;
+    cursor.x = x;
+    cursor.y = y;
+  }
+}
+
+int DrmDisplayCompositor::SetCursorPosition(int display, int x, int y) {
+  if(!bCursorFastPath_ || !initialized_)
+    return -EINVAL;
+
+  {
+    std::lock_guard<std::mutex> cursor_lock(mCursorMutex_);
+    auto cursor = mapDisplayCursor_.find(display);
+    if(cursor == mapDisplayCursor_.end() || cursor->second.plane == NULL)
+      return -ENOENT;
+    // 多次更新只保留最新位置, 每个 vblank 最多提交一次
+    cursor->second.x = x;
+    cursor->second.y = y;
+    cursor->second.pending = true;
+  }
+  worker_.Signal();
+  return 0;
+}
+
+bool DrmDisplayCompositor::HaveCursorUpdate() const {
+  std::lock_guard<std::mutex> cursor_lock(mCursorMutex_);
+  for(auto &cursor : mapDisplayCursor_){
+    if(cursor.second.pending)
+      return true;
+  }
+  return false;
+}
+
+int DrmDisplayCompositor::CommitCursor() {
+  ATRACE_CALL();
+  std::map<int, CursorState> cursors;
+  {
+    std::lock_guard<std::mutex> cursor_lock(mCursorMutex_);
+    for(auto &cursor : mapDisplayCursor_){
+      if(!cursor.second.pending)
+        continue;
+      cursor.second.pending = false;
+      cursors.insert(cursor);
+    }
+  }
+  if(cursors.empty())
+    return 0;
+
+  drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
+  if (!pset) {
+    ALOGE("Failed to allocate cursor property set");
+    return -ENOMEM;
+  }
+
+  int ret = 0;
+  for(auto &cursor : cursors){
+    DrmPlane *plane = cursor.second.plane;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(),
+                                    plane->crtc_x_property().id(),
+                                    cursor.second.x) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(),
+                                    plane->crtc_y_property().id(),
+                                    cursor.second.y) < 0;
+    // 位置更新不需要等待完整帧, 下一帧完整提交时会恢复为 0
+    if(plane->async_commit_property().id())
+      ret |= drmModeAtomicAddProperty(pset, plane->id(),
+                                      plane->async_commit_property().id(),
+                                      1) < 0;
+  }
+  if (ret) {
+    ALOGE("Failed to add cursor plane to pset");
+    drmModeAtomicFree(pset);
+    return -EINVAL;
+  }
+
+  // NONBLOCK 提交的 page flip 未完成时提交会返回 -EBUSY.
+  WaitFlipDone();
+  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  ret = drmModeAtomicCommit(drm->fd(), pset, 0, drm);
+  drmModeAtomicFree(pset);
+  if (ret) {
+    HWC2_ALOGD_IF_DEBUG("display=%d cursor commit fail ret=%d, fallback to full commit.",
+                        display_, ret);
+    // 之后的光标更新走完整的 validate/present 流程, 直到下一帧重新记录光标 plane
+    std::lock_guard<std::mutex> cursor_lock(mCursorMutex_);
+    for(auto &cursor : cursors)
+      mapDisplayCursor_.erase(cursor.first);
+    return ret;
+  }
+  // blocking 提交在 flip 完成后才返回, 光标更新已限制为每个 vblank 一次
+  iCursorCommitCnt_++;
+  return 0;
+}
+
+// Must be called with lock_ held.
+void DrmDisplayCompositor::RetireCompositions(
+    std::map<int, std::unique_ptr<DrmDisplayComposition>> &compositions,
+    std::vector<std::unique_ptr<DrmDisplayComposition>> &superseded) {
+  DrmTelemetry *telemetry = DrmTelemetry::getInstance();
+  for(auto &collect_composition : compositions){
+    telemetry->Mark(collect_composition.first, collect_composition.second->frame_no(), kTmFlipDone);
     auto active_composition = active_composition_map_.find(collect_composition.first);
     if(active_composition != active_composition_map_.end()){
+      telemetry->Mark(active_composition->first, active_composition->second->frame_no(), kTmRelease);
       active_composition->second->SignalCompositionDone();
       active_composition_map_.erase(active_composition);
     }
   }
 
-  for(auto &collect_composition : collect_composition_map_){
+  // 被跳过的帧 ReleaseFence 的 sync point 比刚被替换的帧更大,
+  // 必须在其之后 signal, 否则会提前释放正在显示的 buffer.
+  for(auto &superseded_composition : superseded){
+    superseded_composition->SignalCompositionDone();
+  }
+  superseded.clear();
+
+  for(auto &collect_composition : compositions){
     active_composition_map_.insert(std::move(collect_composition));
   }
-  collect_composition_map_.clear();
-  //flatten_countdown_ = FLATTEN_COUNTDOWN_INIT;
-  //vsync_worker_.VSyncControl(!writeback);
+  compositions.clear();
+}
+
+int DrmDisplayCompositor::WaitFlipDone() {
+  ATRACE_CALL();
+  AutoLock lock(&lock_, __func__);
+  if (lock.Lock())
+    return -1;
+
+  if(!bFlipPending_)
+    return 0;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int64_t timeout = ts.tv_sec * kOneSecondNs + ts.tv_nsec + kWaitFlipDoneNs;
+  ts.tv_sec = timeout / kOneSecondNs;
+  ts.tv_nsec = timeout - (ts.tv_sec * kOneSecondNs);
+
+  while(bFlipPending_){
+    int ret = pthread_cond_timedwait(&flip_done_cond_, &lock_, &ts);
+    if(ret == ETIMEDOUT){
+      // 避免 ReleaseFence 无法 signal 导致上层卡死.
+      HWC2_ALOGE("display=%d wait flip done timeout, sequence=%" PRIu64,
+                 display_, iFlipSequence_);
+      RetireCompositions(flip_composition_map_, flip_superseded_compositions_);
+      bFlipPending_ = false;
+      return -ETIMEDOUT;
+    }
+  }
+  return 0;
+}
+
+void DrmDisplayCompositor::FlipDone(uint64_t sequence, int64_t timestamp_ns) {
+  ATRACE_CALL();
+  AutoLock lock(&lock_, __func__);
+  if (lock.Lock())
+    return;
+
+  // Stale event of a commit already retired by timeout or ClearDisplay.
+  if(!bFlipPending_ || sequence != iFlipSequence_)
+    return;
+
+  for(auto &flip_composition : flip_composition_map_)
+    DrmPlaneBalancer::getInstance()->CommitDone(flip_composition.second.get());
+  RetireCompositions(flip_composition_map_, flip_superseded_compositions_);
+  bFlipPending_ = false;
+  last_timestamp_ = timestamp_ns;
+
+  if(bLateLatch_ && timestamp_ns > iCommitDeadlineNs_ + iCommitPeriodNs_ / 2){
+    iLateLatchMissCnt_++;
+    HWC2_ALOGD_IF_DEBUG("display=%d miss deadline=%" PRIi64 " flip done=%" PRIi64 " cost=%" PRIi64 "us",
+                        display_, iCommitDeadlineNs_, timestamp_ns, iCommitCostNs_ / 1000);
+  }
+  pthread_cond_signal(&flip_done_cond_);
+}
+
+// Must be called with lock_ held, takes ownership of fd.
+void DrmDisplayCompositor::SetOutFence(int display, uint64_t frame_no, int fd) {
+  OutFence &out_fence = mapDisplayOutFence_[display];
+  if(out_fence.fd >= 0)
+    close(out_fence.fd);
+  out_fence.frame_no = frame_no;
+  out_fence.fd = fd;
+  pthread_cond_broadcast(&out_fence_cond_);
+}
+
+// 等待 frame_no 提交完成, 返回 dup 后的 crtc out fence, 失败返回 -1.
+int DrmDisplayCompositor::WaitOutFence(int display, uint64_t frame_no) {
+  ATRACE_CALL();
+  AutoLock lock(&lock_, __func__);
+  if (lock.Lock())
+    return -1;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int64_t timeout = ts.tv_sec * kOneSecondNs + ts.tv_nsec + kWaitOutFenceNs;
+  ts.tv_sec = timeout / kOneSecondNs;
+  ts.tv_nsec = timeout - (ts.tv_sec * kOneSecondNs);
+
+  auto out_fence = mapDisplayOutFence_.find(display);
+  while(out_fence == mapDisplayOutFence_.end() || out_fence->second.frame_no != frame_no){
+    int ret = pthread_cond_timedwait(&out_fence_cond_, &lock_, &ts);
+    if(ret == ETIMEDOUT){
+      HWC2_ALOGE("display=%d wait out fence timeout, frame_no=%" PRIu64, display, frame_no);
+      return -1;
+    }
+    out_fence = mapDisplayOutFence_.find(display);
+  }
+  return out_fence->second.fd >= 0 ? dup(out_fence->second.fd) : -1;
 }
 
 int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
@@ -1339,6 +1982,11 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
       display_frame = layer.display_frame;
       display_frame_mirror = layer.display_frame_mirror;
       source_crop = layer.source_crop;
+      // 克隆送显: 同一 FB 以 plane 自己的 crop/frame 送到 mirror CRTC
+      if(comp_plane.has_mirror_rect()){
+        source_crop = comp_plane.mirror_crop();
+        display_frame_mirror = comp_plane.mirror_frame();
+      }
       if (layer.blending == DrmHwcBlending::kPreMult) alpha = layer.alpha << 8;
       eotf = layer.uEOTF;
       colorspace = layer.uColorSpace;
@@ -1447,24 +2095,10 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
       break;
     }
 
-    size_t index=0;
-    std::ostringstream out_log;
-
-    out_log << "DrmDisplayCompositor[" << index << "]"
-            << " frame_no=" << display_comp->frame_no()
-            << " display=" << display_comp->display()
-            << " plane=" << (plane ? plane->name() : "Unknow")
-            << " crct id=" << crtc->id()
-            << " fb id=" << fb_id
-            << " display_frame[" << dst_l << ","
-            << dst_t << "," << dst_w
-            << "," << dst_h << "]"
-            << " source_crop[" << src_l << ","
-            << src_t << "," << src_w
-            << "," << src_h << "]"
-            << ", zpos=" << zpos
-            ;
-    index++;
+    HWC2_EVENT(kEvCommitPlane, display_comp->frame_no(), display_comp->display(),
+               plane->id(), crtc->id(), fb_id, zpos);
+    HWC2_EVENT(kEvCommitPlaneDst, plane->id(), dst_l, dst_t, dst_w, dst_h);
+    HWC2_EVENT(kEvCommitPlaneSrc, plane->id(), src_l, src_t, src_w, src_h);
 
     if (plane->rotation_property().id()) {
       ret = drmModeAtomicAddProperty(pset, plane->id(),
@@ -1475,7 +2109,6 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
               plane->rotation_property().id(), plane->id());
         break;
       }
-      out_log << " rotation=" << rotation;
     }
 
     if (plane->alpha_property().id()) {
@@ -1486,7 +2119,6 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
               plane->alpha_property().id(), plane->id());
         break;
       }
-      out_log << " alpha=" << std::hex <<  alpha;
     }
 
     if (plane->blend_property().id()) {
@@ -1497,7 +2129,6 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
               plane->blend_property().id(), plane->id());
         break;
       }
-      out_log << " blend mode =" << blend;
     }
 
     if(plane->get_hdr2sdr() && plane->eotf_property().id()) {
@@ -1509,7 +2140,6 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
               plane->eotf_property().id(), plane->id());
         break;
       }
-      out_log << " eotf=" << std::hex <<  eotf;
     }
 
     if(plane->colorspace_property().id()) {
@@ -1521,11 +2151,9 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
               plane->colorspace_property().id(), plane->id());
         break;
       }
-      out_log << " colorspace=" << std::hex <<  colorspace;
     }
 
-    ALOGD_IF(LogLevel(DBG_INFO),"%s",out_log.str().c_str());
-    out_log.clear();
+    HWC2_EVENT(kEvCommitPlaneAttr, plane->id(), rotation, alpha, blend, eotf, colorspace);
   }
 
   if (!ret) {
@@ -1573,8 +2201,8 @@ std::tuple<int, uint32_t> DrmDisplayCompositor::CreateModeBlob(
 
   uint32_t id = 0;
   DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
-  int ret = drm->CreatePropertyBlob(&drm_mode, sizeof(struct drm_mode_modeinfo),
-                                    &id);
+  int ret = drm->AcquirePropertyBlob(&drm_mode, sizeof(struct drm_mode_modeinfo),
+                                     &id);
   if (ret) {
     ALOGE("Failed to create mode property blob %d", ret);
     return std::make_tuple(ret, 0);
@@ -1638,26 +2266,40 @@ void DrmDisplayCompositor::ClearDisplay() {
   // 清空 DrmDisplayComposition 前需要将已经送显的图层统一关闭后再进行RMFB
   // 如果上层直接 RMFB 的话，底层会自动关闭对应图层，因为关闭有先后顺序
   // 可能会导致屏幕非预期闪屏，例如zpos=1先被关闭，zpos=0图层就显示到屏幕上一帧
+  // 等待中的 page flip 视为已上屏, 和 active 帧一起关闭.
+  RetireCompositions(flip_composition_map_, flip_superseded_compositions_);
+  bFlipPending_ = false;
+  ExitFlatten();
+  {
+    std::lock_guard<std::mutex> cursor_lock(mCursorMutex_);
+    mapDisplayCursor_.clear();
+  }
+
   for(auto &map : active_composition_map_){
     if(map.second != NULL)
       SingalCompsition(std::move(map.second));
   }
   active_composition_map_.clear();
 
-  //Singal the remainder fences in composite queue.
-  while(!composite_queue_.empty())
-  {
-    std::unique_ptr<DrmDisplayComposition> remain_composition(
-      std::move(composite_queue_.front()));
-
-    if(remain_composition)
-      ALOGD_IF(LogLevel(DBG_DEBUG),"ClearDisplay: composite_queue_ size=%zu frame_no=%" PRIu64 "",composite_queue_.size(), remain_composition->frame_no());
+  for(auto &superseded : superseded_compositions_){
+    superseded->SignalCompositionDone();
+  }
+  superseded_compositions_.clear();
 
-    SingalCompsition(std::move(remain_composition));
-    composite_queue_.pop();
-    pthread_cond_signal(&composite_queue_cond_);
+  //Singal the remainder fences in composite queue.
+  for(CompositionQueue &queue : composite_queue_){
+    std::unique_ptr<DrmDisplayComposition> remain_composition;
+    while(queue.Pop(&remain_composition))
+    {
+      if(remain_composition)
+        ALOGD_IF(LogLevel(DBG_DEBUG),"ClearDisplay: composite_queue_ size=%zu frame_no=%" PRIu64 "",queue.Size(), remain_composition->frame_no());
+
+      if(remain_composition && bKernelOutFence_)
+        SetOutFence(remain_composition->display(), remain_composition->frame_no(), -1);
+      SingalCompsition(std::move(remain_composition));
+    }
   }
-  mapDisplayHaveQeueuCnt_.clear();
+  pthread_cond_broadcast(&composite_queue_cond_);
 
   if(bWriteBackEnable_){
     drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
@@ -1702,6 +2344,7 @@ void DrmDisplayCompositor::ApplyFrame(
     ClearDisplay();
     return;
   }
+  DrmPlaneBalancer::getInstance()->CommitDone(composition.get());
 
   AutoLock lock(&lock_, __func__);
   if (lock.Lock())
@@ -1724,51 +2367,61 @@ void DrmDisplayCompositor::ApplyFrame(
 int DrmDisplayCompositor::Composite() {
   ATRACE_CALL();
 
+  // Late-latch: wait for the commit deadline first, so the newest composition
+  // queued in the meantime is the one that gets committed.
+  if(bLateLatch_)
+    WaitCommitDeadline();
+
   int ret = pthread_mutex_lock(&lock_);
   if (ret) {
     ALOGE("Failed to acquire compositor lock %d", ret);
     return ret;
   }
 
-  if (composite_queue_.empty()) {
+  if (!HaveQueuedComposites()) {
     ret = pthread_mutex_unlock(&lock_);
     if (ret)
       ALOGE("Failed to release compositor lock %d", ret);
     return ret;
   }
 
+  // 每个 display 独立排队, 同一 crtc 上的 display (spilt 模式) 合并到一次提交.
   std::unique_ptr<DrmDisplayComposition> composition;
+  for (CompositionQueue &queue : composite_queue_) {
+    if (queue.Empty())
+      continue;
 
-  std::set<int> exist_display;
-  exist_display.clear();
-  if (!composite_queue_.empty()) {
-    while(composite_queue_.size() > 0){
-      composition = std::move(composite_queue_.front());
-      composite_queue_.pop();
-      if(exist_display.count(composition->display())){
-        composite_queue_temp_.push(std::move(composition));
-        continue;
+    // 选择最新的已就绪帧, 若都未就绪则提交最早的一帧
+    size_t latch = 0;
+    if (bLateLatch_) {
+      for (size_t i = queue.Size(); i > 0; i--) {
+        if (IsCompositionReady(queue.Peek(i - 1).get())) {
+          latch = i - 1;
+          break;
+        }
       }
-      mapDisplayHaveQeueuCnt_[composition->display()]--;
-      exist_display.insert(composition->display());
-      CollectInfo(std::move(composition), 0);
     }
-    while(composite_queue_temp_.size()){
-      composite_queue_.push(std::move(composite_queue_temp_.front()));
-      composite_queue_temp_.pop();
-    }
-  }else{ // frame_queue_ is empty
-    ALOGW_IF(LogLevel(DBG_DEBUG),"%s,line=%d composite_queue_ is empty, skip ApplyFrame",__FUNCTION__,__LINE__);
-    ret = pthread_mutex_unlock(&lock_);
-    if (ret) {
-      ALOGE("Failed to release compositor lock %d", ret);
-      return ret;
+
+    for (size_t i = 0; i < latch; i++) {
+      queue.Pop(&composition);
+      HWC2_ALOGD_IF_DEBUG("display=%d drop superseded frame_no=%" PRIu64 " latch frame_no=%" PRIu64,
+                          composition->display(), composition->frame_no(),
+                          queue.Peek(latch - i - 1)->frame_no());
+      iLateLatchDropCnt_++;
+      superseded_compositions_.push_back(std::move(composition));
     }
-    return 0;
+
+    queue.Pop(&composition);
+    int display = composition->display();
+    uint64_t frame_no = composition->frame_no();
+    HwcTraceCounter(display, "QueueDepth", queue.Size());
+    HWC_FRAME_TRACE("Composite", display, frame_no);
+    if(CollectInfo(std::move(composition), 0) && bKernelOutFence_)
+      SetOutFence(display, frame_no, -1);
   }
 
   // ALOGI("rk-debug display=%d signal cond=%p",display(),&composite_queue_cond_);
-  pthread_cond_signal(&composite_queue_cond_);
+  pthread_cond_broadcast(&composite_queue_cond_);
 
   ret = pthread_mutex_unlock(&lock_);
   if (ret) {
@@ -1777,31 +2430,71 @@ int DrmDisplayCompositor::Composite() {
   }
 
   Commit();
-  SyntheticWaitVBlank();
+  // Late-latch paces itself on the next deadline.
+  if(!bLateLatch_)
+    SyntheticWaitVBlank();
   return ret;
 }
 
 bool DrmDisplayCompositor::HaveQueuedComposites() const {
-  int ret = pthread_mutex_lock(&lock_);
-  if (ret) {
-    ALOGE("Failed to acquire compositor lock %d", ret);
-    return false;
+  for (const CompositionQueue &queue : composite_queue_) {
+    if (!queue.Empty())
+      return true;
   }
+  return false;
+}
 
-  bool empty_ret = !composite_queue_.empty();
 
-  ret = pthread_mutex_unlock(&lock_);
-  if (ret) {
-    ALOGE("Failed to release compositor lock %d", ret);
-    return false;
-  }
+int DrmDisplayCompositor::TestComposition(DrmDisplayComposition *composition) {
+  return CommitFrame(composition, true);
+}
 
-  return empty_ret;
+// 返回 0 表示方案已通过校验, -EINVAL 表示已被内核拒绝, -ENOENT 表示未校验过.
+int DrmDisplayCompositor::LookupPlan(uint64_t signature) {
+  std::lock_guard<std::mutex> lock(mPlanCacheMutex_);
+  auto it = mapPlanCache_.find(signature);
+  if(it == mapPlanCache_.end())
+    return -ENOENT;
+  listPlanCache_.splice(listPlanCache_.begin(), listPlanCache_, it->second);
+  return it->second->second ? 0 : -EINVAL;
 }
 
+int DrmDisplayCompositor::TestPlan(DrmDisplayComposition *composition, bool cache_reject) {
+  ATRACE_CALL();
+  if(!bPlanTest_ || !composition)
+    return 0;
 
-int DrmDisplayCompositor::TestComposition(DrmDisplayComposition *composition) {
-  return CommitFrame(composition, true);
+  uint64_t signature = composition->plan_signature();
+  int ret = LookupPlan(signature);
+  if(ret != -ENOENT){
+    std::lock_guard<std::mutex> lock(mPlanCacheMutex_);
+    iPlanCacheHitCnt_++;
+    return ret;
+  }
+
+  // 未命中缓存, 由内核进行一次 TEST_ONLY 校验
+  ret = TestComposition(composition);
+  if(ret){
+    HWC2_ALOGI("display=%d frame_no=%" PRIu64 " plan=0x%" PRIx64 " rejected by TEST_ONLY commit ret=%d",
+               composition->display(), composition->frame_no(), signature, ret);
+  }
+
+  std::lock_guard<std::mutex> lock(mPlanCacheMutex_);
+  iPlanCacheMissCnt_++;
+  if(ret)
+    iPlanRejectCnt_++;
+  // 只有方案本身不被支持才缓存为拒绝, -EBUSY/-ENOMEM/-EINTR 等暂时性错误下帧重新校验
+  if(ret && (!cache_reject || (ret != -EINVAL && ret != -ERANGE)))
+    return ret;
+  if(!mapPlanCache_.count(signature)){
+    listPlanCache_.emplace_front(signature, ret == 0);
+    mapPlanCache_[signature] = listPlanCache_.begin();
+    while(listPlanCache_.size() > iPlanCacheSize_){
+      mapPlanCache_.erase(listPlanCache_.back().first);
+      listPlanCache_.pop_back();
+    }
+  }
+  return ret ? -EINVAL : 0;
 }
 
 // Flatten a scene on the display by using a writeback connector
@@ -1821,7 +2514,7 @@ int DrmDisplayCompositor::FlattenOnDisplay(
         mode.v_display() == src_mode.v_display()) {
       mode_.mode = mode;
       if (mode_.blob_id)
-        drm->DestroyPropertyBlob(mode_.blob_id);
+        drm->ReleasePropertyBlob(mode_.blob_id);
       std::tie(ret, mode_.blob_id) = CreateModeBlob(mode_.mode);
       if (ret) {
         ALOGE("Failed to create mode blob for display %d", display_);
@@ -1902,98 +2595,244 @@ int DrmDisplayCompositor::FlattenOnDisplay(
 
 // Flatten a scene by enabling the writeback connector attached
 // to the same CRTC as the one driving the display.
+// 1. WriteBack 连接到当前 crtc, 将正在显示的多图层场景写回到 flatten buffer;
+// 2. 用一个 plane 全屏显示 flatten buffer, 关闭场景中其他 plane 并断开 WriteBack.
+// 之后直到内容变化都只需扫描一个图层, 下一次 Commit 会覆盖/关闭该 plane.
 int DrmDisplayCompositor::FlattenSerial(DrmConnector *writeback_conn) {
-  ALOGV("FlattenSerial by enabling writeback connector to the same crtc");
-  // Flattened composition with only one layer that is obtained
-  // using the writeback connector
-  std::unique_ptr<DrmDisplayComposition>
-      writeback_comp = CreateInitializedComposition();
-  if (!writeback_comp)
+  ATRACE_CALL();
+  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  DrmCrtc *crtc = drm->GetCrtcForDisplay(display_);
+  DrmConnector *connector = drm->GetConnectorForDisplay(display_);
+  if (!crtc || !connector) {
+    ALOGE("Failed to find crtc or connector for display %d", display_);
+    return -ENODEV;
+  }
+  if (writeback_conn->writeback_fb_id().id() == 0 ||
+      writeback_conn->writeback_out_fence().id() == 0) {
+    ALOGE("Writeback properties don't exit");
     return -EINVAL;
+  }
 
-  AutoLock lock(&lock_, __func__);
-  int ret = lock.Lock();
-  if (ret)
-    return ret;
-  if (!CountdownExpired() || active_composition_->layers().size() < 2) {
+  // WriteBack 输出宽度需要 16 对齐, 否则 flatten 图层无法覆盖全屏.
+  const DrmMode &mode = connector->current_mode();
+  int width = mode.h_display();
+  int height = mode.v_display();
+  if (width <= 0 || height <= 0 || width % 16) {
+    ALOGV("Flattening is not supported for %dx%d", width, height);
+    return -EINVAL;
+  }
+
+  // NONBLOCK 提交的 page flip 完成后场景才稳定.
+  WaitFlipDone();
+
+  std::vector<DrmPlane *> scene_planes;
+  uint64_t scene_bytes = 0;
+  {
+    AutoLock lock(&lock_, __func__);
+    int ret = lock.Lock();
+    if (ret)
+      return ret;
+    // spilt 模式两个 display 共用 crtc, 不做 flatten.
+    if (clear_ || active_composition_map_.size() != 1 || HaveQueuedComposites())
+      return -EALREADY;
+    DrmDisplayComposition *active = active_composition_map_.begin()->second.get();
+    if (!active || active->hdr_mode())
+      return -EINVAL;
+    std::vector<DrmHwcLayer> &layers = active->layers();
+    for (DrmCompositionPlane &comp_plane : active->composition_planes()) {
+      if (comp_plane.type() != DrmCompositionPlane::Type::kLayer ||
+          comp_plane.source_layers().empty())
+        continue;
+      size_t index = comp_plane.source_layers().front();
+      if (comp_plane.mirror() || index >= layers.size())
+        return -EINVAL;
+      DrmHwcLayer &layer = layers[index];
+      if (layer.bSidebandStreamLayer_ || layer.uEOTF != TRADITIONAL_GAMMA_SDR)
+        return -EINVAL;
+      uint64_t src_w = layer.source_crop.right - layer.source_crop.left;
+      uint64_t src_h = layer.source_crop.bottom - layer.source_crop.top;
+      scene_bytes += layer.bYuv_ ? src_w * src_h * 3 / 2 : src_w * src_h * 4;
+      scene_planes.push_back(comp_plane.plane());
+    }
+  }
+
+  // 只有在能节省带宽时才进行 flatten.
+  uint64_t flatten_bytes = (uint64_t)width * height * 4;
+  if (scene_planes.size() < 2 || scene_bytes <= flatten_bytes) {
     ALOGV("Flattening is not needed");
     return -EALREADY;
   }
 
-  DrmFramebuffer *writeback_fb = &framebuffers_[framebuffer_index_];
-  framebuffer_index_ = (framebuffer_index_ + 1) % DRM_DISPLAY_BUFFERS;
-  lock.Unlock();
-
-  if (!writeback_fb->Allocate(mode_.mode.h_display(), mode_.mode.v_display())) {
-    ALOGE("Failed to allocate writeback buffer");
-    return -ENOMEM;
+  if (!pFlattenBuffer_ || pFlattenBuffer_->GetWidth() != width ||
+      pFlattenBuffer_->GetHeight() != height) {
+    pFlattenBuffer_ = std::make_shared<DrmBuffer>(width, height, HAL_PIXEL_FORMAT_RGBA_8888,
+                                                  0, "FlattenBuffer");
+    if (pFlattenBuffer_->Init()) {
+      HWC2_ALOGE("display=%d FlattenBuffer init fail, w=%d h=%d", display_, width, height);
+      pFlattenBuffer_ = NULL;
+      return -ENOMEM;
+    }
   }
-  writeback_comp->layers().emplace_back();
 
-  DrmHwcLayer &writeback_layer = writeback_comp->layers().back();
-  writeback_layer.sf_handle = writeback_fb->buffer()->handle;
-  writeback_layer.source_crop = {0, 0, (float)mode_.mode.h_display(),
-                                 (float)mode_.mode.v_display()};
-  writeback_layer.display_frame = {0, 0, (int)mode_.mode.h_display(),
-                                   (int)mode_.mode.v_display()};
-  ret = writeback_layer.ImportBuffer(
-      resource_manager_->GetImporter(display_).get());
-  if (ret || writeback_comp->layers().size() != 1) {
-    ALOGE("Failed to import writeback buffer");
-    return ret;
+  DrmPlane *flatten_plane = NULL;
+  for (DrmPlane *plane : scene_planes) {
+    if (plane->is_support_format(pFlattenBuffer_->GetFourccFormat(), false) &&
+        plane->is_support_input(width, height) &&
+        plane->is_support_output(width, height)) {
+      flatten_plane = plane;
+      break;
+    }
+  }
+  if (!flatten_plane) {
+    ALOGV("No plane can scan out the flattened scene");
+    return -EINVAL;
   }
 
+  // 1. 连接 WriteBack, 写回当前场景.
+  int writeback_fence = -1;
   drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
   if (!pset) {
     ALOGE("Failed to allocate property set");
     return -ENOMEM;
   }
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
-  DrmCrtc *crtc = drm->GetCrtcForDisplay(display_);
-  if (!crtc) {
-    ALOGE("Failed to find crtc for display %d", display_);
-    return -EINVAL;
-  }
-  ret = SetupWritebackCommit(pset, crtc->id(), writeback_conn,
-                             &writeback_layer.buffer);
-  if (ret < 0) {
-    ALOGE("Failed to Setup Writeback Commit");
-    return ret;
-  }
-  ret = drmModeAtomicCommit(drm->fd(), pset, 0, drm);
+  int ret = drmModeAtomicAddProperty(pset, writeback_conn->id(),
+                                     writeback_conn->writeback_fb_id().id(),
+                                     pFlattenBuffer_->GetFbId()) < 0 ||
+            drmModeAtomicAddProperty(pset, writeback_conn->id(),
+                                     writeback_conn->writeback_out_fence().id(),
+                                     (uint64_t)(uintptr_t)&writeback_fence) < 0 ||
+            drmModeAtomicAddProperty(pset, writeback_conn->id(),
+                                     writeback_conn->crtc_id_property().id(),
+                                     crtc->id()) < 0;
+  if (!ret)
+    ret = drmModeAtomicCommit(drm->fd(), pset, DRM_MODE_ATOMIC_ALLOW_MODESET, drm);
+  drmModeAtomicFree(pset);
   if (ret) {
     ALOGE("Failed to enable writeback %d", ret);
     return ret;
   }
-  ret = sync_wait(writeback_fence_, kWaitWritebackFence);
-  writeback_layer.acquire_fence = sp<AcquireFence>(new AcquireFence(writeback_fence_));
-  writeback_fence_ = -1;
-  if (ret) {
-    ALOGE("Failed to wait on writeback fence");
-    return ret;
+  if (writeback_fence >= 0) {
+    ret = sync_wait(writeback_fence, kWaitWritebackFence);
+    close(writeback_fence);
   }
 
-  DrmCompositionPlane squashed_comp(DrmCompositionPlane::Type::kLayer, NULL,
-                                    crtc);
-  for (auto &drmplane : drm->planes()) {
-    if (!drmplane->GetCrtcSupported(*crtc))
-      continue;
-    if (!squashed_comp.plane() && drmplane->type() == DRM_PLANE_TYPE_PRIMARY)
-      squashed_comp.set_plane(drmplane.get());
-    else
-      writeback_comp->AddPlaneDisable(drmplane.get());
+  // 2. 显示 flatten buffer, 关闭场景中其他 plane, 断开 WriteBack.
+  pset = drmModeAtomicAlloc();
+  if (!pset) {
+    ALOGE("Failed to allocate property set");
+    return -ENOMEM;
   }
-  squashed_comp.source_layers().push_back(0);
-  ret = writeback_comp->AddPlaneComposition(std::move(squashed_comp));
+  bool detach_only = ret || HaveQueuedComposites();
+  if (ret)
+    ALOGE("Failed to wait on writeback fence");
+
+  ret = drmModeAtomicAddProperty(pset, writeback_conn->id(),
+                                 writeback_conn->writeback_fb_id().id(), 0) < 0 ||
+        drmModeAtomicAddProperty(pset, writeback_conn->id(),
+                                 writeback_conn->crtc_id_property().id(), 0) < 0;
+  if (!detach_only) {
+    for (DrmPlane *plane : scene_planes) {
+      if (plane == flatten_plane)
+        continue;
+      ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->crtc_property().id(), 0) < 0;
+      ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->fb_property().id(), 0) < 0;
+    }
+    DrmPlane *plane = flatten_plane;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->crtc_property().id(), crtc->id()) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->fb_property().id(),
+                                    pFlattenBuffer_->GetFbId()) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->crtc_x_property().id(), 0) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->crtc_y_property().id(), 0) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->crtc_w_property().id(), width) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->crtc_h_property().id(), height) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->src_x_property().id(), 0) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->src_y_property().id(), 0) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->src_w_property().id(),
+                                    width << 16) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->src_h_property().id(),
+                                    height << 16) < 0;
+    ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->zpos_property().id(), 0) < 0;
+    if (plane->rotation_property().id())
+      ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->rotation_property().id(),
+                                      DRM_MODE_ROTATE_0) < 0;
+    if (plane->alpha_property().id())
+      ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->alpha_property().id(),
+                                      0xFFFF) < 0;
+    if (plane->blend_property().id()) {
+      uint64_t blend = 0;
+      int blend_ret;
+      std::tie(blend, blend_ret) = plane->blend_property().GetEnumValueWithName("None");
+      ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->blend_property().id(),
+                                      blend) < 0;
+    }
+    if (plane->get_hdr2sdr() && plane->eotf_property().id())
+      ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->eotf_property().id(),
+                                      TRADITIONAL_GAMMA_SDR) < 0;
+    if (plane->colorspace_property().id())
+      ret |= drmModeAtomicAddProperty(pset, plane->id(), plane->colorspace_property().id(),
+                                      V4L2_COLORSPACE_DEFAULT) < 0;
+    if (plane->async_commit_property().id())
+      ret |= drmModeAtomicAddProperty(pset, plane->id(),
+                                      plane->async_commit_property().id(), 0) < 0;
+    if (ret) {
+      ALOGE("Failed to add flatten plane %d to pset", plane->id());
+      drmModeAtomicFree(pset);
+      return -EINVAL;
+    }
+    ret = drmModeAtomicCommit(drm->fd(), pset,
+                              DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_TEST_ONLY, drm);
+    if (ret) {
+      HWC2_ALOGD_IF_DEBUG("display=%d flatten scene check fail ret=%d", display_, ret);
+      detach_only = true;
+      drmModeAtomicFree(pset);
+      pset = drmModeAtomicAlloc();
+      if (!pset) {
+        ALOGE("Failed to allocate property set");
+        return -ENOMEM;
+      }
+      drmModeAtomicAddProperty(pset, writeback_conn->id(),
+                               writeback_conn->writeback_fb_id().id(), 0);
+      drmModeAtomicAddProperty(pset, writeback_conn->id(),
+                               writeback_conn->crtc_id_property().id(), 0);
+    }
+  }
+
+  ret = drmModeAtomicCommit(drm->fd(), pset, DRM_MODE_ATOMIC_ALLOW_MODESET, drm);
+  drmModeAtomicFree(pset);
   if (ret) {
-    ALOGE("Failed to add flatten scene");
+    ALOGE("Failed to commit flatten scene %d", ret);
     return ret;
   }
+  if (detach_only)
+    return -EAGAIN;
 
-  ApplyFrame(std::move(writeback_comp), 0, true);
+  AutoLock lock(&lock_, __func__);
+  ret = lock.Lock();
+  if (ret)
+    return ret;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  bFlattened_ = true;
+  iFlattenCnt_++;
+  iFlattenStartNs_ = ts.tv_sec * kOneSecondNs + ts.tv_nsec;
+  iFlattenSavingPerFrame_ = scene_bytes - flatten_bytes;
+  HWC2_ALOGD_IF_DEBUG("display=%d flatten %zu planes to %s, save %" PRIu64 " bytes/frame",
+                      display_, scene_planes.size(), flatten_plane->name(),
+                      iFlattenSavingPerFrame_);
   return 0;
 }
 
+// Must be called with lock_ held.
+void DrmDisplayCompositor::ExitFlatten() {
+  if (!bFlattened_)
+    return;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int64_t flatten_ns = ts.tv_sec * kOneSecondNs + ts.tv_nsec - iFlattenStartNs_;
+  iFlattenSavedBytes_ += flatten_ns / GetRefreshPeriodNs() * iFlattenSavingPerFrame_;
+  bFlattened_ = false;
+}
+
 // Flatten a scene by using a crtc which works concurrent with
 // the one driving the display.
 int DrmDisplayCompositor::FlattenConcurrent(DrmConnector *writeback_conn) {
@@ -2091,33 +2930,46 @@ int DrmDisplayCompositor::FlattenConcurrent(DrmConnector *writeback_conn) {
 }
 
 int DrmDisplayCompositor::FlattenActiveComposition() {
-  DrmConnector *writeback_conn = resource_manager_->AvailableWritebackConnector(
-      display_);
-  if (!active_composition_ || !writeback_conn) {
+  // WriteBack 模式占用了 WriteBack 连接, 不能同时 flatten.
+  if (resource_manager_->isWBMode())
+    return -EBUSY;
+
+  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  DrmConnector *writeback_conn = drm->GetWritebackConnectorForDisplay(display_);
+  DrmConnector *display_conn = drm->GetConnectorForDisplay(display_);
+  if (!writeback_conn || !display_conn ||
+      !writeback_conn->encoder() || !display_conn->encoder()) {
     ALOGV("No writeback connector available");
     return -EINVAL;
   }
 
-  if (writeback_conn->display() != display_) {
-    return FlattenConcurrent(writeback_conn);
-  } else {
-    return FlattenSerial(writeback_conn);
+  // Concurrent flatten needs a spare crtc and a copy of the scene, only the
+  // serial mode is used by the live composite path.
+  if (!writeback_conn->encoder()->CanClone(display_conn->encoder())) {
+    ALOGV("Writeback connector can't attach to display %d crtc", display_);
+    return -EINVAL;
   }
-
-  return 0;
+  return FlattenSerial(writeback_conn);
 }
 
 bool DrmDisplayCompositor::CountdownExpired() const {
   return flatten_countdown_ <= 0;
 }
 
+// 由合成线程空闲时调用, timestamp 为当前 CLOCK_MONOTONIC 时间.
 void DrmDisplayCompositor::Vsync(int display, int64_t timestamp) {
+  if (!bFlattenEnable_)
+    return;
   AutoLock lock(&lock_, __func__);
   if (lock.Lock())
     return;
-  flatten_countdown_--;
+  if (bFlattened_ || bFlattenTried_ || clear_ || last_timestamp_ < 0)
+    return;
+  flatten_countdown_ = iFlattenIdleVsync_ - (timestamp - last_timestamp_) / GetRefreshPeriodNs();
   if (!CountdownExpired())
     return;
+  // 每个静态场景只尝试一次.
+  bFlattenTried_ = true;
   lock.Unlock();
   int ret = FlattenActiveComposition();
   ALOGV("scene flattening triggered for display %d at timestamp %" PRIu64
@@ -2147,6 +2999,29 @@ void DrmDisplayCompositor::Dump(std::ostringstream *out) const {
   *out << "--DrmDisplayCompositor[" << display_
        << "]: num_frames=" << num_frames << " num_ms=" << num_ms
        << " fps=" << fps << "\n";
+  if (bLateLatch_)
+    *out << "  late-latch: margin=" << iLatchMarginNs_ / 1000
+         << "us cost=" << iCommitCostNs_ / 1000
+         << "us drop=" << iLateLatchDropCnt_
+         << " miss=" << iLateLatchMissCnt_ << "\n";
+  *out << "  commit: " << (bNonBlockCommit_ ? "nonblock" : "blocking")
+       << " flip_pending=" << bFlipPending_
+       << " fence=" << (bKernelOutFence_ ? "out_fence_ptr" : "sw_sync") << "\n";
+  if (bCursorFastPath_) {
+    std::lock_guard<std::mutex> cursor_lock(mCursorMutex_);
+    *out << "  cursor: planes=" << mapDisplayCursor_.size()
+         << " commits=" << iCursorCommitCnt_ << "\n";
+  }
+  if (bPlanTest_) {
+    std::lock_guard<std::mutex> plan_lock(mPlanCacheMutex_);
+    *out << "  plan-test: cache=" << mapPlanCache_.size() << "/" << iPlanCacheSize_
+         << " hit=" << iPlanCacheHitCnt_ << " miss=" << iPlanCacheMissCnt_
+         << " reject=" << iPlanRejectCnt_ << "\n";
+  }
+  if (bFlattenEnable_)
+    *out << "  flatten: active=" << bFlattened_ << " count=" << iFlattenCnt_
+         << " saving=" << iFlattenSavingPerFrame_ / 1024 << "KB/frame"
+         << " saved=" << iFlattenSavedBytes_ / (1024 * 1024) << "MB\n";
 
   dump_last_timestamp_ns_ = cur_ts;
 
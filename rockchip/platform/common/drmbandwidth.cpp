@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-bandwidth"
+
+#include "rockchip/platform/drmbandwidth.h"
+#include "rockchip/utils/drmdebug.h"
+#include "drmdevice.h"
+
+#include <drm_fourcc.h>
+#include <log/log.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef DRM_FORMAT_NV15
+#define DRM_FORMAT_NV15		fourcc_code('N', 'V', '1', '5')
+#endif
+#ifndef DRM_FORMAT_NV20
+#define DRM_FORMAT_NV20		fourcc_code('N', 'V', '2', '0')
+#endif
+#ifndef DRM_FORMAT_NV30
+#define DRM_FORMAT_NV30		fourcc_code('N', 'V', '3', '0')
+#endif
+
+namespace android {
+
+#define DMC_MAX_FREQ_PATH "/sys/class/devfreq/dmc/max_freq"
+// DDR 频点最多每秒重新读取一次
+#define DMC_FREQ_UPDATE_NS 1000000000LL
+#define MB (1000ULL * 1000ULL)
+
+struct BandwidthBudget{
+  uint32_t ddr_mhz;
+  uint32_t vop_mbps;
+};
+
+// VOP 可用读带宽，约为 DDR 理论带宽的 30%，其余留给 GPU/VPU/CPU
+static const BandwidthBudget kBudget3588[] = {
+  { 528,  2600 },
+  { 1068, 5300 },
+  { 1560, 7700 },
+  { 2112, 10400 },
+};
+
+static const BandwidthBudget kBudget356x[] = {
+  { 324,  780 },
+  { 528,  1260 },
+  { 780,  1870 },
+  { 1056, 2530 },
+  { 1560, 3740 },
+};
+
+static int64_t BandwidthNowNs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 每像素字节数 * 1000
+static uint32_t FormatBppMilli(uint32_t fourcc){
+  switch(fourcc){
+    case DRM_FORMAT_NV12:
+    case DRM_FORMAT_NV21:
+      return 1500;
+    case DRM_FORMAT_NV15:
+      return 1875;
+    case DRM_FORMAT_NV16:
+    case DRM_FORMAT_NV61:
+    case DRM_FORMAT_YUYV:
+    case DRM_FORMAT_YVYU:
+    case DRM_FORMAT_UYVY:
+    case DRM_FORMAT_VYUY:
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_BGR565:
+      return 2000;
+    case DRM_FORMAT_NV20:
+      return 2500;
+    case DRM_FORMAT_NV24:
+    case DRM_FORMAT_NV42:
+    case DRM_FORMAT_RGB888:
+    case DRM_FORMAT_BGR888:
+      return 3000;
+    case DRM_FORMAT_NV30:
+      return 3750;
+    default:
+      return 4000;
+  }
+}
+
+DrmBandwidth::DrmBandwidth()
+  : bEnable_(hwc_get_bool_property("vendor.hwc.bandwidth_check", BANDWIDTH_CHECK_DEFAULT)),
+    iAfbcRatio_(hwc_get_int_property("vendor.hwc.afbc_compress_ratio", AFBC_COMPRESS_RATIO_DEFAULT)),
+    uBudgetOverride_((uint64_t)hwc_get_int_property("vendor.hwc.vop_bandwidth_budget_mb", "0") * MB),
+    uSocId_(0),
+    uDdrFreqMHz_(0),
+    iDdrFreqUpdateNs_(0){
+  if(iAfbcRatio_ <= 0 || iAfbcRatio_ > 100)
+    iAfbcRatio_ = atoi(AFBC_COMPRESS_RATIO_DEFAULT);
+}
+
+uint32_t DrmBandwidth::GetDdrMaxFreqMHz(){
+  int64_t now = BandwidthNowNs();
+  if(iDdrFreqUpdateNs_ != 0 && now - iDdrFreqUpdateNs_ < DMC_FREQ_UPDATE_NS)
+    return uDdrFreqMHz_;
+  iDdrFreqUpdateNs_ = now;
+
+  FILE *fp = fopen(DMC_MAX_FREQ_PATH, "r");
+  if(fp == NULL){
+    uDdrFreqMHz_ = 0;
+    return uDdrFreqMHz_;
+  }
+  unsigned long long freq_hz = 0;
+  if(fscanf(fp, "%llu", &freq_hz) == 1)
+    uDdrFreqMHz_ = (uint32_t)(freq_hz / MB);
+  else
+    uDdrFreqMHz_ = 0;
+  fclose(fp);
+  return uDdrFreqMHz_;
+}
+
+uint64_t DrmBandwidth::Budget(uint32_t soc_id){
+  if(uBudgetOverride_ > 0)
+    return uBudgetOverride_;
+
+  const BandwidthBudget *table = NULL;
+  size_t size = 0;
+  if(isRK3588(soc_id)){
+    table = kBudget3588;
+    size = sizeof(kBudget3588) / sizeof(kBudget3588[0]);
+  }else if(isRK356x(soc_id)){
+    table = kBudget356x;
+    size = sizeof(kBudget356x) / sizeof(kBudget356x[0]);
+  }else{
+    return UINT64_MAX;
+  }
+
+  // 无法获取 DDR 频点时按最高频点计算
+  uint32_t freq = GetDdrMaxFreqMHz();
+  if(freq == 0)
+    return table[size - 1].vop_mbps * MB;
+
+  // 取不超过当前频点的最大档位，低于最低档位时按比例折算
+  if(freq < table[0].ddr_mhz)
+    return (uint64_t)table[0].vop_mbps * freq / table[0].ddr_mhz * MB;
+  uint32_t mbps = table[0].vop_mbps;
+  for(size_t i = 0; i < size; i++){
+    if(table[i].ddr_mhz <= freq)
+      mbps = table[i].vop_mbps;
+  }
+  return mbps * MB;
+}
+
+void DrmBandwidth::GetModeRate(DrmCrtc *crtc, uint64_t *line_rate, uint64_t *refresh){
+  // 取不到当前模式时按 1080p60 估算
+  *line_rate = 1125 * 60;
+  *refresh = 60;
+  DrmConnector *conn = crtc->getDrmDevice()->GetConnectorForDisplay(crtc->display());
+  if(conn){
+    const DrmMode &mode = conn->current_mode();
+    if(mode.v_total() > 0 && mode.v_refresh() > 0){
+      *line_rate = (uint64_t)(mode.v_total() * mode.v_refresh());
+      *refresh = (uint64_t)mode.v_refresh();
+    }
+  }
+}
+
+uint64_t DrmBandwidth::LayerBandwidth(DrmHwcLayer *layer, DrmCrtc *crtc){
+  int src_w = (int)(layer->source_crop.right - layer->source_crop.left);
+  int src_h = (int)(layer->source_crop.bottom - layer->source_crop.top);
+  int dst_h = layer->display_frame.bottom - layer->display_frame.top;
+  if(src_w <= 0 || src_h <= 0 || dst_h <= 0)
+    return 0;
+
+  uint64_t line_rate, refresh;
+  GetModeRate(crtc, &line_rate, &refresh);
+
+  uint64_t bw = (uint64_t)src_w * FormatBppMilli(layer->uFourccFormat_) / 1000;
+  bw = bw * line_rate * src_h / dst_h;
+  if(layer->bAfbcd_)
+    bw = bw * iAfbcRatio_ / 100;
+  return bw;
+}
+
+uint64_t DrmBandwidth::PlanBandwidth(std::vector<DrmHwcLayer*> &layers, DrmCrtc *crtc){
+  uint64_t total = 0;
+  for(auto &layer : layers){
+    uint64_t bw = LayerBandwidth(layer, crtc);
+    HWC2_ALOGD_IF_DEBUG(" bandwidth += %s %" PRIu64 "MB/s", layer->sLayerName_.c_str(), bw / MB);
+    total += bw;
+  }
+  return total;
+}
+
+uint64_t DrmBandwidth::PostProcessBandwidth(DrmHwcLayer *layer, DrmCrtc *crtc){
+  if(!layer->bUseRga_ && !layer->bUseSvep_)
+    return 0;
+  uint64_t line_rate, refresh;
+  GetModeRate(crtc, &line_rate, &refresh);
+  // RGA/SVEP 每帧读一次源数据、写一次目标数据，按当前 buffer 大小近似
+  uint64_t frame = (uint64_t)layer->iWidth_ * layer->iHeight_ *
+                   FormatBppMilli(layer->uFourccFormat_) / 1000;
+  return frame * 2 * refresh;
+}
+
+uint64_t DrmBandwidth::DisplayBandwidth(DrmCrtc *crtc){
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto it = mapDisplayBw_.find(crtc->display());
+  if(it == mapDisplayBw_.end())
+    return 0;
+  return it->second.uPlanBw_;
+}
+
+uint64_t DrmBandwidth::OtherDisplayBandwidth(int display){
+  uint64_t other = 0;
+  for(auto &map_bw : mapDisplayBw_){
+    if(map_bw.first != display)
+      other += map_bw.second.uPlanBw_;
+  }
+  return other;
+}
+
+int DrmBandwidth::CheckPlan(DrmCrtc *crtc, uint64_t plan_bw){
+  if(!bEnable_)
+    return 0;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  int display = crtc->display();
+  uSocId_ = crtc->getDrmDevice()->getSocId();
+  uint64_t budget = Budget(uSocId_);
+  uint64_t other = OtherDisplayBandwidth(display);
+  uint64_t remain = budget > other ? budget - other : 0;
+
+  BandwidthInfo &info = mapDisplayBw_[display];
+  info.uBudget_ = remain;
+  if(plan_bw > remain){
+    info.uRejectCnt_++;
+    HWC2_ALOGD_IF_DEBUG("display=%d plan bandwidth %" PRIu64 "MB/s > remain %" PRIu64 "MB/s (budget %" PRIu64 "MB/s)",
+                        display, plan_bw / MB, remain / MB, budget / MB);
+    return -1;
+  }
+  return 0;
+}
+
+void DrmBandwidth::UpdatePlan(DrmCrtc *crtc, uint64_t plan_bw){
+  std::lock_guard<std::mutex> lock(mtx_);
+  mapDisplayBw_[crtc->display()].uPlanBw_ = plan_bw;
+}
+
+void DrmBandwidth::ClearPlan(DrmCrtc *crtc){
+  std::lock_guard<std::mutex> lock(mtx_);
+  mapDisplayBw_.erase(crtc->display());
+}
+
+void DrmBandwidth::Dump(String8 &output){
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint64_t budget = Budget(uSocId_);
+  output.appendFormat("Bandwidth: check=%d ddr=%uMHz budget=%" PRIu64 "MB/s afbc-ratio=%d%%\n",
+                      bEnable_, uDdrFreqMHz_,
+                      budget == UINT64_MAX ? 0 : budget / MB, iAfbcRatio_);
+  for(auto &map_bw : mapDisplayBw_){
+    output.appendFormat("  display=%d plan=%" PRIu64 "MB/s remain=%" PRIu64 "MB/s reject=%u\n",
+                        map_bw.first, map_bw.second.uPlanBw_ / MB,
+                        map_bw.second.uBudget_ / MB, map_bw.second.uRejectCnt_);
+  }
+}
+
+} // namespace android
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-plane-balancer"
+
+#include "rockchip/platform/drmplanebalancer.h"
+#include "rockchip/utils/drmdebug.h"
+#include "drmdevice.h"
+#include "drmdisplaycomposition.h"
+
+#include <log/log.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+namespace android {
+
+#define MS_TO_NS(ms) ((int64_t)(ms) * 1000000LL)
+
+static int64_t BalancerNowNs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+DrmPlaneBalancer::DrmPlaneBalancer()
+  : bEnable_(hwc_get_bool_property("vendor.hwc.plane_balance", PLANE_BALANCE_DEFAULT)),
+    iWindow_(hwc_get_int_property("vendor.hwc.plane_balance_window", PLANE_BALANCE_WINDOW_DEFAULT)),
+    iHungryPercent_(hwc_get_int_property("vendor.hwc.plane_balance_hungry_percent",
+                                         PLANE_BALANCE_HUNGRY_PERCENT_DEFAULT)),
+    iCooldownNs_(MS_TO_NS(hwc_get_int_property("vendor.hwc.plane_balance_cooldown_ms",
+                                               PLANE_BALANCE_COOLDOWN_MS_DEFAULT))){
+  if(iWindow_ <= 0)
+    iWindow_ = atoi(PLANE_BALANCE_WINDOW_DEFAULT);
+  if(iHungryPercent_ <= 0 || iHungryPercent_ > 100)
+    iHungryPercent_ = atoi(PLANE_BALANCE_HUNGRY_PERCENT_DEFAULT);
+  if(iCooldownNs_ < 0)
+    iCooldownNs_ = MS_TO_NS(atoi(PLANE_BALANCE_COOLDOWN_MS_DEFAULT));
+}
+
+void DrmPlaneBalancer::Record(DrmCrtc *crtc, int layer_cnt, int gles_cnt, int owned, int used){
+  if(!bEnable_ || crtc == NULL)
+    return;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  DisplayLoad &load = mapDisplayLoad_[crtc->display()];
+  load.uCrtcMask_ = 1 << crtc->pipe();
+  load.iLastRecordNs_ = BalancerNowNs();
+  if(load.iFrameCnt_ == 0 || owned < load.iMinOwned_)
+    load.iMinOwned_ = owned;
+  if(used > load.iMaxUsed_)
+    load.iMaxUsed_ = used;
+  // 图层数多于可用 PlaneGroup 且存在 GLES 合成, 认为是 Plane 不足导致的回退
+  if(gles_cnt > 0 && layer_cnt > owned)
+    load.iGlesFrameCnt_++;
+  load.iFrameCnt_++;
+  if(load.iFrameCnt_ < iWindow_)
+    return;
+
+  bool hungry = load.iGlesFrameCnt_ * 100 >= load.iFrameCnt_ * iHungryPercent_;
+  load.iSpare_ = load.iMinOwned_ - load.iMaxUsed_;
+  // 供出一个 PlaneGroup 后仍至少保留一个空闲
+  bool idle = !hungry && load.iSpare_ >= 2;
+  load.iHungryWindow_ = hungry ? load.iHungryWindow_ + 1 : 0;
+  load.iIdleWindow_ = idle ? load.iIdleWindow_ + 1 : 0;
+
+  load.iFrameCnt_ = 0;
+  load.iGlesFrameCnt_ = 0;
+  load.iMaxUsed_ = 0;
+  load.iMinOwned_ = 0;
+}
+
+bool DrmPlaneBalancer::IsMigratable(PlaneGroup *plane_group, uint32_t soc_id){
+  // Cluster two-win 模式要求 win0/win1 在同一 CRTC, 只迁移 Esmart/Smart
+  if(isRK3588(soc_id))
+    return (plane_group->win_type & ~(uint64_t)PLANE_RK3588_ALL_ESMART_MASK) == 0;
+  if(isRK356x(soc_id))
+    return (plane_group->win_type & DRM_PLANE_TYPE_ALL_CLUSTER_MASK) == 0;
+  // RK3399 等平台各 VOP 独立, 不支持迁移
+  return false;
+}
+
+PlaneGroup *DrmPlaneBalancer::FindDonorGroup(DrmDevice *drm, int donor, uint32_t donor_mask,
+                                             uint32_t recv_mask, uint32_t soc_id){
+  PlaneGroup *candidate = NULL;
+  for(auto &plane_group : drm->GetPlaneGroups()){
+    if(plane_group->bReserved || plane_group->release_crtc_)
+      continue;
+    if(!(plane_group->current_crtc_ & donor_mask) ||
+       plane_group->possible_display_ != donor)
+      continue;
+    if(!(plane_group->possible_crtcs & recv_mask))
+      continue;
+    if(!IsMigratable(plane_group, soc_id))
+      continue;
+    // 优先选择供出方上一帧未使用的 PlaneGroup
+    if(!plane_group->bUse)
+      return plane_group;
+    if(candidate == NULL)
+      candidate = plane_group;
+  }
+  return candidate;
+}
+
+void DrmPlaneBalancer::CheckReleaseTimeout(int64_t now){
+  for(auto iter = vPendingRelease_.begin(); iter != vPendingRelease_.end();){
+    if(now - iter->iStartNs_ < MS_TO_NS(PLANE_BALANCE_RELEASE_TIMEOUT_MS)){
+      iter++;
+      continue;
+    }
+    // 旧 CRTC 长时间没有送显, 取消迁移, 归还给原 display
+    PlaneGroup *plane_group = iter->pPlaneGroup_;
+    plane_group->set_current_crtc(iter->uFromCrtcMask_, iter->iFromDisplay_);
+    plane_group->release_crtc_ = 0;
+    plane_group->release_display_ = -1;
+    HWC2_ALOGI("%s display=%d => display=%d release timeout, cancel migrate.",
+               plane_group->planes[0]->name(), iter->iFromDisplay_, iter->iToDisplay_);
+    iter = vPendingRelease_.erase(iter);
+  }
+}
+
+int DrmPlaneBalancer::Rebalance(DrmDevice *drm, DrmCrtc *crtc){
+  if(!bEnable_ || drm == NULL || crtc == NULL)
+    return -1;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  int64_t now = BalancerNowNs();
+  CheckReleaseTimeout(now);
+
+  // 同一时间只迁移一个 PlaneGroup
+  if(!vPendingRelease_.empty())
+    return -1;
+
+  int display = crtc->display();
+  auto recv_iter = mapDisplayLoad_.find(display);
+  if(recv_iter == mapDisplayLoad_.end())
+    return -1;
+  DisplayLoad &recv = recv_iter->second;
+  if(recv.iHungryWindow_ < PLANE_BALANCE_HOLD_WINDOWS || now < recv.iCooldownNs_)
+    return -1;
+
+  DrmConnector *recv_conn = drm->GetConnectorForDisplay(display);
+  if(!recv_conn || recv_conn->isHorizontalSpilt())
+    return -1;
+
+  uint32_t soc_id = drm->getSocId();
+  uint32_t recv_mask = 1 << crtc->pipe();
+  for(auto &map_load : mapDisplayLoad_){
+    int donor = map_load.first;
+    DisplayLoad &load = map_load.second;
+    if(donor == display || load.uCrtcMask_ == recv_mask)
+      continue;
+    if(load.iIdleWindow_ < PLANE_BALANCE_HOLD_WINDOWS || now < load.iCooldownNs_)
+      continue;
+    if(now - load.iLastRecordNs_ > MS_TO_NS(PLANE_BALANCE_ACTIVE_MS))
+      continue;
+    DrmConnector *donor_conn = drm->GetConnectorForDisplay(donor);
+    if(!donor_conn || donor_conn->isHorizontalSpilt())
+      continue;
+
+    PlaneGroup *plane_group = FindDonorGroup(drm, donor, load.uCrtcMask_, recv_mask, soc_id);
+    if(plane_group == NULL)
+      continue;
+
+    // 新 CRTC 在旧 CRTC 提交 disable 之前无法 acquire, 见 PlaneGroup::acquire()
+    plane_group->release_crtc_ = load.uCrtcMask_;
+    plane_group->release_display_ = donor;
+    plane_group->set_current_crtc(recv_mask, display);
+
+    PendingRelease pending;
+    pending.pPlaneGroup_ = plane_group;
+    pending.iFromDisplay_ = donor;
+    pending.uFromCrtcMask_ = load.uCrtcMask_;
+    pending.iToDisplay_ = display;
+    pending.uToCrtcMask_ = recv_mask;
+    pending.iStartNs_ = now;
+    vPendingRelease_.push_back(pending);
+
+    // 双方重新统计并进入冷却期
+    recv.iCooldownNs_ = load.iCooldownNs_ = now + iCooldownNs_;
+    recv.iHungryWindow_ = recv.iIdleWindow_ = 0;
+    load.iHungryWindow_ = load.iIdleWindow_ = 0;
+    recv.iFrameCnt_ = load.iFrameCnt_ = 0;
+    recv.iGlesFrameCnt_ = load.iGlesFrameCnt_ = 0;
+    recv.iMaxUsed_ = load.iMaxUsed_ = 0;
+    recv.uMigrateIn_++;
+    load.uMigrateOut_++;
+    HWC2_ALOGI("%s migrate display=%d crtc_mask=0x%x => display=%d crtc_mask=0x%x, spare=%d",
+               plane_group->planes[0]->name(), donor, load.uCrtcMask_,
+               display, recv_mask, load.iSpare_);
+    return donor;
+  }
+  return -1;
+}
+
+void DrmPlaneBalancer::CommitDone(DrmDisplayComposition *composition){
+  if(!bEnable_ || composition == NULL)
+    return;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  if(vPendingRelease_.empty())
+    return;
+
+  std::vector<DrmCompositionPlane> &comp_planes = composition->composition_planes();
+  for(auto iter = vPendingRelease_.begin(); iter != vPendingRelease_.end();){
+    if(iter->iFromDisplay_ != composition->display()){
+      iter++;
+      continue;
+    }
+    // 该 PlaneGroup 的所有 plane 都已在旧 CRTC 上提交 disable
+    bool released = true;
+    for(auto &plane : iter->pPlaneGroup_->planes){
+      bool disabled = false;
+      for(auto &comp_plane : comp_planes){
+        if(comp_plane.plane() == plane &&
+           comp_plane.type() == DrmCompositionPlane::Type::kDisable){
+          disabled = true;
+          break;
+        }
+      }
+      if(!disabled){
+        released = false;
+        break;
+      }
+    }
+    if(!released){
+      iter++;
+      continue;
+    }
+    iter->pPlaneGroup_->release_crtc_ = 0;
+    iter->pPlaneGroup_->release_display_ = -1;
+    HWC2_ALOGD_IF_DEBUG("%s released by display=%d, ready for display=%d",
+                        iter->pPlaneGroup_->planes[0]->name(),
+                        iter->iFromDisplay_, iter->iToDisplay_);
+    iter = vPendingRelease_.erase(iter);
+  }
+}
+
+void DrmPlaneBalancer::Reset(DrmDevice *drm){
+  if(!bEnable_ || drm == NULL)
+    return;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  for(auto &plane_group : drm->GetPlaneGroups()){
+    plane_group->release_crtc_ = 0;
+    plane_group->release_display_ = -1;
+  }
+  vPendingRelease_.clear();
+  mapDisplayLoad_.clear();
+}
+
+void DrmPlaneBalancer::Dump(String8 &output){
+  std::lock_guard<std::mutex> lock(mtx_);
+  output.appendFormat("PlaneBalancer: enable=%d window=%d hungry=%d%% cooldown=%" PRIi64 "ms pending=%zu\n",
+                      bEnable_, iWindow_, iHungryPercent_, iCooldownNs_ / 1000000,
+                      vPendingRelease_.size());
+  for(auto &map_load : mapDisplayLoad_){
+    const DisplayLoad &load = map_load.second;
+    output.appendFormat("  display=%d crtc_mask=0x%x spare=%d hungry=%d idle=%d in=%u out=%u\n",
+                        map_load.first, load.uCrtcMask_, load.iSpare_,
+                        load.iHungryWindow_, load.iIdleWindow_,
+                        load.uMigrateIn_, load.uMigrateOut_);
+  }
+  for(auto &pending : vPendingRelease_){
+    output.appendFormat("  releasing %s display=%d => display=%d\n",
+                        pending.pPlaneGroup_->planes[0]->name(),
+                        pending.iFromDisplay_, pending.iToDisplay_);
+  }
+}
+
+} // namespace android
@@ -25,6 +25,7 @@
 #include "rockchip/platform/drmhwc3399.h"
 #include "rockchip/platform/drmhwc356x.h"
 #include "rockchip/platform/drmhwc3588.h"
+#include "rockchip/platform/drmplanebalancer.h"
 
 #include <log/log.h>
 
@@ -74,6 +75,16 @@ std::tuple<int, std::vector<DrmCompositionPlane>> Planner::TryHwcPolicy(
   return std::make_tuple(ret, std::move(composition));
 }
 
+int Planner::RunDeferredJobs(std::vector<DrmHwcLayer> &layers) {
+  int ret = 0;
+  for (auto &i : stages_) {
+    ret = i->RunDeferredJobs(layers);
+    if (ret)
+      return ret;
+  }
+  return ret;
+}
+
 // HwcPlatform
 std::unique_ptr<HwcPlatform> HwcPlatform::CreateInstance(DrmDevice *drm_device) {
   std::unique_ptr<HwcPlatform> hwcPlatform(new HwcPlatform);
@@ -115,6 +126,8 @@ int HwcPlatform::TryAssignPlane(DrmDevice* drm){
       }
     }
   }
+  // PlaneGroup 重新分配, 之前的迁移状态失效
+  DrmPlaneBalancer::getInstance()->Reset(drm);
   return ret;
 }
 
@@ -49,6 +49,9 @@ void Vop3399::Init(){
 
   ctx.state.bMultiAreaScaleEnable = hwc_get_bool_property("vendor.hwc.multi_area_scale_mode","true");
 
+  // 调试用: CombineLayer 分组结果与旧实现交叉校验
+  ctx.state.bCombineLayerCheck = hwc_get_bool_property("vendor.hwc.combine_layer_check","false");
+
 }
 
 bool Vop3399::SupportPlatform(uint32_t soc_id){
@@ -160,7 +163,7 @@ bool Vop3399::IsRec1IntersectRec2(hwc_rect_t* rec1, hwc_rect_t* rec2){
     return false;
 }
 
-bool Vop3399::IsLayerCombine(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
+bool Vop3399::IsLayerCombineAttr(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
     if(!ctx.state.bMultiAreaEnable)
       return false;
 
@@ -171,8 +174,6 @@ bool Vop3399::IsLayerCombine(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
         || (layer_one->bAfbcd_ != layer_two->bAfbcd_)
         || layer_one->alpha!= layer_two->alpha
         || ((layer_one->bScale_ || layer_two->bScale_) && !ctx.state.bMultiAreaScaleEnable)
-        || IsRec1IntersectRec2(&layer_one->display_frame,&layer_two->display_frame)
-        || IsXIntersect(&layer_one->display_frame,&layer_two->display_frame)
         )
     {
         ALOGD_IF(LogLevel(DBG_DEBUG),"is_layer_combine layer one alpha=%d,is_scale=%d",layer_one->alpha,layer_one->bScale_);
@@ -183,7 +184,24 @@ bool Vop3399::IsLayerCombine(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
     return true;
 }
 
-int Vop3399::CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers,uint32_t iPlaneSize){
+bool Vop3399::IsLayerCombine(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
+    if(!IsLayerCombineAttr(layer_one,layer_two))
+        return false;
+
+    if(IsRec1IntersectRec2(&layer_one->display_frame,&layer_two->display_frame)
+        || IsXIntersect(&layer_one->display_frame,&layer_two->display_frame))
+    {
+        ALOGD_IF(LogLevel(DBG_DEBUG),"is_layer_combine layer one id=%d and layer two id=%d intersect",
+                 layer_one->uId_,layer_two->uId_);
+        return false;
+    }
+
+    return true;
+}
+
+// 重构前的分组实现, 仅用于 vendor.hwc.combine_layer_check 交叉校验.
+// 去掉了原实现开头的 bUse_ 判断: bUse_ 恒为 true, 为 false 时原实现不会推进 i.
+void Vop3399::CombineLayerLegacy(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers){
 
     /*Group layer*/
     int zpos = 0;
@@ -194,9 +212,6 @@ int Vop3399::CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers,
     layer_map.clear();
 
     for (i = 0; i < layers.size(); ) {
-        if(!layers[i]->bUse_)
-            continue;
-
         sort_cnt=0;
         if(i == 0)
         {
@@ -308,7 +323,76 @@ int Vop3399::CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers,
             }
         }
   }
+}
+
+int Vop3399::CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers,uint32_t iPlaneSize){
+
+  /*Group layer*/
+  // 按 zpos 顺序分组：图层与当前组内所有图层都能合并时加入该组，否则新建一组。
+  // 可合并的图层在垂直方向互不重叠，组内按 display_frame.top 有序保存，
+  // 新图层只需与上下相邻的两个图层比较，整体复杂度 O(n log n)。
+  int zpos = 0;
+  std::map<int, DrmHwcLayer*> group;
+  // 组内存在高度 <= 0 的图层时，相邻比较不再成立，退回逐个比较
+  bool group_degenerate = false;
 
+  layer_map.clear();
+
+  for(auto &layer : layers){
+    bool is_combine = !group.empty() && IsLayerCombineAttr(layer, group.begin()->second);
+    if(is_combine){
+      if(group_degenerate || layer->display_frame.bottom <= layer->display_frame.top){
+        for(auto &item : group){
+          if(!IsLayerCombine(layer, item.second)){
+            is_combine = false;
+            break;
+          }
+        }
+      }else{
+        auto next = group.lower_bound(layer->display_frame.top);
+        if(next != group.end() && !IsLayerCombine(layer, next->second))
+          is_combine = false;
+        else if(next != group.begin() && !IsLayerCombine(layer, std::prev(next)->second))
+          is_combine = false;
+      }
+    }
+
+    //if it cann't combine with current group, it need start a new group.
+    if(!is_combine && !group.empty()){
+      // RK356x sort layer by ypos
+      for(auto &item : group)
+        layer_map[zpos].push_back(item.second);
+      zpos++;
+      group.clear();
+      group_degenerate = false;
+    }
+
+    group[layer->display_frame.top] = layer;
+    if(layer->display_frame.bottom <= layer->display_frame.top)
+      group_degenerate = true;
+  }
+  for(auto &item : group)
+    layer_map[zpos].push_back(item.second);
+
+  if(ctx.state.bCombineLayerCheck){
+    LayerMap legacy_map;
+    CombineLayerLegacy(legacy_map, layers);
+    if(legacy_map != layer_map){
+      std::string new_groups, legacy_groups;
+      for(auto &iter : layer_map){
+        new_groups += " " + std::to_string(iter.first) + ":";
+        for(auto &layer : iter.second)
+          new_groups += std::to_string(layer->uId_) + ",";
+      }
+      for(auto &iter : legacy_map){
+        legacy_groups += " " + std::to_string(iter.first) + ":";
+        for(auto &layer : iter.second)
+          legacy_groups += std::to_string(layer->uId_) + ",";
+      }
+      ALOGE("CombineLayer mismatch, layers=%zu new=[%s ] legacy=[%s ]",
+            layers.size(), new_groups.c_str(), legacy_groups.c_str());
+    }
+  }
 
   for (LayerMap::iterator iter = layer_map.begin();
        iter != layer_map.end(); ++iter) {
@@ -1611,9 +1695,15 @@ bool Vop3399::CheckGLESLayer(DrmHwcLayer *layer){
   }
 
   switch(layer->sf_composition){
+    case HWC2::Composition::SolidColor:
+      // 已替换为填充 buffer 的 SolidColor 图层按普通图层处理
+      if(layer->bSolidColor_)
+        break;
+      HWC2_ALOGD_IF_DEBUG("[%s]：sf_composition =0x%x not support overlay.",
+              layer->sLayerName_.c_str(),layer->sf_composition);
+      return true;
     case HWC2::Composition::Client:
     case HWC2::Composition::Sideband:
-    case HWC2::Composition::SolidColor:
       HWC2_ALOGD_IF_DEBUG("[%s]：sf_composition =0x%x not support overlay.",
               layer->sLayerName_.c_str(),layer->sf_composition);
       return true;
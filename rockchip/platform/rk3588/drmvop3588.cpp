@@ -37,6 +37,7 @@
 #define LOG_TAG "drm-vop-3588"
 
 #include "rockchip/platform/drmvop3588.h"
+#include "rockchip/platform/drmbandwidth.h"
 #include "drmdevice.h"
 
 #include "im2d.hpp"
@@ -46,6 +47,9 @@
 
 //XML prase
 #include <tinyxml2.h>
+#include <sync/sync.h>
+#include <unistd.h>
+#include <algorithm>
 namespace android {
 
 #define ALIGN_DOWN( value, base)	(value & (~(base-1)) )
@@ -59,11 +63,28 @@ void Vop3588::Init(){
 
   ctx.state.bMultiAreaScaleEnable = hwc_get_bool_property("vendor.hwc.multi_area_scale_mode","true");
 
+  // 调试用: CombineLayer 分组结果与旧实现交叉校验
+  ctx.state.bCombineLayerCheck = hwc_get_bool_property("vendor.hwc.combine_layer_check","false");
+
   ctx.state.bRgaPolicyEnable = hwc_get_int_property("vendor.hwc.enable_rga_policy","0") > 0;
 
+  ctx.state.bRgaComposeEnable = hwc_get_int_property("vendor.hwc.enable_rga_compose_policy","0") > 0;
+
+  ctx.state.iRgaComposeMaxCnt = hwc_get_int_property("vendor.hwc.rga_compose_max_layers",RGA_COMPOSE_MAX_LAYERS);
+
+  ctx.state.bRgaTransformEnable = hwc_get_int_property("vendor.hwc.rga_transform_offload",RGA_TRANSFORM_OFFLOAD_DEFAULT) > 0;
+
   ctx.state.iVopMaxOverlay4KPlane = hwc_get_int_property("vendor.hwc.vop_max_overlay_4k_plane","0");
 
 #ifdef USE_LIBSVEP
+  iSvepSlot_ = 0;
+  iLastSvepMode_ = 0;
+  uLastSvepBufferId_ = 0;
+  iLastEnhancementRate_ = 0;
+  iLastContrastMode_ = 0;
+  iLastContrastOffset_ = 0;
+  iSvepMissCnt_ = 0;
+  iSvepFallbackCnt_ = 0;
   InitSvep();
 #endif
 }
@@ -154,6 +175,18 @@ int Vop3588::InitSvep(){
   return 0;
 }
 
+// 上下文上一次的任务还未完成
+bool Vop3588::SvepSlotBusy(const SvepJobSlot &slot){
+  if(slot.pOutput_ == NULL)
+    return false;
+  int fence = slot.pOutput_->GetFinishFence();
+  if(fence < 0)
+    return false;
+  int ret = sync_wait(fence, 0);
+  close(fence);
+  return ret != 0;
+}
+
 bool Vop3588::SvepAllowedByBlacklist(DrmHwcLayer* layer){
   if(mSvepEnv_.mValid){
     // 此黑名单内的应用名不参与 SVEP 处理
@@ -253,6 +286,8 @@ int Vop3588::TryHwcPolicy(
     DrmCrtc *crtc,
     bool gles_policy) {
   int ret;
+  // 上一次 Validate 未送显的 RGA 任务作废
+  DropRgaComposePending();
   // Get PlaneGroup
   if(plane_groups.size()==0){
     ALOGE("%s,line=%d can't get plane_groups size=%zu",__FUNCTION__,__LINE__,plane_groups.size());
@@ -286,6 +321,16 @@ int Vop3588::TryHwcPolicy(
     }
   }
 
+  // Try to match rga compose policy
+  if(ctx.state.setHwcPolicy.count(HWC_RGA_COMPOSE_LOPICY)){
+    ret = TryRgaComposePolicy(composition,layers,crtc,plane_groups);
+    if(!ret)
+      return 0;
+    else{
+      ALOGD_IF(LogLevel(DBG_DEBUG),"Match rga compose policy fail, try to match other policy.");
+    }
+  }
+
   // Try to match mix policy
   if(ctx.state.setHwcPolicy.count(HWC_MIX_LOPICY)){
     ret = TryMixPolicy(composition,layers,crtc,plane_groups);
@@ -364,7 +409,7 @@ bool Vop3588::IsRec1IntersectRec2(hwc_rect_t* rec1, hwc_rect_t* rec2){
     return false;
 }
 
-bool Vop3588::IsLayerCombine(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
+bool Vop3588::IsLayerCombineAttr(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
     if(!ctx.state.bMultiAreaEnable)
       return false;
 
@@ -379,8 +424,6 @@ bool Vop3588::IsLayerCombine(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
         || (layer_one->bAfbcd_ != layer_two->bAfbcd_)
         || layer_one->alpha!= layer_two->alpha
         || ((layer_one->bScale_ || layer_two->bScale_) && !ctx.state.bMultiAreaScaleEnable)
-        || IsRec1IntersectRec2(&layer_one->display_frame,&layer_two->display_frame)
-        || IsXIntersect(&layer_one->display_frame,&layer_two->display_frame)
         )
     {
         ALOGD_IF(LogLevel(DBG_DEBUG),"is_layer_combine layer one alpha=%d,is_scale=%d",layer_one->alpha,layer_one->bScale_);
@@ -391,7 +434,24 @@ bool Vop3588::IsLayerCombine(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
     return true;
 }
 
-int Vop3588::CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers,uint32_t iPlaneSize){
+bool Vop3588::IsLayerCombine(DrmHwcLayer * layer_one,DrmHwcLayer * layer_two){
+    if(!IsLayerCombineAttr(layer_one,layer_two))
+        return false;
+
+    if(IsRec1IntersectRec2(&layer_one->display_frame,&layer_two->display_frame)
+        || IsXIntersect(&layer_one->display_frame,&layer_two->display_frame))
+    {
+        ALOGD_IF(LogLevel(DBG_DEBUG),"is_layer_combine layer one id=%d and layer two id=%d intersect",
+                 layer_one->uId_,layer_two->uId_);
+        return false;
+    }
+
+    return true;
+}
+
+// 重构前的分组实现, 仅用于 vendor.hwc.combine_layer_check 交叉校验.
+// 去掉了原实现开头的 bUse_ 判断: bUse_ 恒为 true, 为 false 时原实现不会推进 i.
+void Vop3588::CombineLayerLegacy(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers){
 
     /*Group layer*/
     int zpos = 0;
@@ -402,9 +462,6 @@ int Vop3588::CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers,
     layer_map.clear();
 
     for (i = 0; i < layers.size(); ) {
-        if(!layers[i]->bUse_)
-            continue;
-
         sort_cnt=0;
         if(i == 0)
         {
@@ -516,7 +573,76 @@ int Vop3588::CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers,
             }
         }
   }
+}
+
+int Vop3588::CombineLayer(LayerMap& layer_map,std::vector<DrmHwcLayer*> &layers,uint32_t iPlaneSize){
 
+  /*Group layer*/
+  // 按 zpos 顺序分组：图层与当前组内所有图层都能合并时加入该组，否则新建一组。
+  // 可合并的图层在垂直方向互不重叠，组内按 display_frame.top 有序保存，
+  // 新图层只需与上下相邻的两个图层比较，整体复杂度 O(n log n)。
+  int zpos = 0;
+  std::map<int, DrmHwcLayer*> group;
+  // 组内存在高度 <= 0 的图层时，相邻比较不再成立，退回逐个比较
+  bool group_degenerate = false;
+
+  layer_map.clear();
+
+  for(auto &layer : layers){
+    bool is_combine = !group.empty() && IsLayerCombineAttr(layer, group.begin()->second);
+    if(is_combine){
+      if(group_degenerate || layer->display_frame.bottom <= layer->display_frame.top){
+        for(auto &item : group){
+          if(!IsLayerCombine(layer, item.second)){
+            is_combine = false;
+            break;
+          }
+        }
+      }else{
+        auto next = group.lower_bound(layer->display_frame.top);
+        if(next != group.end() && !IsLayerCombine(layer, next->second))
+          is_combine = false;
+        else if(next != group.begin() && !IsLayerCombine(layer, std::prev(next)->second))
+          is_combine = false;
+      }
+    }
+
+    //if it cann't combine with current group, it need start a new group.
+    if(!is_combine && !group.empty()){
+      // RK3588 sort layer by ypos
+      for(auto &item : group)
+        layer_map[zpos].push_back(item.second);
+      zpos++;
+      group.clear();
+      group_degenerate = false;
+    }
+
+    group[layer->display_frame.top] = layer;
+    if(layer->display_frame.bottom <= layer->display_frame.top)
+      group_degenerate = true;
+  }
+  for(auto &item : group)
+    layer_map[zpos].push_back(item.second);
+
+  if(ctx.state.bCombineLayerCheck){
+    LayerMap legacy_map;
+    CombineLayerLegacy(legacy_map, layers);
+    if(legacy_map != layer_map){
+      std::string new_groups, legacy_groups;
+      for(auto &iter : layer_map){
+        new_groups += " " + std::to_string(iter.first) + ":";
+        for(auto &layer : iter.second)
+          new_groups += std::to_string(layer->uId_) + ",";
+      }
+      for(auto &iter : legacy_map){
+        legacy_groups += " " + std::to_string(iter.first) + ":";
+        for(auto &layer : iter.second)
+          legacy_groups += std::to_string(layer->uId_) + ",";
+      }
+      ALOGE("CombineLayer mismatch, layers=%zu new=[%s ] legacy=[%s ]",
+            layers.size(), new_groups.c_str(), legacy_groups.c_str());
+    }
+  }
 
   for (LayerMap::iterator iter = layer_map.begin();
        iter != layer_map.end(); ++iter) {
@@ -845,6 +971,18 @@ int Vop3588::MatchPlane(std::vector<DrmCompositionPlane> *composition_planes,
                             }
                           }
 
+                          // 能力位图预筛，FB-Target 可反转AFBC，两种格式位图都可接受
+                          uint64_t format_mask = (*iter_plane)->get_format_mask((*iter_layer)->bAfbcd_);
+                          if((*iter_layer)->bFbTarget_)
+                            format_mask |= (*iter_plane)->get_format_mask(!(*iter_layer)->bAfbcd_);
+                          if(!(*iter_plane)->is_caps_match((*iter_layer)->uPlaneFormatBit_, format_mask,
+                                                           (*iter_layer)->uPlaneCapsReq_, (*iter_layer)->transform)){
+                            ALOGD_IF(LogLevel(DBG_DEBUG),"%s caps mismatch fourcc=0x%x afbcd=%d req=0x%x transform=0x%x",
+                                     (*iter_plane)->name(),(*iter_layer)->uFourccFormat_,(*iter_layer)->bAfbcd_,
+                                     (*iter_layer)->uPlaneCapsReq_,(*iter_layer)->transform);
+                            continue;
+                          }
+
                           // Format
                           if((*iter_plane)->is_support_format((*iter_layer)->uFourccFormat_,(*iter_layer)->bAfbcd_)){
                             bNeed = true;
@@ -1196,7 +1334,7 @@ int Vop3588::MatchPlanes(
     }
     zpos++;
 
-    // 总数据量超过，iVopMaxOverlay4KPlane 层 4K RGBA 图层，则认为匹配失败。
+    // 兼容旧配置：显式设置 iVopMaxOverlay4KPlane 时仍按 4K RGBA 图层数限制
     if(ctx.state.iVopMaxOverlay4KPlane > 0 ){
       for( auto layer : i->second){
         if(layer->iSize_ > 0){
@@ -1213,6 +1351,27 @@ int Vop3588::MatchPlanes(
       }
     }
   }
+
+  // 按 DDR 带宽模型评估方案，超出预算则认为匹配失败
+  std::vector<DrmHwcLayer*> match_layers;
+  bool fb_target_only = true;
+  for(auto &layer : layers){
+    if(!layer->bMatch_)
+      continue;
+    match_layers.push_back(layer);
+    if(!layer->bFbTarget_)
+      fb_target_only = false;
+  }
+  DrmBandwidth *bandwidth = DrmBandwidth::getInstance();
+  uint64_t plan_bw = bandwidth->PlanBandwidth(match_layers, crtc);
+  // 仅 FB-target 的 GLES 方案是最后的回退, 不受带宽预算限制
+  if(!fb_target_only && bandwidth->CheckPlan(crtc, plan_bw)){
+    ResetLayer(layers);
+    ResetPlaneGroups(plane_groups);
+    composition->clear();
+    return -1;
+  }
+  bandwidth->UpdatePlan(crtc, plan_bw);
   return 0;
 }
 int  Vop3588::GetPlaneGroups(DrmCrtc *crtc, std::vector<PlaneGroup *>&out_plane_groups){
@@ -1358,6 +1517,343 @@ int Vop3588::TryOverlayPolicy(
   return 0;
 }
 
+// SF transform 转换为 im2d usage
+static int RgaTransformUsage(uint32_t transform){
+  int usage = 0;
+  switch(transform){
+  case DRM_MODE_ROTATE_0:
+    usage = 0;
+    break;
+  case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_X :
+    usage = IM_HAL_TRANSFORM_FLIP_H;
+    break;
+  case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_Y:
+    usage = IM_HAL_TRANSFORM_FLIP_V;
+    break;
+  case DRM_MODE_ROTATE_90:
+    usage = IM_HAL_TRANSFORM_ROT_90;
+    break;
+  case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_X | DRM_MODE_REFLECT_Y:
+    usage = IM_HAL_TRANSFORM_ROT_180;
+    break;
+  case DRM_MODE_ROTATE_270:
+    usage = IM_HAL_TRANSFORM_ROT_270;
+    break;
+  case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_X | DRM_MODE_ROTATE_90 :
+    usage = IM_HAL_TRANSFORM_FLIP_H | IM_HAL_TRANSFORM_ROT_90;
+    break;
+  case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_Y | DRM_MODE_ROTATE_90:
+    usage = IM_HAL_TRANSFORM_FLIP_V | IM_HAL_TRANSFORM_ROT_90;
+    break;
+  default:
+    usage = 0;
+    ALOGE_IF(LogLevel(DBG_DEBUG),"Unknow sf transform 0x%x", transform);
+  }
+  return usage;
+}
+
+static void RgaFillSrcBuffer(DrmHwcLayer *layer, rga_buffer_t *src){
+  src->fd      = layer->iFd_;
+  src->width   = layer->iWidth_;
+  src->height  = layer->iHeight_;
+  src->hstride = layer->iHeightStride_;
+  src->format  = layer->iFormat_;
+
+  // RGA 的特殊修改，需要通过 wstride
+  if(layer->uFourccFormat_ == DRM_FORMAT_NV15)
+    src->wstride = layer->iByteStride_;
+  else
+    src->wstride = layer->iStride_;
+
+  if(layer->iFormat_ == HAL_PIXEL_FORMAT_YUV420_8BIT_I){
+    src->format = HAL_PIXEL_FORMAT_YCrCb_NV12;
+  }else if(layer->iFormat_ == HAL_PIXEL_FORMAT_YUV420_10BIT_I){
+    src->format = HAL_PIXEL_FORMAT_YCrCb_NV12_10;
+  }
+
+  // AFBC format
+  if(layer->bAfbcd_)
+    src->rd_mode = IM_FBC_MODE;
+}
+
+bool Vop3588::PlaneSupportLayer(DrmHwcLayer *layer,
+                                std::vector<PlaneGroup *> &plane_groups,
+                                DrmCrtc *crtc,
+                                bool *format_support){
+  *format_support = false;
+  for(auto &plane_group : plane_groups){
+    for(auto &p : plane_group->planes){
+      if(p->is_support_format(layer->uFourccFormat_, layer->bAfbcd_)){
+        *format_support = true;
+        break;
+      }
+    }
+    if(*format_support)
+      break;
+  }
+  if(!*format_support)
+    return false;
+
+  // 单图层试匹配, 限制条件以 MatchPlane 为准; 试匹配会改写 Cluster 状态, 结束后恢复
+  std::vector<DrmCompositionPlane> composition;
+  std::vector<DrmHwcLayer*> match_layers(1, layer);
+  auto state = ctx.state;
+  ResetPlaneGroups(plane_groups);
+  int ret = MatchPlane(&composition, plane_groups, DrmCompositionPlane::Type::kLayer,
+                       crtc, std::make_pair(0, match_layers), 0);
+  ResetLayer(match_layers);
+  ResetPlaneGroups(plane_groups);
+  ctx.state = state;
+  return ret == 0;
+}
+
+bool Vop3588::RgaTransformAllowed(DrmHwcLayer *layer,
+                                  std::vector<PlaneGroup *> &plane_groups){
+  if(layer->bFbTarget_ || layer->bSkipLayer_ || layer->bGlesCompose_ ||
+     layer->bSidebandStreamLayer_ || layer->bSolidColor_ || layer->bCursor_)
+    return false;
+
+  if(layer->iFd_ <= 0)
+    return false;
+
+  if(layer->iWidth_ > RGA_MAX_INPUT_WIDTH)
+    return false;
+
+  // RGA 有缩放倍数限制
+  if(layer->fHScaleMul_ < 0.125 || layer->fHScaleMul_ > 8.0 ||
+     layer->fVScaleMul_ < 0.125 || layer->fVScaleMul_ > 8.0)
+    return false;
+
+  int crop_w = (int)(layer->source_crop.right - layer->source_crop.left);
+  // 限制同 TryRgaOverlayPolicy
+  if(layer->bAfbcd_ && crop_w != layer->iStride_)
+    return false;
+
+  // 只处理 RGA 能解决的问题: 旋转/镜像, 或缩放倍数/输入宽度超出所有 plane 能力.
+  // 其他原因 (alpha/HDR/输出尺寸等) 导致的匹配失败, RGA 预处理后仍无法 overlay.
+  if(layer->transform != DRM_MODE_ROTATE_0)
+    return true;
+
+  for(auto &plane_group : plane_groups){
+    if(plane_group->bReserved)
+      continue;
+    for(auto &p : plane_group->planes){
+      if(!p->is_support_format(layer->uFourccFormat_, layer->bAfbcd_))
+        continue;
+      if(p->is_support_scale(layer->fHScaleMul_) && p->is_support_scale(layer->fVScaleMul_) &&
+         crop_w <= p->get_caps().input_w_max)
+        return false;
+    }
+  }
+  return true;
+}
+
+/*************************RGA transform*************************
+  图层仅因旋转/镜像、缩放倍数或宽度超出 DrmPlane 能力而无法 overlay 时，
+  先由 RGA 按 display_frame 尺寸处理成 ROTATE_0 且无缩放的 buffer，再参与策略匹配。
+  源 buffer 及参数不变时直接复用上一次的输出。
+************************************************************/
+int Vop3588::TryRgaTransformOffload(std::vector<DrmHwcLayer*> &layers,
+                                    std::vector<PlaneGroup *> &plane_groups,
+                                    DrmCrtc *crtc){
+  // 每个 Vop3588 只服务一个显示, 其他 crtc 的缓存在本次处理结束后一并释放
+  uint64_t crtc_key = (uint64_t)crtc->id() << 32;
+  for(auto &cache : mapRgaTransform_)
+    cache.second.bActive_ = false;
+
+  int offload_cnt = 0;
+  int cache_cnt = 0;
+  for(auto &layer : layers){
+    if(!ctx.state.bRgaTransformEnable)
+      break;
+
+    if(!RgaTransformAllowed(layer, plane_groups))
+      continue;
+
+#ifdef USE_LIBSVEP
+    // 视频图层优先由 SVEP 处理
+    if(layer->bYuv_ && ctx.state.setHwcPolicy.count(HWC_SVEP_OVERLAY_LOPICY))
+      continue;
+#endif
+
+    bool format_support = false;
+    if(PlaneSupportLayer(layer, plane_groups, crtc, &format_support) || !format_support)
+      continue;
+
+    int dst_w = layer->display_frame.right  - layer->display_frame.left;
+    int dst_h = layer->display_frame.bottom - layer->display_frame.top;
+    int format = HAL_PIXEL_FORMAT_RGBA_8888;
+    uint64_t usage = RK_GRALLOC_USAGE_WITHIN_4G | MALI_GRALLOC_USAGE_NO_AFBC;
+    if(layer->bYuv_){
+      dst_w = ALIGN_DOWN(dst_w, 2);
+      dst_h = ALIGN_DOWN(dst_h, 2);
+      if(layer->iFormat_ == HAL_PIXEL_FORMAT_YUV420_10BIT_I ||
+         layer->iFormat_ == HAL_PIXEL_FORMAT_YCrCb_NV12_10){
+        // RGA 内部特殊修改，需要满足byte_stride 64对齐
+        format = HAL_PIXEL_FORMAT_YCrCb_NV12_10;
+        usage = RK_GRALLOC_USAGE_STRIDE_ALIGN_64 | MALI_GRALLOC_USAGE_NO_AFBC;
+      }else{
+        format = HAL_PIXEL_FORMAT_YCrCb_NV12;
+        usage = RK_GRALLOC_USAGE_STRIDE_ALIGN_16 | MALI_GRALLOC_USAGE_NO_AFBC;
+      }
+    }
+    if(dst_w < 4 || dst_h < 4)
+      continue;
+
+    if(cache_cnt >= RGA_TRANSFORM_MAX_LAYERS){
+      HWC2_ALOGD_IF_DEBUG("rga transform cache full, skip layer-id=%d.", layer->uId_);
+      break;
+    }
+    cache_cnt++;
+
+    RgaTransformCache &cache = mapRgaTransform_[crtc_key | layer->uId_];
+    if(cache.bufferQueue_ == NULL)
+      cache.bufferQueue_ = std::make_shared<DrmBufferQueue>();
+    cache.bActive_ = true;
+
+    bool reuse = cache.uSrcBufferId_ == layer->uBufferId_ &&
+                 cache.uTransform_   == layer->transform &&
+                 cache.iDstWidth_    == dst_w &&
+                 cache.iDstHeight_   == dst_h &&
+                 cache.mSrcCrop_.left   == layer->source_crop.left &&
+                 cache.mSrcCrop_.top    == layer->source_crop.top &&
+                 cache.mSrcCrop_.right  == layer->source_crop.right &&
+                 cache.mSrcCrop_.bottom == layer->source_crop.bottom;
+
+    std::shared_ptr<DrmBuffer> dst_buffer;
+    int releaseFence = -1;
+    if(reuse)
+      dst_buffer = cache.bufferQueue_->BackDrmBuffer();
+
+    if(dst_buffer != NULL){
+      releaseFence = dst_buffer->GetFinishFence();
+    }else{
+      dst_buffer = cache.bufferQueue_->DequeueDrmBuffer(dst_w, dst_h, format, usage, "RGA-Transform");
+      if(dst_buffer == NULL){
+        HWC2_ALOGD_IF_DEBUG("DequeueDrmBuffer fail!, skip layer-id=%d.", layer->uId_);
+        continue;
+      }
+
+      rga_buffer_t src;
+      rga_buffer_t dst;
+      rga_buffer_t pat;
+      im_rect src_rect;
+      im_rect dst_rect;
+      im_rect pat_rect;
+      memset(&src, 0, sizeof(rga_buffer_t));
+      memset(&dst, 0, sizeof(rga_buffer_t));
+      memset(&pat, 0, sizeof(rga_buffer_t));
+      memset(&src_rect, 0, sizeof(im_rect));
+      memset(&dst_rect, 0, sizeof(im_rect));
+      memset(&pat_rect, 0, sizeof(im_rect));
+
+      RgaFillSrcBuffer(layer, &src);
+      src_rect.x      = (int)layer->source_crop.left;
+      src_rect.y      = (int)layer->source_crop.top;
+      src_rect.width  = (int)(layer->source_crop.right  - layer->source_crop.left);
+      src_rect.height = (int)(layer->source_crop.bottom - layer->source_crop.top);
+      if(layer->bYuv_){
+        src_rect.x      = ALIGN_DOWN(src_rect.x, 2);
+        src_rect.y      = ALIGN_DOWN(src_rect.y, 2);
+        src_rect.width  = ALIGN_DOWN(src_rect.width, 2);
+        src_rect.height = ALIGN_DOWN(src_rect.height, 2);
+      }
+
+      dst.fd      = dst_buffer->GetFd();
+      dst.width   = dst_buffer->GetWidth();
+      dst.height  = dst_buffer->GetHeight();
+      // RGA 的特殊修改，需要通过 wstride
+      if(dst_buffer->GetFourccFormat() == DRM_FORMAT_NV15)
+        dst.wstride = dst_buffer->GetByteStride();
+      else
+        dst.wstride = dst_buffer->GetStride();
+      dst.hstride = dst_buffer->GetHeightStride();
+      dst.format  = dst_buffer->GetFormat();
+
+      dst_rect.x      = 0;
+      dst_rect.y      = 0;
+      dst_rect.width  = dst_w;
+      dst_rect.height = dst_h;
+
+      int im_usage = RgaTransformUsage(layer->transform);
+      IM_STATUS im_state = imcheck_t(src, dst, pat, src_rect, dst_rect, pat_rect, im_usage | IM_ASYNC);
+      if(im_state != IM_STATUS_NOERROR){
+        HWC2_ALOGD_IF_DEBUG("imcheck fail, %s layer-id=%d",imStrError(im_state), layer->uId_);
+        cache.bufferQueue_->QueueBuffer(dst_buffer);
+        cache.uSrcBufferId_ = 0;
+        continue;
+      }
+
+      int acquireFence = -1;
+      if(layer->acquire_fence->isValid())
+        acquireFence = dup(layer->acquire_fence->getFd());
+
+      im_opt_t imOpt;
+      memset(&imOpt, 0x00, sizeof(im_opt_t));
+      im_state = improcess(src, dst, pat, src_rect, dst_rect, pat_rect,
+                           acquireFence, &releaseFence, &imOpt, im_usage | IM_ASYNC);
+      if(acquireFence >= 0)
+        close(acquireFence);
+      if(im_state != IM_STATUS_SUCCESS){
+        HWC2_ALOGE("call im2d transform fail, %s layer-id=%d",imStrError(im_state), layer->uId_);
+        cache.bufferQueue_->QueueBuffer(dst_buffer);
+        cache.uSrcBufferId_ = 0;
+        continue;
+      }
+      dst_buffer->SetFinishFence(dup(releaseFence));
+      cache.bufferQueue_->QueueBuffer(dst_buffer);
+
+      cache.uSrcBufferId_ = layer->uBufferId_;
+      cache.uTransform_   = layer->transform;
+      cache.mSrcCrop_     = layer->source_crop;
+      cache.iDstWidth_    = dst_w;
+      cache.iDstHeight_   = dst_h;
+    }
+
+    HWC2_ALOGD_IF_DEBUG("rga transform layer-id=%d transform=0x%x scale=(%f,%f) %s",
+                        layer->uId_, layer->transform, layer->fHScaleMul_, layer->fVScaleMul_,
+                        reuse ? "reuse" : "process");
+
+    hwc_frect_t source_crop;
+    source_crop.left   = 0;
+    source_crop.top    = 0;
+    source_crop.right  = dst_w;
+    source_crop.bottom = dst_h;
+    layer->UpdateAndStoreInfoFromDrmBuffer(dst_buffer->GetHandle(),
+                                           dst_buffer->GetFd(),
+                                           dst_buffer->GetFormat(),
+                                           dst_buffer->GetWidth(),
+                                           dst_buffer->GetHeight(),
+                                           dst_buffer->GetStride(),
+                                           dst_buffer->GetHeightStride(),
+                                           dst_buffer->GetByteStride(),
+                                           dst_buffer->GetSize(),
+                                           dst_buffer->GetUsage(),
+                                           dst_buffer->GetFourccFormat(),
+                                           dst_buffer->GetModifier(),
+                                           dst_buffer->GetName(),
+                                           source_crop,
+                                           dst_buffer->GetBufferId(),
+                                           dst_buffer->GetGemHandle(),
+                                           DRM_MODE_ROTATE_0);
+    if(releaseFence >= 0)
+      layer->acquire_fence = sp<AcquireFence>(new AcquireFence(releaseFence));
+    layer->pRgaBuffer_ = dst_buffer;
+    layer->bUseRga_ = true;
+    layer->bRgaTransform_ = true;
+    offload_cnt++;
+  }
+
+  // 图层销毁或不再需要预处理后释放对应的缓存
+  for(auto iter = mapRgaTransform_.begin(); iter != mapRgaTransform_.end();){
+    if(!iter->second.bActive_)
+      iter = mapRgaTransform_.erase(iter);
+    else
+      iter++;
+  }
+  return offload_cnt;
+}
+
 int Vop3588::TryRgaOverlayPolicy(
     std::vector<DrmCompositionPlane> *composition,
     std::vector<DrmHwcLayer*> &layers, DrmCrtc *crtc,
@@ -1391,7 +1887,8 @@ int Vop3588::TryRgaOverlayPolicy(
   int usage = 0;
 
   for(auto &drmLayer : layers){
-    if(drmLayer->bYuv_){
+    // 已由 RGA 预处理的图层不再处理
+    if(drmLayer->bYuv_ && !drmLayer->bRgaTransform_){
         if(last_buffer_id != drmLayer->uBufferId_){
           // TODO: afbc 暂时不支持 crop 裁剪，目前会出现RGA输出花屏问题
           if(drmLayer->bAfbcd_){
@@ -1452,27 +1949,7 @@ int Vop3588::TryRgaOverlayPolicy(
           }
 
           // Set src buffer info
-          src.fd      = drmLayer->iFd_;
-          src.width   = drmLayer->iWidth_;
-          src.height  = drmLayer->iHeight_;
-          src.hstride = drmLayer->iHeightStride_;
-          src.format  = drmLayer->iFormat_;
-
-          // RGA 的特殊修改，需要通过 wstride
-          if(drmLayer->uFourccFormat_ == DRM_FORMAT_NV15)
-            src.wstride = drmLayer->iByteStride_;
-          else
-            src.wstride = drmLayer->iStride_;
-
-          if(drmLayer->iFormat_ == HAL_PIXEL_FORMAT_YUV420_8BIT_I){
-            src.format = HAL_PIXEL_FORMAT_YCrCb_NV12;
-          }else if(drmLayer->iFormat_ == HAL_PIXEL_FORMAT_YUV420_10BIT_I){
-            src.format = HAL_PIXEL_FORMAT_YCrCb_NV12_10;
-          }
-
-          // AFBC format
-          if(drmLayer->bAfbcd_)
-            src.rd_mode = IM_FBC_MODE;
+          RgaFillSrcBuffer(drmLayer, &src);
 
           // Set src rect info
           src_rect.x = ALIGN_DOWN((int)drmLayer->source_crop.left,2);
@@ -1515,35 +1992,7 @@ int Vop3588::TryRgaOverlayPolicy(
           }
 
           // 处理旋转
-          switch(drmLayer->transform){
-          case DRM_MODE_ROTATE_0:
-            usage = 0;
-            break;
-          case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_X :
-            usage = IM_HAL_TRANSFORM_FLIP_H;
-            break;
-          case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_Y:
-            usage = IM_HAL_TRANSFORM_FLIP_V;
-            break;
-          case DRM_MODE_ROTATE_90:
-            usage = IM_HAL_TRANSFORM_ROT_90;
-            break;
-          case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_X | DRM_MODE_REFLECT_Y:
-            usage = IM_HAL_TRANSFORM_ROT_180;
-            break;
-          case DRM_MODE_ROTATE_270:
-            usage = IM_HAL_TRANSFORM_ROT_270;
-            break;
-          case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_X | DRM_MODE_ROTATE_90 :
-            usage = IM_HAL_TRANSFORM_FLIP_H | IM_HAL_TRANSFORM_ROT_90;
-            break;
-          case DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_Y | DRM_MODE_ROTATE_90:
-            usage = IM_HAL_TRANSFORM_FLIP_V | IM_HAL_TRANSFORM_ROT_90;
-            break;
-          default:
-            usage = 0;
-            ALOGE_IF(LogLevel(DBG_DEBUG),"Unknow sf transform 0x%x", drmLayer->transform);
-          }
+          usage = RgaTransformUsage(drmLayer->transform);
 
 
           IM_STATUS im_state;
@@ -1632,7 +2081,7 @@ int Vop3588::TryRgaOverlayPolicy(
     }
     if(!ret){ // Match sucess, to call im2d interface
       for(auto &drmLayer : layers){
-        if(drmLayer->bUseRga_){
+        if(drmLayer->bUseRga_ && !drmLayer->bRgaTransform_){
 
           im_opt_t imOpt;
           memset(&imOpt, 0x00, sizeof(im_opt_t));
@@ -1660,7 +2109,7 @@ int Vop3588::TryRgaOverlayPolicy(
     }else{ // Match fail, skip rga policy
       HWC2_ALOGD_IF_DEBUG(" MatchPlanes fail! reset DrmHwcLayer.");
       for(auto &drmLayer : layers){
-        if(drmLayer->bUseRga_){
+        if(drmLayer->bUseRga_ && !drmLayer->bRgaTransform_){
           rgaBufferQueue_->QueueBuffer(dst_buffer);
           drmLayer->ResetInfoFromStore();
           drmLayer->bUseRga_ = false;
@@ -1690,6 +2139,502 @@ int Vop3588::TryRgaOverlayPolicy(
   return -1;
 }
 
+bool Vop3588::RgaComposeAllowed(DrmHwcLayer *layer){
+  if(layer->bFbTarget_ || layer->bSkipLayer_ || layer->bYuv_ || layer->bAfbcd_ ||
+     layer->bSidebandStreamLayer_ || layer->bSolidColor_ || layer->bCursor_ ||
+     layer->bUseRga_)
+    return false;
+
+  // 旋转图层交给 VOP/RGA overlay 处理
+  if(layer->transform != DRM_MODE_ROTATE_0)
+    return false;
+
+  if(layer->iFd_ <= 0)
+    return false;
+
+  if(layer->iWidth_ > RGA_MAX_INPUT_WIDTH)
+    return false;
+
+  // RGA 有缩放倍数限制
+  if(layer->fHScaleMul_ < 0.125 || layer->fHScaleMul_ > 8.0 ||
+     layer->fVScaleMul_ < 0.125 || layer->fVScaleMul_ > 8.0)
+    return false;
+
+  // 不带 alpha 混合且有全局透明度的图层无法在 RGA 中等效合成
+  if(layer->blending == DrmHwcBlending::kNone && layer->alpha != 0xff)
+    return false;
+
+  // 不带 alpha 混合的图层输出 alpha 必须为 0xff, 只支持可按 RGBX 读取的格式
+  if(layer->blending == DrmHwcBlending::kNone){
+    switch(layer->iFormat_){
+      case HAL_PIXEL_FORMAT_RGBA_8888:
+      case HAL_PIXEL_FORMAT_RGBX_8888:
+      case HAL_PIXEL_FORMAT_RGB_888:
+      case HAL_PIXEL_FORMAT_RGB_565:
+        break;
+      default:
+        return false;
+    }
+  }
+
+  if(layer->display_frame.left < 0 || layer->display_frame.top < 0 ||
+     layer->display_frame.right > ctx.state.iDisplayWidth_ ||
+     layer->display_frame.bottom > ctx.state.iDisplayHeight_ ||
+     layer->display_frame.right <= layer->display_frame.left ||
+     layer->display_frame.bottom <= layer->display_frame.top)
+    return false;
+
+  return true;
+}
+
+// RGA 多图层预合成中单个图层的 blit 参数
+struct RgaComposeJob{
+  rga_buffer_t src;
+  im_rect src_rect;
+  im_rect dst_rect;
+  int usage;
+  uint64_t buffer_id;
+  // 仅在 Validate 中有效, 提交任务时图层已移入 DrmDisplayComposition
+  DrmHwcLayer *layer;
+  uint32_t layer_id;
+  sp<AcquireFence> acquire_fence;
+};
+
+// Validate 中确定的 RGA 合成任务, 方案通过 TEST_ONLY 后由 RunDeferredJobs 提交
+struct RgaComposePending{
+  std::vector<RgaComposeJob> jobs;
+  rga_buffer_t dst;
+  im_rect union_rect;
+  bool need_clear;
+  std::shared_ptr<DrmBuffer> dst_buffer;
+  uint64_t signature;
+  uint32_t carrier_id;
+};
+
+static int RgaComposeFillJob(DrmHwcLayer *layer, RgaComposeJob *job){
+  *job = RgaComposeJob();
+  job->layer = layer;
+  job->layer_id = layer->uId_;
+  job->acquire_fence = layer->acquire_fence;
+  job->buffer_id = layer->uBufferId_;
+  job->src.fd      = layer->iFd_;
+  job->src.width   = layer->iWidth_;
+  job->src.height  = layer->iHeight_;
+  job->src.wstride = layer->iStride_;
+  job->src.hstride = layer->iHeightStride_;
+  job->src.format  = layer->iFormat_;
+  job->src.global_alpha = layer->alpha;
+
+  job->src_rect.x      = (int)layer->source_crop.left;
+  job->src_rect.y      = (int)layer->source_crop.top;
+  job->src_rect.width  = (int)(layer->source_crop.right  - layer->source_crop.left);
+  job->src_rect.height = (int)(layer->source_crop.bottom - layer->source_crop.top);
+
+  job->dst_rect.x      = layer->display_frame.left;
+  job->dst_rect.y      = layer->display_frame.top;
+  job->dst_rect.width  = layer->display_frame.right  - layer->display_frame.left;
+  job->dst_rect.height = layer->display_frame.bottom - layer->display_frame.top;
+
+  switch(layer->blending){
+  case DrmHwcBlending::kPreMult:
+    job->usage = IM_ALPHA_BLEND_SRC_OVER;
+    break;
+  case DrmHwcBlending::kCoverage:
+    // 源数据未预乘，由 RGA 内部完成预乘
+    job->usage = IM_ALPHA_BLEND_SRC_OVER | IM_ALPHA_BLEND_PRE_MUL;
+    break;
+  default:
+    job->usage = 0;
+    // 源 alpha 通道无意义, 按 RGBX 读取使输出 alpha 为 0xff, 见 RgaComposeAllowed
+    if(job->src.format == HAL_PIXEL_FORMAT_RGBA_8888)
+      job->src.format = HAL_PIXEL_FORMAT_RGBX_8888;
+    break;
+  }
+  return 0;
+}
+
+// 按 zpos 从下到上依次提交 RGA 任务，任务之间通过 fence 串联，不阻塞 HWC 线程
+static int RgaComposeRun(std::vector<RgaComposeJob> &jobs,
+                         rga_buffer_t &dst,
+                         const im_rect &union_rect,
+                         bool need_clear,
+                         int *out_fence){
+  rga_buffer_t pat;
+  im_rect pat_rect;
+  memset(&pat, 0, sizeof(rga_buffer_t));
+  memset(&pat_rect, 0, sizeof(im_rect));
+  int fence = -1;
+  IM_STATUS im_state;
+
+  if(need_clear){
+    rga_buffer_t src;
+    im_rect src_rect;
+    memset(&src, 0, sizeof(rga_buffer_t));
+    memset(&src_rect, 0, sizeof(im_rect));
+    im_opt_t imOpt;
+    memset(&imOpt, 0x00, sizeof(im_opt_t));
+    imOpt.color = 0x0;
+    im_state = improcess(src, dst, pat, src_rect, union_rect, pat_rect,
+                         -1, &fence, &imOpt, IM_COLOR_FILL | IM_ASYNC);
+    if(im_state != IM_STATUS_SUCCESS){
+      HWC2_ALOGE("call im2d fill fail, %s",imStrError(im_state));
+      return -1;
+    }
+  }
+
+  for(auto &job : jobs){
+    int acquire_fence = -1;
+    if(job.acquire_fence != NULL && job.acquire_fence->isValid())
+      acquire_fence = dup(job.acquire_fence->getFd());
+
+    if(fence >= 0 && acquire_fence >= 0){
+      int merge_fence = sync_merge("RGA-Compose", fence, acquire_fence);
+      close(fence);
+      close(acquire_fence);
+      acquire_fence = merge_fence;
+    }else if(fence >= 0){
+      acquire_fence = fence;
+    }
+    fence = -1;
+
+    im_opt_t imOpt;
+    memset(&imOpt, 0x00, sizeof(im_opt_t));
+    im_state = improcess(job.src, dst, pat, job.src_rect, job.dst_rect, pat_rect,
+                         acquire_fence, &fence, &imOpt, job.usage | IM_ASYNC);
+    if(acquire_fence >= 0)
+      close(acquire_fence);
+    if(im_state != IM_STATUS_SUCCESS){
+      HWC2_ALOGE("call im2d blend fail, %s layer-id=%d",imStrError(im_state), job.layer_id);
+      if(fence >= 0)
+        close(fence);
+      return -1;
+    }
+  }
+
+  *out_fence = fence;
+  return 0;
+}
+
+/*************************RGA compose*************************
+  多个 RGBA 图层先由 RGA 合成到一块与屏幕同尺寸的缓冲区，再由一个 DrmPlane 显示，
+  用于图层数超过硬件图层数时替代 GPU 合成。
+  被合成的图层（bRgaCompose_）不占用 DrmPlane，release fence 与承载图层相同。
+************************************************************/
+int Vop3588::TryRgaComposePolicy(
+    std::vector<DrmCompositionPlane> *composition,
+    std::vector<DrmHwcLayer*> &layers, DrmCrtc *crtc,
+    std::vector<PlaneGroup *> &plane_groups) {
+  if(!ctx.state.bRgaComposeEnable){
+    HWC2_ALOGD_IF_DEBUG("bRgaComposeEnable=%d skip TryRgaComposePolicy", ctx.state.bRgaComposeEnable);
+    return -1;
+  }
+  ALOGD_IF(LogLevel(DBG_DEBUG), "%s:line=%d",__FUNCTION__,__LINE__);
+  std::vector<DrmHwcLayer*> tmp_layers;
+  ResetLayer(layers);
+  ResetPlaneGroups(plane_groups);
+  //save fb into tmp_layers
+  MoveFbToTmp(layers, tmp_layers);
+
+  int layer_cnt = layers.size();
+  if(layer_cnt < 2){
+    ResetLayerFromTmp(layers,tmp_layers);
+    return -1;
+  }
+
+  // 优先复用上一次的输出，仅用于匹配 DrmPlane，各 buffer 尺寸与格式相同
+  bool new_buffer = false;
+  std::shared_ptr<DrmBuffer> dst_buffer = rgaComposeBufferQueue_->BackDrmBuffer();
+  if(dst_buffer == NULL){
+    dst_buffer = rgaComposeBufferQueue_->DequeueDrmBuffer(ctx.state.iDisplayWidth_,
+                                                          ctx.state.iDisplayHeight_,
+                                                          HAL_PIXEL_FORMAT_RGBA_8888,
+                                                          RK_GRALLOC_USAGE_WITHIN_4G | MALI_GRALLOC_USAGE_NO_AFBC,
+                                                          "RGA-Compose");
+    if(dst_buffer == NULL){
+      HWC2_ALOGD_IF_DEBUG("DequeueDrmBuffer fail!, skip this policy.");
+      ResetLayerFromTmp(layers,tmp_layers);
+      return -1;
+    }
+    new_buffer = true;
+  }
+
+  rga_buffer_t dst;
+  rga_buffer_t pat;
+  im_rect pat_rect;
+  memset(&dst, 0, sizeof(rga_buffer_t));
+  memset(&pat, 0, sizeof(rga_buffer_t));
+  memset(&pat_rect, 0, sizeof(im_rect));
+
+  std::vector<RgaComposeJob> jobs;
+  hwc_frect_t union_crop;
+  im_rect union_rect;
+  DrmHwcLayer *carrier = NULL;
+  hwc_rect_t carrier_frame;
+  uint16_t carrier_alpha = 0;
+  DrmHwcBlending carrier_blending = DrmHwcBlending::kNone;
+  bool carrier_gles = false;
+  int ret = -1;
+
+  int max_cnt = std::min(ctx.state.iRgaComposeMaxCnt, layer_cnt);
+  // 合成图层数从少到多尝试，同样数量下优先合成 zpos 高的图层
+  for(int cnt = 2; cnt <= max_cnt && ret; cnt++){
+    for(int first = layer_cnt - cnt; first >= 0 && ret; first--){
+      bool allowed = true;
+      for(int i = first; i < first + cnt; i++){
+        if(!RgaComposeAllowed(layers[i])){
+          allowed = false;
+          break;
+        }
+      }
+      if(!allowed)
+        continue;
+
+      jobs.clear();
+      hwc_rect_t frame = layers[first]->display_frame;
+      for(int i = first; i < first + cnt; i++){
+        RgaComposeJob job;
+        RgaComposeFillJob(layers[i], &job);
+        jobs.push_back(job);
+        frame.left   = std::min(frame.left,   layers[i]->display_frame.left);
+        frame.top    = std::min(frame.top,    layers[i]->display_frame.top);
+        frame.right  = std::max(frame.right,  layers[i]->display_frame.right);
+        frame.bottom = std::max(frame.bottom, layers[i]->display_frame.bottom);
+      }
+
+      dst.fd      = dst_buffer->GetFd();
+      dst.width   = dst_buffer->GetWidth();
+      dst.height  = dst_buffer->GetHeight();
+      dst.wstride = dst_buffer->GetStride();
+      dst.hstride = dst_buffer->GetHeightStride();
+      dst.format  = dst_buffer->GetFormat();
+
+      IM_STATUS im_state = IM_STATUS_NOERROR;
+      for(auto &job : jobs){
+        im_state = imcheck_t(job.src, dst, pat, job.src_rect, job.dst_rect, pat_rect, job.usage | IM_ASYNC);
+        if(im_state != IM_STATUS_NOERROR){
+          HWC2_ALOGD_IF_DEBUG("imcheck fail, %s layer-id=%d",imStrError(im_state), job.layer->uId_);
+          break;
+        }
+      }
+      if(im_state != IM_STATUS_NOERROR)
+        continue;
+
+      union_rect.x      = frame.left;
+      union_rect.y      = frame.top;
+      union_rect.width  = frame.right  - frame.left;
+      union_rect.height = frame.bottom - frame.top;
+      union_crop.left   = frame.left;
+      union_crop.top    = frame.top;
+      union_crop.right  = frame.right;
+      union_crop.bottom = frame.bottom;
+
+      carrier = layers[first];
+      carrier_frame    = carrier->display_frame;
+      carrier_alpha    = carrier->alpha;
+      carrier_blending = carrier->blending;
+      carrier_gles     = carrier->bGlesCompose_;
+      carrier->UpdateAndStoreInfoFromDrmBuffer(dst_buffer->GetHandle(),
+                                               dst_buffer->GetFd(),
+                                               dst_buffer->GetFormat(),
+                                               dst_buffer->GetWidth(),
+                                               dst_buffer->GetHeight(),
+                                               dst_buffer->GetStride(),
+                                               dst_buffer->GetHeightStride(),
+                                               dst_buffer->GetByteStride(),
+                                               dst_buffer->GetSize(),
+                                               dst_buffer->GetUsage(),
+                                               dst_buffer->GetFourccFormat(),
+                                               dst_buffer->GetModifier(),
+                                               dst_buffer->GetName(),
+                                               union_crop,
+                                               dst_buffer->GetBufferId(),
+                                               dst_buffer->GetGemHandle(),
+                                               DRM_MODE_ROTATE_0);
+      carrier->display_frame = frame;
+      carrier->alpha = 0xff;
+      carrier->blending = DrmHwcBlending::kPreMult;
+      carrier->bGlesCompose_ = false;
+
+      // 被合成的图层移出，不参与 DrmPlane 匹配
+      layers.erase(layers.begin() + first + 1, layers.begin() + first + cnt);
+      int zpos = 0;
+      for(auto &layer : layers){
+        layer->iDrmZpos_ = zpos;
+        zpos++;
+      }
+      for(int i = 1; i < cnt; i++)
+        tmp_layers.push_back(jobs[i].layer);
+
+      HWC2_ALOGD_IF_DEBUG("rga compose (%d,%d) frame=[%d,%d,%d,%d]",
+                          first, first + cnt - 1, frame.left, frame.top, frame.right, frame.bottom);
+      ret = MatchPlanes(composition,layers,crtc,plane_groups);
+      if(ret){
+        carrier->ResetInfoFromStore();
+        carrier->display_frame = carrier_frame;
+        carrier->alpha         = carrier_alpha;
+        carrier->blending      = carrier_blending;
+        carrier->bGlesCompose_ = carrier_gles;
+        carrier = NULL;
+        ResetLayerFromTmpExceptFB(layers,tmp_layers);
+        MoveFbToTmp(layers, tmp_layers);
+      }
+    }
+  }
+
+  if(ret){
+    HWC2_ALOGD_IF_DEBUG("fail!, No layer use RGA compose policy.");
+    if(new_buffer)
+      rgaComposeBufferQueue_->QueueBuffer(dst_buffer);
+    ResetLayerFromTmp(layers,tmp_layers);
+    return -1;
+  }
+
+  // 参与合成的图层及其参数未变化时，直接复用上一次的输出
+  uint64_t signature = 14695981039346656037ULL;
+  auto hash_value = [&signature](uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+      signature ^= (value >> (i * 8)) & 0xff;
+      signature *= 1099511628211ULL;
+    }
+  };
+  for(auto &job : jobs){
+    hash_value(job.layer->uId_);
+    hash_value(job.buffer_id);
+    hash_value(((uint64_t)job.dst_rect.x << 32) | (uint32_t)job.dst_rect.y);
+    hash_value(((uint64_t)job.dst_rect.width << 32) | (uint32_t)job.dst_rect.height);
+    hash_value(((uint64_t)job.src_rect.x << 32) | (uint32_t)job.src_rect.y);
+    hash_value(((uint64_t)job.src_rect.width << 32) | (uint32_t)job.src_rect.height);
+    hash_value(((uint64_t)job.src.global_alpha << 32) | (uint32_t)job.usage);
+  }
+
+  if(!new_buffer && signature == uRgaComposeSignature_){
+    HWC2_ALOGD_IF_DEBUG("Use last rga compose buffer.");
+  }else{
+    if(!new_buffer){
+      dst_buffer = rgaComposeBufferQueue_->DequeueDrmBuffer(ctx.state.iDisplayWidth_,
+                                                            ctx.state.iDisplayHeight_,
+                                                            HAL_PIXEL_FORMAT_RGBA_8888,
+                                                            RK_GRALLOC_USAGE_WITHIN_4G | MALI_GRALLOC_USAGE_NO_AFBC,
+                                                            "RGA-Compose");
+      if(dst_buffer == NULL){
+        HWC2_ALOGD_IF_DEBUG("DequeueDrmBuffer fail!, skip this policy.");
+        ret = -1;
+      }else{
+        carrier->ResetInfoFromStore();
+        carrier->UpdateAndStoreInfoFromDrmBuffer(dst_buffer->GetHandle(),
+                                                 dst_buffer->GetFd(),
+                                                 dst_buffer->GetFormat(),
+                                                 dst_buffer->GetWidth(),
+                                                 dst_buffer->GetHeight(),
+                                                 dst_buffer->GetStride(),
+                                                 dst_buffer->GetHeightStride(),
+                                                 dst_buffer->GetByteStride(),
+                                                 dst_buffer->GetSize(),
+                                                 dst_buffer->GetUsage(),
+                                                 dst_buffer->GetFourccFormat(),
+                                                 dst_buffer->GetModifier(),
+                                                 dst_buffer->GetName(),
+                                                 union_crop,
+                                                 dst_buffer->GetBufferId(),
+                                                 dst_buffer->GetGemHandle(),
+                                                 DRM_MODE_ROTATE_0);
+        dst.fd = dst_buffer->GetFd();
+      }
+    }
+
+    if(ret){
+      if(dst_buffer != NULL)
+        rgaComposeBufferQueue_->QueueBuffer(dst_buffer);
+      uRgaComposeSignature_ = 0;
+      carrier->ResetInfoFromStore();
+      carrier->display_frame = carrier_frame;
+      carrier->alpha         = carrier_alpha;
+      carrier->blending      = carrier_blending;
+      carrier->bGlesCompose_ = carrier_gles;
+      ResetLayerFromTmp(layers,tmp_layers);
+      ResetLayer(layers);
+      ResetPlaneGroups(plane_groups);
+      composition->clear();
+      return -1;
+    }
+
+    // 方案仍可能被 TEST_ONLY 拒绝或被 SurfaceFlinger 重新 Validate,
+    // RGA 任务推迟到 RunDeferredJobs 中提交
+    std::shared_ptr<RgaComposePending> pending = std::make_shared<RgaComposePending>();
+    // 最底层图层不透明且覆盖整个合成区域时无需清屏
+    DrmHwcLayer *bottom = jobs[0].layer;
+    pending->need_clear = !(bottom->blending == DrmHwcBlending::kNone &&
+                            jobs[0].dst_rect.x == union_rect.x &&
+                            jobs[0].dst_rect.y == union_rect.y &&
+                            jobs[0].dst_rect.width == union_rect.width &&
+                            jobs[0].dst_rect.height == union_rect.height);
+    for(auto &job : jobs)
+      job.layer = NULL;
+    pending->jobs = jobs;
+    pending->dst = dst;
+    pending->union_rect = union_rect;
+    pending->dst_buffer = dst_buffer;
+    pending->signature = signature;
+    pending->carrier_id = carrier->uId_;
+    pRgaComposePending_ = pending;
+  }
+
+  carrier->bUseRga_ = true;
+  carrier->pRgaBuffer_ = dst_buffer;
+  for(auto &job : jobs){
+    if(job.layer == carrier)
+      continue;
+    job.layer->bRgaCompose_ = true;
+    carrier->vRgaComposeIds_.push_back(job.layer->uId_);
+  }
+  return 0;
+}
+
+// 未提交的任务直接丢弃, 输出 buffer 未写入, 不能再作为复用结果
+void Vop3588::DropRgaComposePending(){
+  if(pRgaComposePending_ == NULL)
+    return;
+  rgaComposeBufferQueue_->QueueBuffer(pRgaComposePending_->dst_buffer);
+  uRgaComposeSignature_ = 0;
+  pRgaComposePending_.reset();
+}
+
+int Vop3588::RunDeferredJobs(std::vector<DrmHwcLayer> &layers){
+  if(pRgaComposePending_ == NULL)
+    return 0;
+
+  DrmHwcLayer *carrier = NULL;
+  for(auto &layer : layers){
+    if(layer.uId_ == pRgaComposePending_->carrier_id && layer.bUseRga_ &&
+       !layer.vRgaComposeIds_.empty()){
+      carrier = &layer;
+      break;
+    }
+  }
+  // 最终方案没有使用 RGA 合成
+  if(carrier == NULL){
+    DropRgaComposePending();
+    return 0;
+  }
+
+  std::shared_ptr<RgaComposePending> pending = pRgaComposePending_;
+  int releaseFence = -1;
+  int ret = RgaComposeRun(pending->jobs, pending->dst, pending->union_rect,
+                          pending->need_clear, &releaseFence);
+  if(ret){
+    HWC2_ALOGE("rga compose run fail, carrier layer-id=%d", pending->carrier_id);
+    DropRgaComposePending();
+    return ret;
+  }
+
+  pending->dst_buffer->SetFinishFence(dup(releaseFence));
+  carrier->acquire_fence = sp<AcquireFence>(new AcquireFence(releaseFence));
+  rgaComposeBufferQueue_->QueueBuffer(pending->dst_buffer);
+  uRgaComposeSignature_ = pending->signature;
+  pRgaComposePending_.reset();
+  return 0;
+}
+
 /*************************mix SidebandStream*************************
    DisplayId=0, Connector 345, Type = HDMI-A-1, Connector state = DRM_MODE_CONNECTED , frame_no = 6611
   ------+-----+-----------+-----------+--------------------+-------------+------------+--------------------------------+------------------------+------------+------------
@@ -1924,9 +2869,8 @@ int Vop3588::TrySvepPolicy(
     }
   }
 
-  static int last_svep_mode = 0;
   if(!use_svep){
-    last_svep_mode = use_svep;
+    iLastSvepMode_ = 0;
     return -1;
   }
 
@@ -1939,9 +2883,19 @@ int Vop3588::TrySvepPolicy(
     }
   }
 
+  // SVEP 连续无法按时完成, 暂时退回 VOP 缩放
+  if(iSvepFallbackCnt_ > 0){
+    iSvepFallbackCnt_--;
+    // 退回结束后强制重新处理当前帧
+    iLastSvepMode_ = 0;
+    HWC2_ALOGD_IF_DEBUG("Svep overload, fallback to scale, remain=%d", iSvepFallbackCnt_);
+    return -1;
+  }
+
   bool rga_layer_ready = false;
   bool use_laster_rga_layer = false;
   std::shared_ptr<DrmBuffer> dst_buffer;
+  SvepJobSlot *slot = NULL;
 
   // 以下参数更新后需要强制触发svep处理更新图像数据
   property_get(SVEP_ENHANCEMENT_RATE_NAME, value, "5");
@@ -1952,10 +2906,7 @@ int Vop3588::TrySvepPolicy(
   int contrast_offset = atoi(value);
   property_get(SVEP_OSD_VIDEO_ONELINE_MODE, value, "0");
   int osd_oneline_mode = atoi(value);
-  static uint64_t last_buffer_id = 0;
-  static int last_enhancement_rate = 0;
-  static int last_contrast_mode = 0;
-  static int last_contrast_offset = 0;
+  auto output_mode = (ctx.state.b8kMode_ ? SVEP_OUTPUT_8K_MODE : SVEP_MODE_NONE);
 
   for(auto &drmLayer : layers){
     if(SvepAllowedByWhitelist(drmLayer) || (
@@ -1963,17 +2914,56 @@ int Vop3588::TrySvepPolicy(
        SvepAllowedByBlacklist(drmLayer))){
         ALOGD_IF(LogLevel(DBG_DEBUG), "%s:line=%d",__FUNCTION__,__LINE__);
         // 部分参数变化后需要强制更新
-        if(last_svep_mode != svep_mode ||
-           last_buffer_id != drmLayer->uBufferId_  ||
-           last_enhancement_rate != enhancement_rate ||
-           last_contrast_mode != contrast_mode ||
-           last_contrast_offset != contrast_offset){
+        bool need_update = iLastSvepMode_ != svep_mode ||
+                           uLastSvepBufferId_ != drmLayer->uBufferId_  ||
+                           iLastEnhancementRate_ != enhancement_rate ||
+                           iLastContrastMode_ != contrast_mode ||
+                           iLastContrastOffset_ != contrast_offset;
+        if(need_update){
+          slot = &mSvepSlots_[iSvepSlot_ % SVEP_CTX_NUM];
+          // 上下文仍在处理之前的帧, 或视频帧尚未解码完成, 本帧无法按时完成, 复用上一帧结果
+          // Validate 中不阻塞等待, AcquireFence 只查询一次状态
+          if(SvepSlotBusy(*slot) ||
+             (drmLayer->acquire_fence->isValid() &&
+              drmLayer->acquire_fence->wait(0))){
+            need_update = false;
+            iSvepMissCnt_++;
+            HWC2_ALOGD_IF_DEBUG("Svep miss deadline cnt=%d BufferId=%" PRIx64,
+                                iSvepMissCnt_, drmLayer->uBufferId_);
+            if(iSvepMissCnt_ >= SVEP_MISS_FALLBACK_CNT){
+              iSvepMissCnt_ = 0;
+              iSvepFallbackCnt_ = SVEP_FALLBACK_FRAMES;
+              iLastSvepMode_ = 0;
+              HWC2_ALOGD_IF_DEBUG("Svep miss deadline %d times, fallback to scale.",
+                                  SVEP_MISS_FALLBACK_CNT);
+              return -1;
+            }
+          }
+        }
+        if(need_update){
           ALOGD_IF(LogLevel(DBG_DEBUG), "%s:line=%d",__FUNCTION__,__LINE__);
-          // 1. Init Ctx
-          int ret = svep_->InitCtx(svepCtx_);
-          if(ret){
-            HWC2_ALOGE("Svep ctx init fail");
-            continue;
+          // 1. Init Ctx, 源图像几何信息不变时复用上下文
+          bool geometry_changed = !slot->bInit_ ||
+                                  slot->iSrcWidth_   != drmLayer->iWidth_ ||
+                                  slot->iSrcHeight_  != drmLayer->iHeight_ ||
+                                  slot->iSrcFormat_  != drmLayer->iFormat_ ||
+                                  slot->iSrcStride_  != drmLayer->iStride_ ||
+                                  slot->bSrcAfbc_    != drmLayer->bAfbcd_ ||
+                                  slot->iOutputMode_ != output_mode ||
+                                  slot->mSrcCrop_.left   != drmLayer->source_crop.left ||
+                                  slot->mSrcCrop_.top    != drmLayer->source_crop.top ||
+                                  slot->mSrcCrop_.right  != drmLayer->source_crop.right ||
+                                  slot->mSrcCrop_.bottom != drmLayer->source_crop.bottom;
+          int ret = 0;
+          if(geometry_changed){
+            slot->bInit_ = false;
+            ret = svep_->InitCtx(slot->mCtx_);
+            if(ret){
+              HWC2_ALOGE("Svep ctx init fail");
+              continue;
+            }
+            slot->iEnhancementRate_ = -1;
+            slot->iOsdMode_ = -1;
           }
           // 2. Set buffer Info
           SvepImageInfo src;
@@ -1997,21 +2987,29 @@ int Vop3588::TrySvepPolicy(
           src.mCrop_.iRight_ = (int)drmLayer->source_crop.right;
           src.mCrop_.iBottom_= (int)drmLayer->source_crop.bottom;
 
-          ret = svep_->SetSrcImage(svepCtx_,
-                                   src,
-                                   (ctx.state.b8kMode_ ? SVEP_OUTPUT_8K_MODE : SVEP_MODE_NONE));
+          ret = svep_->SetSrcImage(slot->mCtx_, src, output_mode);
           if(ret){
             printf("Svep SetSrcImage fail\n");
             continue;
           }
 
-          // 3. Get dst info
-          SvepImageInfo require;
-          ret = svep_->GetDstRequireInfo(svepCtx_, require);
-          if(ret){
-            printf("Svep GetDstRequireInfo fail\n");
-            continue;
+          // 3. Get dst info, 只在几何信息变化时获取
+          if(geometry_changed){
+            ret = svep_->GetDstRequireInfo(slot->mCtx_, slot->mRequire_);
+            if(ret){
+              printf("Svep GetDstRequireInfo fail\n");
+              continue;
+            }
+            slot->iSrcWidth_   = drmLayer->iWidth_;
+            slot->iSrcHeight_  = drmLayer->iHeight_;
+            slot->iSrcFormat_  = drmLayer->iFormat_;
+            slot->iSrcStride_  = drmLayer->iStride_;
+            slot->bSrcAfbc_    = drmLayer->bAfbcd_;
+            slot->iOutputMode_ = output_mode;
+            slot->mSrcCrop_    = drmLayer->source_crop;
+            slot->bInit_       = true;
           }
+          SvepImageInfo &require = slot->mRequire_;
 
           // 4. Alloc dst_buffer
             dst_buffer = bufferQueue_->DequeueDrmBuffer(require.mBufferInfo_.iWidth_,
@@ -2041,24 +3039,27 @@ int Vop3588::TrySvepPolicy(
           dst.mCrop_.iRight_ = require.mCrop_.iRight_;
           dst.mCrop_.iBottom_= require.mCrop_.iBottom_;
 
-          ret = svep_->SetDstImage(svepCtx_, dst);
+          ret = svep_->SetDstImage(slot->mCtx_, dst);
           if(ret){
             printf("Svep SetSrcImage fail\n");
             continue;
           }
 
-          ret = svep_->SetEnhancementRate(svepCtx_, enhancement_rate);
-          if(ret){
-            printf("Svep SetEnhancementRate fail\n");
-            continue;
+          if(slot->iEnhancementRate_ != enhancement_rate){
+            ret = svep_->SetEnhancementRate(slot->mCtx_, enhancement_rate);
+            if(ret){
+              printf("Svep SetEnhancementRate fail\n");
+              continue;
+            }
+            slot->iEnhancementRate_ = enhancement_rate;
           }
 
           SvepOsdMode osd_mode = SVEP_OSD_ENABLE_VIDEO;
           const wchar_t* osd_str = SVEP_OSD_VIDEO_STR;
           if(osd_oneline_mode > 0){
             // 视频播放SVEP若干帧后，采用oneline OSD模式
-            if(mLastMode_ != svepCtx_.mSvepMode_){
-              mLastMode_ = svepCtx_.mSvepMode_;
+            if(mLastMode_ != slot->mCtx_.mSvepMode_){
+              mLastMode_ = slot->mCtx_.mSvepMode_;
               mLastModeCnt_ = 0;
             }
             mLastModeCnt_++;
@@ -2068,10 +3069,13 @@ int Vop3588::TrySvepPolicy(
             }
           }
 
-          ret = svep_->SetOsdMode(svepCtx_, osd_mode, osd_str);
-          if(ret){
-            printf("Svep SetOsdMode fail\n");
-            continue;
+          if(slot->iOsdMode_ != (int)osd_mode){
+            ret = svep_->SetOsdMode(slot->mCtx_, osd_mode, osd_str);
+            if(ret){
+              printf("Svep SetOsdMode fail\n");
+              continue;
+            }
+            slot->iOsdMode_ = (int)osd_mode;
           }
 
           hwc_frect_t source_crop;
@@ -2161,18 +3165,22 @@ int Vop3588::TrySvepPolicy(
       for(auto &drmLayer : layers){
         if(drmLayer->bUseSvep_){
           int output_fence = 0;
-          ret = svep_->RunAsync(svepCtx_, &output_fence);
+          ret = svep_->RunAsync(slot->mCtx_, &output_fence);
           if(ret){
             HWC2_ALOGD_IF_DEBUG("RunAsync fail!");
             drmLayer->bUseSvep_ = false;
           }
-          last_buffer_id = svepCtx_.mSrc_.mBufferInfo_.uBufferId_;
-          last_svep_mode = svep_mode;
-          last_contrast_mode = contrast_mode;
-          last_enhancement_rate = enhancement_rate;
-          last_contrast_offset = contrast_offset;
+          uLastSvepBufferId_ = slot->mCtx_.mSrc_.mBufferInfo_.uBufferId_;
+          iLastSvepMode_ = svep_mode;
+          iLastContrastMode_ = contrast_mode;
+          iLastEnhancementRate_ = enhancement_rate;
+          iLastContrastOffset_ = contrast_offset;
+          iSvepMissCnt_ = 0;
           dst_buffer->SetFinishFence(output_fence);
           bufferQueue_->QueueBuffer(dst_buffer);
+          // 下一帧使用另一个上下文, 与本帧的 SVEP 任务并行
+          slot->pOutput_ = dst_buffer;
+          iSvepSlot_ = (iSvepSlot_ + 1) % SVEP_CTX_NUM;
           drmLayer->pSvepBuffer_ = dst_buffer;
           drmLayer->acquire_fence = sp<AcquireFence>(new AcquireFence(dst_buffer->GetFinishFence()));
           return ret;
@@ -2633,6 +3641,9 @@ bool Vop3588::CheckGLESLayer(DrmHwcLayer *layer){
   switch(layer->sf_composition){
     //case HWC2::Composition::Sideband:
     case HWC2::Composition::SolidColor:
+      // 已替换为填充 buffer 的 SolidColor 图层按普通图层处理
+      if(layer->bSolidColor_)
+        break;
       HWC2_ALOGD_IF_DEBUG("[%s]：sf_composition =0x%x not support overlay.",
               layer->sLayerName_.c_str(),layer->sf_composition);
       return true;
@@ -2899,6 +3910,9 @@ void Vop3588::TryMix(){
     ctx.state.setHwcPolicy.insert(HWC_MIX_VIDEO_LOPICY);
   }
 
+  if(ctx.state.bRgaComposeEnable && ctx.request.iSkipCnt == 0)
+    ctx.state.setHwcPolicy.insert(HWC_RGA_COMPOSE_LOPICY);
+
   if(ctx.request.iSkipCnt > 0)
     ctx.state.setHwcPolicy.insert(HWC_MIX_SKIP_LOPICY);
   if(ctx.request.bSidebandStreamMode)
@@ -2958,6 +3972,10 @@ int Vop3588::InitContext(
   }
 #endif
 
+  // DrmPlane 不支持的旋转/缩放交给 RGA 预处理, 之后重新统计图层需求
+  if(TryRgaTransformOffload(layers, plane_groups, crtc) > 0)
+    InitRequestContext(layers);
+
   if(!TryOverlay())
     TryMix();
 
@@ -39,6 +39,10 @@
 #include <cutils/properties.h>
 
 #include "rockchip/utils/drmdebug.h"
+#include "rockchip/utils/drmeventlog.h"
+
+#include <mutex>
+#include <sys/system_properties.h>
 
 namespace android {
 
@@ -51,6 +55,7 @@ void InitDebugModule()
   g_frame = 0;
   UpdateLogLevel();
   InitHwcVersion();
+  DrmEventLog::Init();
 }
 
 void InitHwcVersion()
@@ -63,6 +68,26 @@ void InitHwcVersion()
 }
 int UpdateLogLevel()
 {
+  // 每次 Validate 都会调用, 属性 serial 未变化时不再重新解析
+  // 多个 display 的 Validate 线程会同时调用, 缓存状态需加锁
+  static std::mutex log_mutex;
+  static const prop_info *log_prop = NULL;
+  static uint32_t log_serial = 0;
+  static bool inited = false;
+  std::lock_guard<std::mutex> lock(log_mutex);
+  if(log_prop == NULL){
+    log_prop = __system_property_find("vendor.hwc.log");
+    if(log_prop == NULL && inited)
+      return 0;
+  }
+  if(log_prop != NULL){
+    uint32_t serial = __system_property_serial(log_prop);
+    if(inited && serial == log_serial)
+      return 0;
+    log_serial = serial;
+  }
+  inited = true;
+
   char value[PROPERTY_VALUE_MAX];
   property_get("vendor.hwc.log", value, "0");
   if(!strcmp(value,"info"))
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-event-log"
+
+#include "rockchip/utils/drmeventlog.h"
+#include "rockchip/utils/drmdebug.h"
+
+#include <log/log.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace android {
+
+#define HWC_EVENT_FMT(id, fmt) fmt,
+static const char *kEventFmt[kEvCnt] = {
+  HWC_EVENT_LIST(HWC_EVENT_FMT)
+};
+#undef HWC_EVENT_FMT
+
+// 每个线程独占一个环形缓冲区，head 只由所属线程递增
+// 线程退出后缓冲区保留供 Dump 查看，直到被新线程复用，复用时 start 之前的记录作废
+struct EventRing{
+  std::atomic<pid_t> tid;
+  std::atomic<bool> active;
+  std::atomic<uint64_t> start;
+  std::atomic<uint64_t> head;
+  HwcEventRecord records[EVENT_LOG_RING_SIZE];
+};
+
+// 线程退出时归还缓冲区
+struct EventRingOwner{
+  EventRing *ring = NULL;
+  ~EventRingOwner();
+};
+
+static std::mutex g_ring_mutex;
+static EventRing *g_rings[EVENT_LOG_MAX_THREAD];
+static std::atomic<int> g_ring_cnt(0);
+// 每归还一个缓冲区加一，缓冲区已满的线程据此判断是否需要重新申请
+static std::atomic<uint32_t> g_ring_release_gen(0);
+static thread_local EventRingOwner t_ring;
+static thread_local bool t_ring_full = false;
+static thread_local uint32_t t_ring_full_gen = 0;
+
+EventRingOwner::~EventRingOwner(){
+  if(ring == NULL)
+    return;
+  ring->active.store(false, std::memory_order_release);
+  g_ring_release_gen.fetch_add(1, std::memory_order_release);
+  ring = NULL;
+}
+
+bool DrmEventLog::bEnable_ = false;
+
+void DrmEventLog::Init(){
+  bEnable_ = hwc_get_bool_property("vendor.hwc.event_log", EVENT_LOG_DEFAULT);
+}
+
+static EventRing *GetThreadRing(){
+  if(t_ring.ring != NULL)
+    return t_ring.ring;
+  if(t_ring_full &&
+     t_ring_full_gen == g_ring_release_gen.load(std::memory_order_acquire))
+    return NULL;
+
+  std::lock_guard<std::mutex> lock(g_ring_mutex);
+  int cnt = g_ring_cnt.load(std::memory_order_relaxed);
+  EventRing *ring = NULL;
+  // 优先复用已退出线程的缓冲区
+  for(int i = 0; i < cnt; i++){
+    if(!g_rings[i]->active.load(std::memory_order_acquire)){
+      ring = g_rings[i];
+      break;
+    }
+  }
+  if(ring == NULL){
+    if(cnt >= EVENT_LOG_MAX_THREAD){
+      t_ring_full = true;
+      t_ring_full_gen = g_ring_release_gen.load(std::memory_order_acquire);
+      return NULL;
+    }
+    ring = new EventRing();
+    ring->start.store(0, std::memory_order_relaxed);
+    ring->head.store(0, std::memory_order_relaxed);
+    g_rings[cnt] = ring;
+    g_ring_cnt.store(cnt + 1, std::memory_order_release);
+  }
+  ring->start.store(ring->head.load(std::memory_order_relaxed), std::memory_order_release);
+  ring->tid.store(gettid(), std::memory_order_release);
+  ring->active.store(true, std::memory_order_release);
+  t_ring_full = false;
+  t_ring.ring = ring;
+  return ring;
+}
+
+void DrmEventLog::Log(HwcEventId id, uint64_t a0, uint64_t a1, uint64_t a2,
+                      uint64_t a3, uint64_t a4, uint64_t a5){
+  EventRing *ring = GetThreadRing();
+  if(ring == NULL)
+    return;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  HwcEventRecord &record = ring->records[head % EVENT_LOG_RING_SIZE];
+  record.ts = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  record.id = id;
+  record.args[0] = a0;
+  record.args[1] = a1;
+  record.args[2] = a2;
+  record.args[3] = a3;
+  record.args[4] = a4;
+  record.args[5] = a5;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+struct EventDumpRecord{
+  pid_t tid;
+  HwcEventRecord record;
+};
+
+void DrmEventLog::Dump(String8 &output){
+  if(!bEnable_)
+    return;
+
+  std::vector<EventDumpRecord> events;
+  int ring_cnt = g_ring_cnt.load(std::memory_order_acquire);
+  for(int i = 0; i < ring_cnt; i++){
+    EventRing *ring = g_rings[i];
+    pid_t tid = ring->tid.load(std::memory_order_acquire);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t start = head > EVENT_LOG_DUMP_CNT ? head - EVENT_LOG_DUMP_CNT : 0;
+    start = std::max<uint64_t>(start, ring->start.load(std::memory_order_acquire));
+    size_t base = events.size();
+    for(uint64_t idx = start; idx < head; idx++){
+      EventDumpRecord event;
+      event.tid = tid;
+      event.record = ring->records[idx % EVENT_LOG_RING_SIZE];
+      events.push_back(event);
+    }
+    // 拷贝期间被写线程覆盖的记录丢弃
+    uint64_t new_head = ring->head.load(std::memory_order_acquire);
+    if(new_head > EVENT_LOG_RING_SIZE && new_head - EVENT_LOG_RING_SIZE > start){
+      size_t overwritten = std::min<uint64_t>(new_head - EVENT_LOG_RING_SIZE - start, head - start);
+      events.erase(events.begin() + base, events.begin() + base + overwritten);
+    }
+  }
+
+  std::sort(events.begin(), events.end(),
+            [](const EventDumpRecord &a, const EventDumpRecord &b){
+              return a.record.ts < b.record.ts;
+            });
+  size_t first = events.size() > EVENT_LOG_DUMP_CNT ? events.size() - EVENT_LOG_DUMP_CNT : 0;
+
+  output.appendFormat("EventLog: threads=%d events=%zu\n", ring_cnt, events.size() - first);
+  char line[256];
+  for(size_t i = first; i < events.size(); i++){
+    const HwcEventRecord &record = events[i].record;
+    if(record.id >= kEvCnt)
+      continue;
+    snprintf(line, sizeof(line), kEventFmt[record.id],
+             record.args[0], record.args[1], record.args[2],
+             record.args[3], record.args[4], record.args[5]);
+    output.appendFormat("  %" PRIi64 ".%06" PRIi64 " %5d %s\n",
+                        (int64_t)(record.ts / 1000000000), (int64_t)((record.ts / 1000) % 1000000),
+                        events[i].tid, line);
+  }
+}
+
+} // namespace android
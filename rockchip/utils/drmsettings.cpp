@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-settings"
+
+#include "rockchip/utils/drmsettings.h"
+#include "rockchip/utils/drmdebug.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include <log/log.h>
+#include <system/thread_defs.h>
+
+#include <sys/system_properties.h>
+
+namespace android {
+
+static const char *kSettingsName[] = {
+  "vendor.hwc.log",
+  "vendor.display.timeline",
+};
+
+// 按 connector 区分的设置, 后缀为 main / aux 或 connector unique name
+static const char *kConnectorSettingsPrefix[] = {
+  "persist.vendor.resolution.",
+  "persist.vendor.color.",
+  "persist.vendor.overscan.",
+  "persist.vendor.framebuffer.",
+  "persist.vendor.brightness.",
+  "persist.vendor.contrast.",
+  "persist.vendor.saturation.",
+  "persist.vendor.hue.",
+};
+
+DrmSettings::DrmSettings()
+    : Worker("hwc2-settings", ANDROID_PRIORITY_BACKGROUND),
+      bEnable_(false),
+      uAreaSerial_(0),
+      uGeneration_(0),
+      pSnapshot_(std::make_shared<DrmSettingsSnapshot>()){
+}
+
+DrmSettings::~DrmSettings(){
+}
+
+void DrmSettings::Watch(const std::string &name){
+  for(auto &prop : vWatchProps_){
+    if(prop.sName_ == name)
+      return;
+  }
+  WatchProp prop;
+  prop.sName_ = name;
+  vWatchProps_.push_back(prop);
+}
+
+int DrmSettings::Init(const std::vector<std::string> &connector_names){
+  if(!hwc_get_bool_property("vendor.hwc.settings_notifier", SETTINGS_NOTIFIER_DEFAULT))
+    return 0;
+
+  for(const char *name : kSettingsName)
+    Watch(name);
+  std::vector<std::string> suffixes = {"main", "aux"};
+  suffixes.insert(suffixes.end(), connector_names.begin(), connector_names.end());
+  for(const char *prefix : kConnectorSettingsPrefix){
+    for(auto &suffix : suffixes)
+      Watch(std::string(prefix) + suffix);
+  }
+
+  // 先同步生成首个快照, 保证首帧 Validate 读取一次设置
+  uAreaSerial_ = __system_property_area_serial();
+  Refresh();
+
+  int ret = InitWorker();
+  if(ret){
+    HWC2_ALOGE("InitWorker fail ret=%d, fallback to per-frame polling.", ret);
+    return ret;
+  }
+  bEnable_ = true;
+  HWC2_ALOGI("settings notifier enable, generation=%" PRIu64, Generation());
+  return 0;
+}
+
+std::shared_ptr<const DrmSettingsSnapshot> DrmSettings::GetSnapshot() const{
+  std::lock_guard<std::mutex> lock(mtx_);
+  return pSnapshot_;
+}
+
+void DrmSettings::Refresh(){
+  // 只比较关注属性各自的 serial, 不遍历整个属性区
+  bool changed = false;
+  for(auto &prop : vWatchProps_){
+    if(prop.pInfo_ == NULL){
+      // 属性首次被设置前不存在, 之后才能找到
+      prop.pInfo_ = __system_property_find(prop.sName_.c_str());
+      if(prop.pInfo_ == NULL)
+        continue;
+    }
+    uint32_t serial = __system_property_serial(prop.pInfo_);
+    if(prop.bValid_ && serial == prop.uSerial_)
+      continue;
+    __system_property_read_callback(prop.pInfo_,
+        [](void *cookie, const char * /*name*/, const char *value, uint32_t serial){
+          WatchProp *watch = static_cast<WatchProp *>(cookie);
+          watch->sValue_ = value;
+          watch->uSerial_ = serial;
+        }, &prop);
+    prop.bValid_ = true;
+    changed = true;
+  }
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  if(pSnapshot_->uGeneration_ > 0 && !changed)
+    return;
+
+  std::shared_ptr<DrmSettingsSnapshot> snapshot = std::make_shared<DrmSettingsSnapshot>();
+  for(auto &prop : vWatchProps_){
+    if(prop.bValid_)
+      snapshot->mapProps_[prop.sName_] = prop.sValue_;
+  }
+
+  snapshot->uGeneration_ = pSnapshot_->uGeneration_ + 1;
+  pSnapshot_ = snapshot;
+  uGeneration_.store(snapshot->uGeneration_, std::memory_order_release);
+  HWC2_ALOGD_IF_DEBUG("settings change, generation=%" PRIu64, snapshot->uGeneration_);
+}
+
+void DrmSettings::Routine(){
+  uint32_t new_serial = uAreaSerial_;
+  struct timespec timeout = {.tv_sec = SETTINGS_WAIT_TIMEOUT_MS / 1000,
+                             .tv_nsec = (SETTINGS_WAIT_TIMEOUT_MS % 1000) * 1000000};
+  // 单线程无法同时等待多个属性, 借属性区 serial 唤醒, 再由 Refresh 比较各属性 serial
+  if(!__system_property_wait(NULL, uAreaSerial_, &new_serial, &timeout))
+    return;
+  uAreaSerial_ = new_serial;
+  Refresh();
+}
+
+void DrmSettings::Dump(String8 &output){
+  std::shared_ptr<const DrmSettingsSnapshot> snapshot = GetSnapshot();
+  output.appendFormat("Settings: notifier=%d generation=%" PRIu64 " watch=%zu props=%zu\n",
+                      bEnable_, snapshot->uGeneration_, vWatchProps_.size(),
+                      snapshot->mapProps_.size());
+}
+
+} // namespace android
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2022 Rockchip Electronics Co.Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-telemetry"
+
+#include "rockchip/utils/drmtelemetry.h"
+#include "rockchip/utils/drmdebug.h"
+
+#include <cutils/properties.h>
+#include <log/log.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace android {
+
+// 记录区按 cache line 对齐
+#define TELEMETRY_HEADER_SIZE 64
+#define TELEMETRY_INVALID_FRAME UINT64_MAX
+
+static_assert(sizeof(TelemetryHeader) <= TELEMETRY_HEADER_SIZE,
+              "TelemetryHeader is larger than TELEMETRY_HEADER_SIZE");
+
+static const char *kPolicyName[kTmPolicyCnt] = {
+  "none", "overlay", "mix", "gles", "rga", "svep", "drop",
+};
+
+struct TelemetrySegment{
+  const char *name;
+  TelemetryStage start;
+  TelemetryStage end;
+};
+
+static const TelemetrySegment kSegments[] = {
+  { "validate", kTmValidateStart, kTmValidateEnd },
+  { "plan",     kTmValidateStart, kTmPlanEnd },
+  { "import",   kTmValidateEnd,   kTmImportEnd },
+  { "present",  kTmValidateEnd,   kTmQueue },
+  { "fence",    kTmQueue,         kTmFenceWaitEnd },
+  { "latch",    kTmQueue,         kTmCommitStart },
+  { "commit",   kTmCommitStart,   kTmCommitEnd },
+  { "flip",     kTmCommitEnd,     kTmFlipDone },
+  { "total",    kTmValidateStart, kTmFlipDone },
+  { "hold",     kTmFlipDone,      kTmRelease },
+};
+
+static int64_t TelemetryNowNs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+DrmTelemetry::DrmTelemetry()
+  : bEnable_(hwc_get_bool_property("vendor.hwc.telemetry", TELEMETRY_DEFAULT)),
+    bShared_(false),
+    pMem_(NULL),
+    iMemSize_(0),
+    pHeader_(NULL),
+    pRing_(NULL){
+  if(!bEnable_)
+    return;
+
+  iMemSize_ = TELEMETRY_HEADER_SIZE +
+              sizeof(TelemetryRecord) * TELEMETRY_MAX_DISPLAY * TELEMETRY_RING_SIZE;
+
+  char path[PROPERTY_VALUE_MAX] = {0};
+  hwc_get_string_property("vendor.hwc.telemetry_file", TELEMETRY_FILE_DEFAULT, path);
+  if(strlen(path) > 0){
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0){
+      HWC2_ALOGE("open %s fail, errno=%d", path, errno);
+    }else{
+      if(ftruncate(fd, iMemSize_) == 0){
+        pMem_ = mmap(NULL, iMemSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(pMem_ == MAP_FAILED){
+          HWC2_ALOGE("mmap %s fail, errno=%d", path, errno);
+          pMem_ = NULL;
+        }else{
+          bShared_ = true;
+        }
+      }else{
+        HWC2_ALOGE("ftruncate %s fail, errno=%d", path, errno);
+      }
+      // mmap 之后 fd 可以关闭
+      close(fd);
+    }
+  }
+
+  if(pMem_ == NULL){
+    pMem_ = mmap(NULL, iMemSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(pMem_ == MAP_FAILED){
+      HWC2_ALOGE("mmap telemetry ring fail, errno=%d", errno);
+      pMem_ = NULL;
+      bEnable_ = false;
+      return;
+    }
+  }
+
+  memset(pMem_, 0, iMemSize_);
+  pRing_ = reinterpret_cast<TelemetryRecord*>(static_cast<char*>(pMem_) + TELEMETRY_HEADER_SIZE);
+  for(int i = 0; i < TELEMETRY_MAX_DISPLAY * TELEMETRY_RING_SIZE; i++)
+    pRing_[i].frame_no = TELEMETRY_INVALID_FRAME;
+
+  TelemetryHeader *header = static_cast<TelemetryHeader*>(pMem_);
+  for(int i = 0; i < TELEMETRY_MAX_DISPLAY; i++)
+    header->display_id[i] = TELEMETRY_FREE_SLOT;
+  header->version = TELEMETRY_VERSION;
+  header->max_display = TELEMETRY_MAX_DISPLAY;
+  header->ring_size = TELEMETRY_RING_SIZE;
+  header->record_size = sizeof(TelemetryRecord);
+  header->stage_cnt = kTmStageCnt;
+  // magic 最后写入，读者据此判断布局已就绪
+  __atomic_store_n(&header->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+  pHeader_ = header;
+}
+
+DrmTelemetry::~DrmTelemetry(){
+  if(pMem_)
+    munmap(pMem_, iMemSize_);
+}
+
+// 按完整 display id 查找环形缓冲区，拼接屏的高位标记不能丢弃，否则会与主屏共用
+int DrmTelemetry::GetSlot(int display){
+  for(int i = 0; i < TELEMETRY_MAX_DISPLAY; i++){
+    int32_t id = __atomic_load_n(&pHeader_->display_id[i], __ATOMIC_ACQUIRE);
+    if(id == display)
+      return i;
+    if(id != TELEMETRY_FREE_SLOT)
+      continue;
+    // 多个线程可能同时为不同 display 分配
+    int32_t expected = TELEMETRY_FREE_SLOT;
+    if(__atomic_compare_exchange_n(&pHeader_->display_id[i], &expected, display,
+                                   false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return i;
+    if(expected == display)
+      return i;
+  }
+  return -1;
+}
+
+TelemetryRecord *DrmTelemetry::GetRecord(int display, uint64_t frame_no){
+  if(!bEnable_)
+    return NULL;
+  int slot = GetSlot(display);
+  if(slot < 0)
+    return NULL;
+  return &pRing_[slot * TELEMETRY_RING_SIZE + (frame_no % TELEMETRY_RING_SIZE)];
+}
+
+void DrmTelemetry::Begin(int display, uint64_t frame_no){
+  TelemetryRecord *record = GetRecord(display, frame_no);
+  if(!record)
+    return;
+
+  __atomic_store_n(&record->frame_no, TELEMETRY_INVALID_FRAME, __ATOMIC_RELEASE);
+  for(int i = 0; i < kTmStageCnt; i++)
+    __atomic_store_n(&record->ts[i], 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->policy, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->overlay_cnt, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->gles_cnt, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->rga_cnt, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->svep_cnt, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->bandwidth_mb, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->ts[kTmValidateStart], TelemetryNowNs(), __ATOMIC_RELAXED);
+  __atomic_store_n(&record->frame_no, frame_no, __ATOMIC_RELEASE);
+}
+
+void DrmTelemetry::Mark(int display, uint64_t frame_no, TelemetryStage stage){
+  TelemetryRecord *record = GetRecord(display, frame_no);
+  if(!record || __atomic_load_n(&record->frame_no, __ATOMIC_ACQUIRE) != frame_no)
+    return;
+  __atomic_store_n(&record->ts[stage], TelemetryNowNs(), __ATOMIC_RELEASE);
+}
+
+void DrmTelemetry::SetFrameInfo(int display, uint64_t frame_no, const TelemetryFrameInfo &info){
+  TelemetryRecord *record = GetRecord(display, frame_no);
+  if(!record || __atomic_load_n(&record->frame_no, __ATOMIC_ACQUIRE) != frame_no)
+    return;
+  __atomic_store_n(&record->policy, (uint32_t)info.policy, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->overlay_cnt, info.overlay_cnt, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->gles_cnt, info.gles_cnt, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->rga_cnt, info.rga_cnt, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->svep_cnt, info.svep_cnt, __ATOMIC_RELAXED);
+  __atomic_store_n(&record->bandwidth_mb, info.bandwidth_mb, __ATOMIC_RELEASE);
+}
+
+bool DrmTelemetry::ReadRecord(int slot, int index, TelemetryRecord *out){
+  TelemetryRecord *record = &pRing_[slot * TELEMETRY_RING_SIZE + index];
+  uint64_t frame_no = __atomic_load_n(&record->frame_no, __ATOMIC_ACQUIRE);
+  if(frame_no == TELEMETRY_INVALID_FRAME)
+    return false;
+  for(int i = 0; i < kTmStageCnt; i++)
+    out->ts[i] = __atomic_load_n(&record->ts[i], __ATOMIC_ACQUIRE);
+  out->policy = __atomic_load_n(&record->policy, __ATOMIC_RELAXED);
+  out->overlay_cnt = __atomic_load_n(&record->overlay_cnt, __ATOMIC_RELAXED);
+  out->gles_cnt = __atomic_load_n(&record->gles_cnt, __ATOMIC_RELAXED);
+  out->rga_cnt = __atomic_load_n(&record->rga_cnt, __ATOMIC_RELAXED);
+  out->svep_cnt = __atomic_load_n(&record->svep_cnt, __ATOMIC_RELAXED);
+  out->bandwidth_mb = __atomic_load_n(&record->bandwidth_mb, __ATOMIC_RELAXED);
+  out->frame_no = frame_no;
+  // 拷贝期间被新帧覆盖则丢弃
+  return __atomic_load_n(&record->frame_no, __ATOMIC_ACQUIRE) == frame_no;
+}
+
+void DrmTelemetry::DumpDisplay(String8 &output, int slot){
+  int display = __atomic_load_n(&pHeader_->display_id[slot], __ATOMIC_ACQUIRE);
+  if(display == TELEMETRY_FREE_SLOT)
+    return;
+
+  std::vector<TelemetryRecord> records;
+  records.reserve(TELEMETRY_RING_SIZE);
+  for(int i = 0; i < TELEMETRY_RING_SIZE; i++){
+    TelemetryRecord record;
+    if(ReadRecord(slot, i, &record))
+      records.push_back(record);
+  }
+  if(records.empty())
+    return;
+
+  uint32_t policy_cnt[kTmPolicyCnt] = {0};
+  uint64_t overlay = 0, gles = 0, rga = 0, svep = 0, bandwidth = 0;
+  for(auto &record : records){
+    if(record.policy < kTmPolicyCnt)
+      policy_cnt[record.policy]++;
+    overlay += record.overlay_cnt;
+    gles += record.gles_cnt;
+    rga += record.rga_cnt;
+    svep += record.svep_cnt;
+    bandwidth += record.bandwidth_mb;
+  }
+
+  size_t cnt = records.size();
+  output.appendFormat(" Display=0x%x frames=%zu avg layers: overlay=%.1f gles=%.1f rga=%.1f svep=%.1f bandwidth=%" PRIu64 "MB/s\n",
+                      display, cnt, overlay * 1.0 / cnt, gles * 1.0 / cnt,
+                      rga * 1.0 / cnt, svep * 1.0 / cnt, bandwidth / cnt);
+  output.append("  policy:");
+  for(int i = 0; i < kTmPolicyCnt; i++){
+    if(policy_cnt[i])
+      output.appendFormat(" %s=%u", kPolicyName[i], policy_cnt[i]);
+  }
+  output.append("\n");
+
+  output.append("  stage(us)      cnt      p50      p90      p99      max\n");
+  std::vector<int64_t> costs;
+  costs.reserve(cnt);
+  for(auto &segment : kSegments){
+    costs.clear();
+    for(auto &record : records){
+      int64_t start = record.ts[segment.start];
+      int64_t end = record.ts[segment.end];
+      if(start > 0 && end >= start)
+        costs.push_back((end - start) / 1000);
+    }
+    if(costs.empty())
+      continue;
+    std::sort(costs.begin(), costs.end());
+    size_t n = costs.size();
+    output.appendFormat("  %-10s %8zu %8" PRIi64 " %8" PRIi64 " %8" PRIi64 " %8" PRIi64 "\n",
+                        segment.name, n, costs[n * 50 / 100], costs[n * 90 / 100],
+                        costs[n * 99 / 100], costs[n - 1]);
+  }
+}
+
+void DrmTelemetry::Dump(String8 &output){
+  if(!bEnable_)
+    return;
+  output.appendFormat("Telemetry: ring=%d shared=%d\n", TELEMETRY_RING_SIZE, bShared_);
+  for(int slot = 0; slot < TELEMETRY_MAX_DISPLAY; slot++)
+    DumpDisplay(output, slot);
+}
+
+} // namespace android